@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 #pragma once
+#include <span>
 #include <string_view>
 #include <string>
 
@@ -24,6 +25,29 @@ class CodeConvert
 
 public:
 
+    /*
+    Result of a conversion into a caller-provided buffer.
+    */
+    struct SpanResult
+    {
+        size_t Consumed;     // Number of input units (bytes or char16s) consumed.
+        size_t Produced;     // Number of output units (char16s or bytes) written.
+        LSTATUS Status;      // ERROR_SUCCESS or an error code (see below).
+        bool NeedMoreOutput; // Stopped because the output buffer is full.
+    };
+
+    /*
+    Position tracking for Validate. Default-initialize, then pass the same
+    object to Validate for each consecutive chunk of the input.
+    */
+    struct ValidateResult
+    {
+        size_t Consumed = 0; // Number of input bytes consumed by the last call.
+        size_t Offset = 0;   // Offset (in bytes from start of input) of the next unconsumed byte.
+        size_t Line = 1;     // 1-based line number of Offset.
+        size_t Column = 1;   // 1-based column (in characters) of Offset.
+    };
+
     /*
     Returns true if the specified code page category is likely to work well
     with this class. This will return true for Sbcs, Dbcs, or Utf. It will
@@ -112,6 +136,13 @@ public:
     - utf16Output will be resized as necessary to store the output.
     - utf16OutputPos will be updated to reflect the used output size.
     - May throw in case of out-of-memory (when utf16Output is resized).
+    - For UTF input, invalid sequences are replaced with U+FFFD. If mb2wcFlags includes
+      MB_ERR_INVALID_CHARS, returns ERROR_NO_UNICODE_TRANSLATION if any replacement was
+      made (the converted output is still stored).
+    - Common SBCS code pages (1252, 437, 850, ISO-8859) use built-in tables. On Windows,
+      other SBCS code pages use tables built from the OS. For table-driven SBCS input
+      with MB_ERR_INVALID_CHARS, an undefined byte results in
+      ERROR_NO_UNICODE_TRANSLATION (the converted output is still stored).
     - Returns ERROR_SUCCESS or any error returned by MultiByteToWideChar.
     */
     LSTATUS
@@ -122,6 +153,62 @@ public:
         size_t& utf16OutputPos, // <= utf16Output.size()
         unsigned mb2wcFlags = 0) const;
 
+    /*
+    Converts a chunk of encoded input to UTF-16 output in a caller-provided buffer.
+    Does not allocate (except for building code page tables on first use).
+    - Conversion consumes as much of encodedInput as possible, subject to the space
+      available in utf16Output. It may stop before the end if encodedInput ends in the
+      middle of a character, or if utf16Output is full (NeedMoreOutput will be true).
+    - An invalid sequence may need to be converted together with the following
+      character. An output buffer with room for at least 4 char16s always makes
+      progress.
+    - Output is written to utf16Output[0..Produced).
+    - Returns the same status codes as the std::u16string& overload in Status.
+    */
+    SpanResult
+    EncodedToUtf16(
+        std::string_view encodedInput,
+        std::span<char16_t> utf16Output,
+        unsigned mb2wcFlags = 0) const;
+
+    /*
+    Checks a chunk of encoded input without producing any output. Input is
+    valid if EncodedToUtf16 with MB_ERR_INVALID_CHARS would succeed.
+    - Validation consumes as much of input as possible. It stops at the first
+      invalid character, or before an incomplete character at the end of
+      input (the caller should pass the unconsumed bytes to the next call, or
+      treat them as invalid if there is no more input).
+    - result.Consumed is set to the number of bytes consumed. result.Offset,
+      Line, and Column are advanced past the consumed bytes, so after an error
+      they give the position of the first invalid character. Line numbers
+      advance after each LF. Columns count characters (code points).
+    - UTF-8 uses a vectorized validator. Other encodings are decoded into a
+      fixed-size stack buffer.
+    - Returns ERROR_SUCCESS, ERROR_NO_UNICODE_TRANSLATION for invalid input,
+      or any error returned by MultiByteToWideChar.
+    */
+    LSTATUS
+    Validate(
+        std::string_view input,
+        ValidateResult& result) const;
+
+    /*
+    Finds a place to split input so that the two halves can be converted
+    independently (e.g. in parallel), with the same result as converting
+    input in one piece. Requires that input starts at a character boundary.
+    - Returns a position <= pos that is not inside a character. For UTF-8,
+      this is the start of a sequence. For UTF-16 and UTF-32, it is aligned
+      and not inside a surrogate pair. For DBCS, the lead bytes before pos
+      are paired up the same way EncodedToUtf16 does it.
+    - Returns 0 if no split point was found, e.g. for a long run of bytes that
+      could be DBCS lead bytes, or for code pages that are neither SBCS, DBCS,
+      nor UTF.
+    */
+    size_t
+    SplitPosition(
+        std::string_view input,
+        size_t pos) const noexcept;
+
     /*
     Converts a chunk of UTF-16 input to encoded output and appends it to encodedOutput.
     - Requires: utf16InputPos <= utf16Input.size().
@@ -138,6 +225,12 @@ public:
     - encodedOutputPos will be updated to reflect the used output size.
     - May throw in case of out-of-memory (when encodedOutput is resized).
     - If pUsedDefaultChar != null and default char is used, sets *pUsedDefaultChar = true.
+    - For UTF output, unmatched surrogates are replaced with U+FFFD. If wc2mbFlags
+      includes WC_ERR_INVALID_CHARS, returns ERROR_NO_UNICODE_TRANSLATION if any
+      replacement was made (the converted output is still stored).
+    - For table-driven SBCS output, best-fit mappings (used unless wc2mbFlags includes
+      WC_NO_BEST_FIT_CHARS) come from WideCharToMultiByte. Without Windows, only exact
+      mappings are used.
     - Returns ERROR_SUCCESS or any error returned by WideCharToMultiByte.
     */
     LSTATUS
@@ -149,4 +242,23 @@ public:
         unsigned wc2mbFlags = 0,
         _In_opt_ PCCH pDefaultChar = nullptr,
         _Inout_opt_ bool* pUsedDefaultChar = nullptr) const;
+
+    /*
+    Converts a chunk of UTF-16 input to encoded output in a caller-provided buffer.
+    Does not allocate (except for building code page tables on first use).
+    - Conversion consumes as much of utf16Input as possible, subject to the space
+      available in encodedOutput. It may stop before the end if utf16Input ends with a
+      high surrogate, or if encodedOutput is full (NeedMoreOutput will be true).
+    - An unmatched high surrogate is converted together with the following character.
+      An output buffer with room for at least 8 bytes always makes progress.
+    - Output is written to encodedOutput[0..Produced).
+    - Returns the same status codes as the std::string& overload in Status.
+    */
+    SpanResult
+    Utf16ToEncoded(
+        std::u16string_view utf16Input,
+        std::span<char> encodedOutput,
+        unsigned wc2mbFlags = 0,
+        _In_opt_ PCCH pDefaultChar = nullptr,
+        _Inout_opt_ bool* pUsedDefaultChar = nullptr) const;
 };
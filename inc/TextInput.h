@@ -14,8 +14,10 @@ enum class TextInputFlags : uint8_t
     FoldCRLF = 0x01, // Convert CRLF or CR to LF.
     ConsumeBom = 0x02, // If input starts with BOM, consume BOM and override codepage.
     InvalidMbcsError = 0x04, // Use MB_ERR_INVALID_CHARS in conversion.
+    RawBytes = 0x08, // For byte, file, or source input, don't convert. Use Bytes() and ReadNextBytes(). Ignored if FoldCRLF is set and input is not UTF-8.
     CheckConsole = 0x10, // If input is a console, use ReadConsoleW and override codepage.
     ConsoleCtrlZ = 0x20, // If using ReadConsoleW, Read() returns immediately for Ctrl-Z.
+    ReadAhead = 0x40, // For file or pipe input (not Mapped), read the next chunk on a thread pool thread while the current chunk is processed. Close cancels a pending read.
     Default = InvalidMbcsError | CheckConsole | ConsoleCtrlZ
 };
 DEFINE_ENUM_FLAG_OPERATORS(TextInputFlags);
@@ -27,6 +29,59 @@ enum class TextInputMode : uint8_t
     Bytes,
     File,
     Console,
+    Mapped, // Large on-disk file read through a memory-mapped view.
+    BorrowedBytes, // Caller's bytes, converted a window at a time (see OpenBorrowedBytes).
+    Source, // Caller-supplied TextInputSource.
+};
+
+/*
+Supplies input bytes to a TextInput opened with OpenSource, e.g. from a socket,
+a decompressor, or another in-process producer. TextInput pulls from the
+source as it needs more input.
+*/
+class TextInputSource
+{
+public:
+
+    virtual
+    ~TextInputSource() = default;
+
+    /*
+    Copies up to cbMax bytes of input to pBuffer and returns the number of
+    bytes copied. Blocks until at least one byte is available. Returns 0 only
+    at end of input (Read is not called again after that). Chunks may split
+    multi-byte characters. May throw; the exception propagates out of the
+    TextInput method that was reading.
+    */
+    virtual size_t
+    Read(
+        _Out_writes_to_(cbMax, return) char* pBuffer,
+        size_t cbMax) = 0;
+};
+
+namespace TextToolsImpl
+{
+    struct TextInputReadAhead;
+
+    struct TextInputReadAhead_delete
+    {
+        void operator()(TextInputReadAhead* p) const noexcept;
+    };
+}
+
+/*
+Tuning for reads from files and pipes. Reads start at PipeBufferSize or
+FileBufferSize (depending on the handle type). Each time a read fills the
+buffer, the read size doubles, up to MaxBufferSize. For Mapped or
+BorrowedBytes input, each read adds MappedChunkSize bytes. All sizes must be
+nonzero.
+*/
+struct TextInputOptions
+{
+    unsigned PipeBufferSize = 4096; // Small so interactive pipes see input promptly.
+    unsigned FileBufferSize = 0x10000;
+    unsigned MaxBufferSize = 0x400000;
+    unsigned MappedChunkSize = 0x40000;
 };
 
 class TextInput
@@ -36,6 +91,26 @@ class TextInput
 
     TextToolsUniqueHandle m_inputOwner;
     HANDLE m_inputHandle;
+    TextInputSource* m_source; // Borrowed. Non-null in Source mode until end of input.
+    TextInputOptions m_options;
+    unsigned m_readSize;
+
+    // Must be destroyed before m_inputOwner (cancels and waits for any pending read).
+    std::unique_ptr<TextToolsImpl::TextInputReadAhead, TextToolsImpl::TextInputReadAhead_delete> m_readAhead;
+
+    // Mapped mode: m_view maps file bytes [m_viewOffset..m_viewOffset+m_viewSize).
+    // Bytes [m_mappedPos..m_mappedEnd) of the view are pending (not consumed).
+    // BorrowedBytes mode: same, but the view is m_borrowedBytes.
+    TextToolsUniqueHandle m_mapping;
+    TextToolsUniqueView m_view;
+    uint64_t m_fileSize;
+    uint64_t m_viewOffset;
+    size_t m_viewSize;
+    size_t m_mappedPos;
+    size_t m_mappedEnd;
+    size_t m_prefetchEnd;
+    std::string_view m_borrowedBytes;
+
     CodeConvert m_codeConvert;
     TextInputMode m_mode;
     TextInputFlags m_flags;
@@ -47,42 +122,137 @@ class TextInput
     constexpr bool
     IsFlagSet(TextInputFlags flag) const noexcept;
 
+    // True if Mode is Mapped or BorrowedBytes, i.e. pending bytes are
+    // [m_mappedPos..m_mappedEnd) of a view instead of m_bytes.
+    constexpr bool
+    IsViewMode() const noexcept;
+
+    // True if the handle or source has not yet reached end of input.
+    bool
+    HasMoreInput() const noexcept;
+
     void
     SetCodeConvert(unsigned codePage);
 
     void
     FoldCRLF() noexcept;
 
+    // Same as FoldCRLF, but for the UTF-8 bytes in m_bytes[pos..m_bytesPos).
+    void
+    FoldCRLFBytes(size_t pos) noexcept;
+
     void
     ConsumeBytes(size_t consumedBytes) noexcept;
 
+    // Gets the pending bytes: m_bytes[0..m_bytesPos), or the pending part of
+    // the view in Mapped or BorrowedBytes mode.
+    std::string_view
+    PendingBytes() const noexcept;
+
     /*
-    Clears m_chars. Fills m_chars from m_bytes. Calls FoldCRLF().
+    Clears m_chars. Fills m_chars from PendingBytes(). Calls FoldCRLF().
     Throws for conversion failure.
     */
     void
     Convert();
 
+    // Reads from the handle (or source) into m_bytes.
     void
     ReadBytesFromFile();
 
     void
     ReadBytesFromFile(DWORD cbMaxToRead);
 
+    // Called after a read fills the requested size.
+    void
+    GrowReadSize() noexcept;
+
+    // Starts reading the next chunk on a thread pool thread.
+    void
+    StartReadAhead();
+
+    // Waits for the read started by StartReadAhead and appends its bytes.
+    void
+    FinishReadAhead();
+
     void
     ReadCharsFromConsole();
 
+    /*
+    Creates a mapping for m_inputHandle and maps the first view. Returns false
+    (leaving the mapping closed) if the file is too small to be worth mapping
+    or if it cannot be mapped.
+    */
+    bool
+    MapFile() noexcept;
+
+    /*
+    Maps a view of the file starting at or just before fileOffset. Sets
+    m_mappedPos to the position of fileOffset within the view. If a full-size
+    view can't be mapped, retries with smaller views that still hold at least
+    cbMin bytes starting at fileOffset.
+    */
+    bool
+    MapView(uint64_t fileOffset, size_t cbMin) noexcept;
+
+    /*
+    Extends the pending bytes by up to one chunk, sliding the view forward if
+    necessary. Returns false at end-of-file. If the next view can't be mapped,
+    switches to ReadFile (see UnmapAndReadFile).
+    */
+    bool
+    MapNextBytes();
+
+    /*
+    Mapped mode: copies the pending bytes to m_bytes, closes the mapping,
+    switches to File mode, and reads the rest of the file with ReadFile.
+    Reads the next chunk. Returns false at end-of-file.
+    */
+    bool
+    UnmapAndReadFile();
+
+    // Mapped or BorrowedBytes mode: extends the pending bytes by up to one
+    // chunk. Returns false at end of input.
+    bool
+    NextViewBytes();
+
+    // File or Source mode: reads the first few bytes to consume a BOM (if
+    // ConsumeBom is set).
+    void
+    ReadBom();
+
+    // Finishes an Open of a handle or source: clears RawBytes if it isn't in
+    // effect, sets up ReadAhead, and loads the first chunk.
+    void
+    FinishOpen();
+
     void
     OpenHandle(
         TextToolsUniqueHandle inputOwner,
         _In_ HANDLE inputHandle,
         unsigned codePage,
-        TextInputFlags flags);
+        TextInputFlags flags,
+        bool mapFile);
 
 public:
 
     TextInput() noexcept;
 
+    explicit
+    TextInput(TextInputOptions const& options) noexcept;
+
+    /*
+    Gets the read tuning options.
+    */
+    TextInputOptions const&
+    Options() const noexcept;
+
+    /*
+    Sets the read tuning options. Takes effect at the next Open.
+    */
+    void
+    SetOptions(TextInputOptions const& options) noexcept;
+
     /*
     Closes any existing input.
     */
@@ -105,7 +275,7 @@ public:
 
     /*
     Closes any existing input, then converts inputBytes to UTF16 and stores the
-    result in the Chars() buffer.
+    result in the Chars() buffer. For large inputs, consider OpenBorrowedBytes.
     */
     void
     OpenBytes(
@@ -113,6 +283,21 @@ public:
         unsigned codePage = CP_ACP,
         TextInputFlags flags = TextInputFlags::Default);
 
+    /*
+    Closes any existing input, then sets up to convert inputBytes a window
+    (MappedChunkSize bytes) at a time, like a file, instead of converting it
+    all up front. Reads and converts the first window. inputBytes is borrowed
+    and must remain valid until Close. Peak memory does not depend on the
+    size of inputBytes. If RawBytes and FoldCRLF are both set, this behaves
+    like OpenBytes (Mode = Bytes), since folding raw bytes needs a writable
+    copy.
+    */
+    void
+    OpenBorrowedBytes(
+        std::string_view inputBytes,
+        unsigned codePage = CP_ACP,
+        TextInputFlags flags = TextInputFlags::Default);
+
     /*
     Closes any existing input. Sets up to read from the input file. Reads and
     converts an initial chunk of input.
@@ -126,7 +311,11 @@ public:
     /*
     Opens the specified file. If successful, closes any existing input, sets up
     to read from the input file, and reads and converts an initial chunk of
-    input.
+    input. Large on-disk files are read through a memory-mapped view (Mode()
+    returns Mapped) unless RawBytes and FoldCRLF are both set, since folding
+    raw bytes needs a writable buffer. If a later view can't be mapped (e.g.
+    out of address space), reading continues with ReadFile and Mode() changes
+    to File.
     */
     LSTATUS
     OpenFile(
@@ -134,6 +323,19 @@ public:
         unsigned codePage = CP_ACP,
         TextInputFlags flags = TextInputFlags::Default);
 
+    /*
+    Closes any existing input. Sets up to read from source (Mode = Source).
+    Reads and converts an initial chunk of input. The input is streamed: BOM
+    detection and multi-byte characters split across Read calls are handled
+    the same way as for pipes. source is borrowed and must remain valid until
+    Close. The CheckConsole and ReadAhead flags are ignored.
+    */
+    void
+    OpenSource(
+        TextInputSource& source,
+        unsigned codePage = CP_ACP,
+        TextInputFlags flags = TextInputFlags::Default);
+
     /*
     Gets text from the clipboard. If successful, closes any existing input and
     copies the clipboard text to the Chars() buffer.
@@ -143,6 +345,14 @@ public:
     OpenClipboard(
         TextInputFlags flags = TextInputFlags::Default);
 
+    /*
+    Gets the encoding of the input. If the input started with a BOM (and the
+    ConsumeBom flag was set), this is the encoding given by the BOM. For
+    console or chars input, this is UTF-16LE.
+    */
+    unsigned
+    CodePage() const noexcept;
+
     /*
     Gets the currently-available UTF-16LE characters.
     */
@@ -151,8 +361,35 @@ public:
 
     /*
     Clears the Chars() buffer, then loads more from the input source.
-    If no more input is available (e.g. end-of-file), returns false.
+    If no more input is available (e.g. end-of-file), returns false. A file,
+    pipe, or console read canceled by another thread (CancelSynchronousIo)
+    is treated as end of input.
     */
     bool
     ReadNextChars();
+
+    /*
+    Returns true if the input was opened with the RawBytes flag and the flag
+    is in effect, i.e. input is available via Bytes() and ReadNextBytes().
+    RawBytes is not in effect for console or chars input, or if FoldCRLF is
+    set and the input encoding is not UTF-8.
+    */
+    bool
+    IsRawBytes() const noexcept;
+
+    /*
+    Gets the currently-available unconverted bytes (in the CodePage() encoding).
+    Valid only if IsRawBytes(). If FoldCRLF is set, CRLF and CR have already
+    been converted to LF.
+    */
+    std::string_view
+    Bytes() const noexcept;
+
+    /*
+    Discards the first cbConsumed bytes of the Bytes() buffer, then loads more
+    from the input source. Valid only if IsRawBytes(). If no more input is available (e.g. end-of-file), returns
+    false. Any remaining bytes (e.g. an incomplete character) stay in Bytes().
+    */
+    bool
+    ReadNextBytes(size_t cbConsumed);
 };
@@ -4,6 +4,7 @@
 #pragma once
 #include "TextToolsCommon.h"
 #include "CodeConvert.h"
+#include "Transcoder.h"
 #include <memory>
 #include <string>
 #include <string_view>
@@ -16,6 +17,7 @@ enum class TextOutputFlags : uint8_t
     InvalidUtf16Error = 0x04, // Use WC_ERR_INVALID_CHARS in conversion (affects UTF output only).
     NoBestFitChars = 0x08, // Use WC_NO_BEST_FIT_CHARS (affects non-UTF output only).
     CheckConsole = 0x10, // If output is a console, use WriteConsoleW and override codepage.
+    WriteBehind = 0x20, // For file or pipe output, write full buffers on a thread pool thread while conversion continues.
     Default = InvalidUtf16Error | NoBestFitChars | CheckConsole
 };
 DEFINE_ENUM_FLAG_OPERATORS(TextOutputFlags);
@@ -27,15 +29,63 @@ enum class TextOutputMode : uint8_t
     Bytes,
     File,
     Console,
+    Sink,
 };
 
+/*
+Receives converted output from a TextOutput opened with OpenSink, e.g. to pass
+it to a callback, a network buffer, a ring buffer, or a compressor.
+*/
+class TextOutputSink
+{
+public:
+
+    virtual
+    ~TextOutputSink() = default;
+
+    /*
+    Consumes the next block of converted bytes. bytes points into the
+    TextOutput's buffer (nothing is copied before this call) and is valid only
+    until Write returns. May throw; the exception propagates out of the
+    TextOutput method that flushed.
+    */
+    virtual void
+    Write(std::string_view bytes) = 0;
+};
+
+namespace TextToolsImpl
+{
+    struct TextOutputWriteBehind;
+
+    struct TextOutputWriteBehind_delete
+    {
+        void operator()(TextOutputWriteBehind* p) const noexcept;
+    };
+
+    struct TextOutputParallel;
+
+    struct TextOutputParallel_delete
+    {
+        void operator()(TextOutputParallel* p) const noexcept;
+    };
+}
+
 class TextOutput
 {
     std::string m_bytes;
     std::u16string m_chars;
+    std::string m_crlfBytes; // Transcoded bytes waiting for CRLF expansion.
 
     TextToolsUniqueHandle m_outputOwner;
     HANDLE m_outputHandle;
+    TextOutputSink* m_sink; // Borrowed. Non-null only in Sink mode.
+
+    // Must be destroyed before m_outputOwner (waits for any pending write).
+    std::unique_ptr<TextToolsImpl::TextOutputWriteBehind, TextToolsImpl::TextOutputWriteBehind_delete> m_writeBehind;
+
+    // Created by the first WriteBytesParallel.
+    std::unique_ptr<TextToolsImpl::TextOutputParallel, TextToolsImpl::TextOutputParallel_delete> m_parallel;
+
     CodeConvert m_codeConvert;
     bool m_codeConvertUtf;
     TextOutputMode m_mode;
@@ -44,10 +94,15 @@ class TextOutput
 
     size_t m_bytesPos;
     size_t m_charsPos;
+    size_t m_flushSize; // File or Sink mode: flush when m_bytesPos reaches this.
 
     constexpr bool
     IsFlagSet(TextOutputFlags flag) const noexcept;
 
+    // True if Mode is File or Sink, i.e. m_bytes is flushed by FlushFile.
+    constexpr bool
+    IsFlushMode() const noexcept;
+
     void
     SetCodeConvert(unsigned codePage);
 
@@ -59,9 +114,18 @@ class TextOutput
     void
     InsertBom();
 
+    // Writes m_bytes to the file (or passes it to the sink).
     void
     FlushFile();
 
+    // Waits for the pending write-behind (if any). Throws if it failed.
+    void
+    FinishWriteBehind();
+
+    // Throws if a write-behind has already failed. Does not wait.
+    void
+    ThrowIfWriteBehindFailed();
+
     void
     FlushConsole(std::u16string_view pendingChars);
 
@@ -91,6 +155,15 @@ class TextOutput
     void
     AppendChars(std::u16string_view newChars);
 
+    // Appends already-converted bytes (expanding CRLF if needed). May flush.
+    // Swaps (instead of copying) encoded into m_bytes when possible.
+    void
+    AppendEncodedBytes(std::string& encoded, size_t encodedSize);
+
+    // Appends UTF-8 bytes to m_bytes, converting LF to CRLF.
+    void
+    AppendBytesAndExpandCRLF(std::string_view newBytes);
+
     void
     OpenHandle(
         TextToolsUniqueHandle outputOwner,
@@ -109,6 +182,7 @@ public:
 
     /*
     Writes any buffered bytes to file/console (as appropriate for Mode).
+    With WriteBehind, waits for the writes to complete.
     */
     void
     Flush();
@@ -163,6 +237,26 @@ public:
         unsigned codePage = CP_ACP,
         TextOutputFlags flags = TextOutputFlags::Default);
 
+    /*
+    Flushes and closes any existing output, then opens with Mode = Sink
+    (convert bytes and pass them to sink.Write). Bytes are passed to the sink
+    in blocks of roughly 16 KB, so the TextOutput's buffer stays bounded.
+    sink is borrowed and must remain valid until Close. The CheckConsole and
+    WriteBehind flags are ignored.
+    */
+    void
+    OpenSink(
+        TextOutputSink& sink,
+        unsigned codePage = CP_ACP,
+        TextOutputFlags flags = TextOutputFlags::Default);
+
+    /*
+    Gets the encoding of the output. For console or chars output, this is
+    UTF-16LE.
+    */
+    unsigned
+    CodePage() const noexcept;
+
     /*
     Gets buffered in-memory chars. Valid only if Mode == Chars.
     */
@@ -185,4 +279,40 @@ public:
         std::u16string_view chars,
         _In_opt_ PCCH pDefaultChar = nullptr,
         _Inout_opt_ bool* pUsedDefaultChar = nullptr);
+
+    /*
+    Converts bytes from transcoder.From() encoding and appends the result to
+    output, without going through UTF-16 if the transcoder has a direct path.
+    Valid only if Mode is Bytes, File, or Sink and transcoder.To() is CodePage().
+    If the ExpandCRLF flag is set, CodePage() must be UTF-8.
+    mb2wcFlags is used for decoding the input (e.g. MB_ERR_INVALID_CHARS).
+    Returns the number of bytes consumed, which may be less than bytes.size()
+    if bytes ends in the middle of a character.
+    If the pUsedDefaultChar != null and the default char gets used, sets
+    *pUsedDefaultChar = true. Otherwise leaves pUsedDefaultChar at the prior value.
+    */
+    size_t
+    WriteBytes(
+        Transcoder const& transcoder,
+        std::string_view bytes,
+        unsigned mb2wcFlags,
+        _In_opt_ PCCH pDefaultChar = nullptr,
+        _Inout_opt_ bool* pUsedDefaultChar = nullptr);
+
+    /*
+    Same as WriteBytes, but splits bytes into chunks of at least 1 MB (at
+    positions from CodeConvert::SplitPosition) and converts the chunks in
+    parallel on the thread pool. Output is written in input order. Falls back
+    to WriteBytes if bytes is too small to split. Intended for large inputs,
+    e.g. Mapped TextInput with a large MappedChunkSize.
+    If a chunk fails to convert, the output of the chunks before it (and of
+    the failed chunk) is written before the error is thrown.
+    */
+    size_t
+    WriteBytesParallel(
+        Transcoder const& transcoder,
+        std::string_view bytes,
+        unsigned mb2wcFlags,
+        _In_opt_ PCCH pDefaultChar = nullptr,
+        _Inout_opt_ bool* pUsedDefaultChar = nullptr);
 };
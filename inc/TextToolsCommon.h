@@ -17,6 +17,12 @@ namespace TextToolsImpl
     {
         void operator()(HANDLE h) const noexcept;
     };
+
+    struct UnmapViewOfFile_delete
+    {
+        void operator()(void const* p) const noexcept;
+    };
 }
 
 using TextToolsUniqueHandle = std::unique_ptr<void, TextToolsImpl::CloseHandle_delete>;
+using TextToolsUniqueView = std::unique_ptr<void const, TextToolsImpl::UnmapViewOfFile_delete>;
@@ -0,0 +1,106 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+#pragma once
+#include "CodeConvert.h"
+#include <string_view>
+#include <string>
+
+/*
+Converts encoded character data directly from one encoding to another.
+Conversions from UTF-8 to UTF-16/UTF-32, from UTF-16/UTF-32 to UTF-8, and
+from table-driven SBCS code pages to UTF-8 use fused kernels that write the
+output encoding directly. UTF-8 to UTF-8 and UTF-16LE to UTF-16LE validate
+and copy the input. Other conversions decode to UTF-16 in small chunks
+(using a fixed-size stack buffer) and then encode.
+*/
+class Transcoder
+{
+    enum class Path : UINT8
+    {
+        Pivot,
+        Utf8ToUtf8,
+        Utf16ToUtf16,
+        Utf8ToUtf16,
+        Utf8ToUtf32,
+        Utf16ToUtf8,
+        Utf32ToUtf8,
+        SbcsToUtf8,
+    };
+
+    CodeConvert m_from;
+    CodeConvert m_to;
+    Path m_path;
+
+    LSTATUS
+    TranscodePivot(
+        std::string_view input,
+        size_t& inputPos,
+        std::string& output,
+        size_t& outputPos,
+        unsigned mb2wcFlags,
+        unsigned wc2mbFlags,
+        _In_opt_ PCCH pDefaultChar,
+        _Inout_opt_ bool* pUsedDefaultChar) const;
+
+public:
+
+    /*
+    Initializes a Transcoder that converts from the encoding of from to the
+    encoding of to.
+    */
+    Transcoder(CodeConvert from, CodeConvert to);
+
+    constexpr CodeConvert
+    From() const noexcept
+    {
+        return m_from;
+    }
+
+    constexpr CodeConvert
+    To() const noexcept
+    {
+        return m_to;
+    }
+
+    /*
+    Returns true if conversion uses a fused kernel, i.e. does not go through
+    UTF-16. (SBCS input still uses the UTF-16 pivot if mb2wcFlags contains
+    flags other than MB_PRECOMPOSED and MB_ERR_INVALID_CHARS.)
+    */
+    bool
+    IsDirect() const noexcept;
+
+    /*
+    Converts a chunk of input in the From() encoding to the To() encoding and
+    appends it to output.
+    - Requires: inputPos <= input.size().
+    - Requires: outputPos <= output.size().
+    - Requires: If To() is UTF, pDefaultChar and pUsedDefaultChar must be null.
+    - Conversion consumes as much of input as possible. It may stop before the
+      end if input ends in the middle of a character.
+    - inputPos will be updated to reflect the position of the next unconsumed
+      input, or will be set to input.size() if all input was consumed.
+    - Output is written starting at output[outputPos]. output will be resized
+      as necessary. outputPos will be updated to reflect the used output size.
+    - May throw in case of out-of-memory (when output is resized).
+    - mb2wcFlags applies to decoding the From() encoding as in
+      CodeConvert::EncodedToUtf16. wc2mbFlags, pDefaultChar, and
+      pUsedDefaultChar apply to encoding the To() encoding as in
+      CodeConvert::Utf16ToEncoded.
+    - Invalid input is replaced with U+FFFD. If mb2wcFlags includes
+      MB_ERR_INVALID_CHARS, returns ERROR_NO_UNICODE_TRANSLATION if any
+      replacement was made (the converted output is still stored).
+    - Returns ERROR_SUCCESS or any error returned by CodeConvert.
+    */
+    LSTATUS
+    Transcode(
+        std::string_view input,
+        size_t& inputPos, // <= input.size()
+        std::string& output,
+        size_t& outputPos, // <= output.size()
+        unsigned mb2wcFlags = 0,
+        unsigned wc2mbFlags = 0,
+        _In_opt_ PCCH pDefaultChar = nullptr,
+        _Inout_opt_ bool* pUsedDefaultChar = nullptr) const;
+};
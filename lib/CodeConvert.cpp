@@ -4,8 +4,12 @@
 #include "pch.h"
 #include <CodeConvert.h>
 #include <CodePageInfo.h>
+#include "DbcsCodec.h"
+#include "SbcsCodec.h"
+#include "UtfKernels.h"
 #include "Utility.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <stdexcept>
 
@@ -14,202 +18,306 @@ using namespace TextToolsImpl;
 // Ensure that cOutputNeeded <= INT_MAX/sizeof(WCHAR) by limiting cBatch to INT_MAX/sizeof(WCHAR).
 static constexpr int MultiByteBatchMax = INT_MAX / sizeof(WCHAR);
 
-static constexpr char16_t UnicodeReplacement = 0xFFFD;
-
 namespace
 {
-    struct UtfConvertResult
+    struct ChunkResult
     {
-        void const* InputPos;
-        void const* OutputPos;
-        LSTATUS UsedReplacement;
+        size_t Consumed;
+        size_t Produced;
+        bool UsedReplacement;
+        LSTATUS Error;
     };
+}
 
-    enum class ByteSwap : UINT8
+// Worst-case number of char16s produced from cbInput bytes of input.
+static size_t
+DecodeCapacity(unsigned codePage, size_t cbInput) noexcept
+{
+    switch (codePage | 1u)
     {
-        None,
-        Input,
-        Output
-    };
+    case CodePageUtf16BE: return cbInput / sizeof(char16_t);
+    case CodePageUtf32BE: return cbInput / sizeof(char32_t) * 2;
+    default: return cbInput; // Estimate for the MultiByteToWideChar path.
+    }
+}
 
-    template<ByteSwap Swap>
-    struct ByteSwapper
+// Largest input chunk (in bytes) whose worst-case output fits in cOutput char16s.
+static size_t
+DecodeChunkMax(unsigned codePage, size_t cOutput) noexcept
+{
+    size_t const cOutputMax = ~(size_t)0 / sizeof(char32_t);
+    if (cOutput > cOutputMax)
     {
-        static UINT16
-        Input16(UINT16 n) noexcept
-        {
-            if constexpr (Swap == ByteSwap::Input)
-                return _byteswap_ushort(n);
-            else
-                return n;
-        }
+        cOutput = cOutputMax;
+    }
 
-        static UINT32
-        Input32(UINT32 n) noexcept
-        {
-            if constexpr (Swap == ByteSwap::Input)
-                return _byteswap_ulong(n);
-            else
-                return n;
-        }
+    switch (codePage | 1u)
+    {
+    case CodePageUtf16BE: return cOutput * sizeof(char16_t);
+    case CodePageUtf32BE: return cOutput / 2 * sizeof(char32_t);
+    default: return cOutput;
+    }
+}
 
-        static UINT16
-        Output16(UINT16 n) noexcept
-        {
-            if constexpr (Swap == ByteSwap::Output)
-                return _byteswap_ushort(n);
-            else
-                return n;
-        }
+// Worst-case number of bytes produced from cchInput char16s of input.
+static size_t
+EncodeCapacity(unsigned codePage, size_t cchInput) noexcept
+{
+    size_t const cchInputMax = ~(size_t)0 / sizeof(char32_t);
+    if (cchInput > cchInputMax)
+    {
+        cchInput = cchInputMax;
+    }
 
-        static UINT32
-        Output32(UINT32 n) noexcept
-        {
-            if constexpr (Swap == ByteSwap::Output)
-                return _byteswap_ulong(n);
-            else
-                return n;
-        }
-    };
+    switch (codePage | 1u)
+    {
+    case CodePageUtf16BE: return cchInput * sizeof(char16_t);
+    case CodePageUtf32BE: return cchInput * sizeof(char32_t);
+    case CodePageUtf8: return codePage == CodePageUtf8 ? cchInput * 3 : cchInput * 2;
+    default: return SbcsCodec::Get(codePage) ? cchInput : cchInput * 2;
+    }
+}
+
+// Largest input chunk (in char16s) whose worst-case output fits in cbOutput bytes.
+static size_t
+EncodeChunkMax(unsigned codePage, size_t cbOutput) noexcept
+{
+    switch (codePage | 1u)
+    {
+    case CodePageUtf16BE: return cbOutput / sizeof(char16_t);
+    case CodePageUtf32BE: return cbOutput / sizeof(char32_t);
+    case CodePageUtf8: return codePage == CodePageUtf8 ? cbOutput / 3 : cbOutput / 2;
+    default: return SbcsCodec::Get(codePage) ? cbOutput : cbOutput / 2;
+    }
 }
 
-// Validates. If appropriate, byte-swaps.
-template<ByteSwap Swap>
-static UtfConvertResult
-Utf16ToUtf16(
-    _In_reads_(cInput) char16_t const* const pInput,
-    size_t const cInput,
-    _Pre_cap_(cInput) char16_t* const pOutput) noexcept
+// Converts a chunk of encoded input to UTF-16.
+// Except for the MultiByteToWideChar path, requires cOutput >= DecodeCapacity(cInput).
+// The MultiByteToWideChar path returns ERROR_INSUFFICIENT_BUFFER if nothing fits.
+static ChunkResult
+DecodeChunk(
+    unsigned codePage,
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cOutput, return.Produced) char16_t* pOutput,
+    size_t cOutput,
+    unsigned mb2wcFlags)
 {
-    static constexpr ByteSwapper<Swap> swap;
-    size_t iInput = 0;
-    LSTATUS usedReplacement = ERROR_SUCCESS;
+    UtfConvertResult result;
 
-    for (; iInput != cInput; iInput += 1)
+    switch (codePage | 1u) // Combine BE and LE cases
     {
-        auto const ch0 = swap.Input16(pInput[iInput]);
-        if (ch0 < 0xD800 || ch0 >= 0xE000)
-        {
-            // Not a surrogate.
-            pOutput[iInput] = swap.Output16(ch0);
-        }
-        else if (ch0 >= 0xDC00)
+    case CodePageUtf16BE: // Includes CodePageUtf16LE
+        result = Utf16ToUtf16(
+            reinterpret_cast<char16_t const*>(pInput), cInput / sizeof(char16_t), pOutput,
+            codePage == CodePageUtf16BE ? ByteSwap::Input : ByteSwap::None);
+        break;
+
+    case CodePageUtf32BE: // Includes CodePageUtf32LE
+        result = Utf32ToUtf16(
+            reinterpret_cast<char32_t const*>(pInput), cInput / sizeof(char32_t), pOutput,
+            codePage == CodePageUtf32BE ? ByteSwap::Input : ByteSwap::None);
+        break;
+
+    case CodePageUtf8: // Also matches 65000 (UTF-7), which is handled by default.
+
+        if (codePage == CodePageUtf8)
         {
-            // Unmatched low surrogate.
-            pOutput[iInput] = swap.Output16(UnicodeReplacement);
-            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+            result = Utf8ToUtf16(pInput, cInput, pOutput, ByteSwap::None);
+            break;
         }
-        else if (iInput + 1 == cInput)
+        [[fallthrough]];
+
+    default: // SBCS, DBCS
+
+        if (auto const pSbcs = SbcsCodec::Get(codePage);
+            pSbcs && (mb2wcFlags & ~(MB_PRECOMPOSED | MB_ERR_INVALID_CHARS)) == 0)
         {
-            // High surrogate at end of input. Don't consume it.
-            break;
+            bool const anyInvalid = pSbcs->Decode(pInput, cInput, pOutput);
+            return { cInput, cInput, anyInvalid, ERROR_SUCCESS };
         }
-        else if (
-            auto const ch1 = swap.Input16(pInput[iInput + 1]);
-            ch1 >= 0xDC00 && ch1 < 0xE000)
+        else if (auto const pDbcs = DbcsCodec::Get(codePage);
+            pDbcs && (mb2wcFlags & ~(MB_PRECOMPOSED | MB_ERR_INVALID_CHARS)) == 0)
         {
-            // Surrogate pair.
-            pOutput[iInput] = swap.Output16(ch0);
-            iInput += 1;
-            pOutput[iInput] = swap.Output16(ch1);
+            auto const dbcsResult = pDbcs->Decode(pInput, cInput, pOutput);
+            return { dbcsResult.InputUsed, dbcsResult.OutputUsed, dbcsResult.AnyInvalid, ERROR_SUCCESS };
         }
-        else
+
+        // Trim off an incomplete character sequence.
+        // Assume DBCS. If not DBCS, there are no lead bytes and we don't trim anything.
+        CPINFOEXW cpInfo;
+        LeadByteMap const leadBytes = GetCPInfoExW(codePage, 0, &cpInfo)
+            ? LeadByteMap(cpInfo.LeadByte)
+            : LeadByteMap();
+        size_t cbInput = leadBytes.CompleteLength(
+            pInput,
+            cInput < MultiByteBatchMax ? cInput : MultiByteBatchMax);
+        int const cOutputMax = cOutput < INT_MAX ? (int)cOutput : INT_MAX;
+
+        for (LSTATUS status = ERROR_SUCCESS; cbInput != 0;)
         {
-            // Unmatched high surrogate.
-            pOutput[iInput] = swap.Output16(UnicodeReplacement);
-            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+            int const cOutputWritten = cOutputMax == 0 ? 0 : MultiByteToWideChar(
+                codePage,
+                mb2wcFlags,
+                reinterpret_cast<PCCH>(pInput),
+                (int)cbInput,
+                reinterpret_cast<PWCH>(pOutput),
+                cOutputMax);
+            if (cOutputWritten > 0)
+            {
+                return { cbInput, (size_t)cOutputWritten, false, ERROR_SUCCESS };
+            }
+
+            status = cOutputMax == 0 ? ERROR_INSUFFICIENT_BUFFER : GetLastError();
+            assert(status != ERROR_SUCCESS);
+            if (status != ERROR_INSUFFICIENT_BUFFER)
+            {
+                return { 0, 0, false, status };
+            }
+
+            // Output too small. Try a smaller batch.
+            cbInput = leadBytes.CompleteLength(pInput, cbInput / 2);
+            if (cbInput == 0)
+            {
+                return { 0, 0, false, status };
+            }
         }
+
+        return { 0, 0, false, ERROR_SUCCESS };
     }
 
-    return { &pInput[iInput], &pOutput[iInput], usedReplacement };
+    return {
+        static_cast<size_t>(static_cast<UINT8 const*>(result.InputPos) - pInput),
+        static_cast<size_t>(static_cast<char16_t const*>(result.OutputPos) - pOutput),
+        result.UsedReplacement != ERROR_SUCCESS,
+        ERROR_SUCCESS };
 }
 
-// Validates. If appropriate, byte-swaps.
-template<ByteSwap Swap>
-static UtfConvertResult
-Utf16ToUtf32(
+// Converts a chunk of UTF-16 input to encoded output.
+// Except for the WideCharToMultiByte path, requires cOutput >= EncodeCapacity(cInput).
+// The WideCharToMultiByte path returns ERROR_INSUFFICIENT_BUFFER if nothing fits.
+static ChunkResult
+EncodeChunk(
+    unsigned codePage,
     _In_reads_(cInput) char16_t const* pInput,
-    size_t const cInput,
-    _Pre_cap_(cInput) char32_t* pOutput) noexcept
+    size_t cInput,
+    _Out_writes_to_(cOutput, return.Produced) UINT8* pOutput,
+    size_t cOutput,
+    unsigned wc2mbFlags,
+    _In_opt_ PCCH pDefaultChar,
+    _Inout_opt_ bool* pUsedDefaultChar)
 {
-    static constexpr ByteSwapper<Swap> swap;
-    size_t iInput = 0;
-    size_t iOutput = 0;
-    LSTATUS usedReplacement = ERROR_SUCCESS;
+    UtfConvertResult result;
 
-    for (; iInput != cInput; iInput += 1)
+    switch (codePage | 1u) // Combine BE and LE cases
     {
-        auto const ch0 = swap.Input16(pInput[iInput]);
-        if (ch0 < 0xD800 || ch0 >= 0xE000)
-        {
-            // Not a surrogate.
-            pOutput[iOutput++] = swap.Output32(ch0);
-        }
-        else if (ch0 >= 0xDC00)
-        {
-            // Unmatched low surrogate.
-            pOutput[iOutput++] = swap.Output32(UnicodeReplacement);
-            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
-        }
-        else if (iInput + 1 == cInput)
+    case CodePageUtf16BE: // Includes CodePageUtf16LE
+        result = Utf16ToUtf16(
+            pInput, cInput, reinterpret_cast<char16_t*>(pOutput),
+            codePage == CodePageUtf16BE ? ByteSwap::Output : ByteSwap::None);
+        break;
+
+    case CodePageUtf32BE: // Includes CodePageUtf32LE
+        result = Utf16ToUtf32(
+            pInput, cInput, reinterpret_cast<char32_t*>(pOutput),
+            codePage == CodePageUtf32BE ? ByteSwap::Output : ByteSwap::None);
+        break;
+
+    case CodePageUtf8: // Also matches 65000 (UTF-7), which is handled by default.
+
+        if (codePage == CodePageUtf8)
         {
-            // High surrogate at end of input. Don't consume it.
+            result = Utf16ToUtf8(pInput, cInput, pOutput, ByteSwap::None);
             break;
         }
-        else if (
-            auto const ch1 = swap.Input16(pInput[iInput + 1]);
-            ch1 >= 0xDC00 && ch1 < 0xE000)
-        {
-            // Surrogate pair.
-            pOutput[iOutput++] = swap.Output32(0x10000 + (((ch0 - 0xD800) << 10) | (ch1 - 0xDC00)));
-            iInput += 1;
-        }
-        else
-        {
-            // Unmatched high surrogate.
-            pOutput[iOutput++] = swap.Output32(UnicodeReplacement);
-            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
-        }
-    }
-
-    return { &pInput[iInput], &pOutput[iOutput], usedReplacement };
-}
+        [[fallthrough]];
 
-// Validates. If appropriate, byte-swaps.
-template<ByteSwap Swap>
-static UtfConvertResult
-Utf32ToUtf16(
-    _In_reads_(cInput) char32_t const* pInput,
-    size_t const cInput,
-    _Pre_cap_(cInput * 2) char16_t* pOutput) noexcept
-{
-    static constexpr ByteSwapper<Swap> swap;
-    size_t iInput = 0;
-    size_t iOutput = 0;
-    LSTATUS usedReplacement = ERROR_SUCCESS;
+    default: // SBCS, DBCS
 
-    for (; iInput != cInput; iInput += 1)
-    {
-        auto const ch = swap.Input32(pInput[iInput]);
-        if (ch <= 0xFFFF)
+        if (auto const pSbcs = SbcsCodec::Get(codePage);
+            pSbcs && (wc2mbFlags & ~WC_NO_BEST_FIT_CHARS) == 0)
         {
-            // Note: Not checking for surrogates, which would be errors if we were more strict.
-            pOutput[iOutput++] = swap.Output16(static_cast<char16_t>(ch));
+            auto const sbcsResult = pSbcs->Encode(
+                pInput,
+                cInput,
+                pOutput,
+                !(wc2mbFlags & WC_NO_BEST_FIT_CHARS),
+                pDefaultChar ? static_cast<UINT8>(*pDefaultChar) : pSbcs->DefaultChar());
+            if (sbcsResult.UsedDefaultChar && pUsedDefaultChar)
+            {
+                *pUsedDefaultChar = true;
+            }
+            return { sbcsResult.InputUsed, sbcsResult.OutputUsed, false, ERROR_SUCCESS };
         }
-        else if (ch <= 0x10FFFF)
+        else if (auto const pDbcs = DbcsCodec::Get(codePage);
+            pDbcs && (wc2mbFlags & ~WC_NO_BEST_FIT_CHARS) == 0)
         {
-            auto val = ch - 0x10000;
-            pOutput[iOutput++] = swap.Output16(static_cast<char16_t>(val >> 10) + 0xD800);
-            pOutput[iOutput++] = swap.Output16(static_cast<char16_t>(val & 0x3FF) + 0xDC00);
+            auto const dbcsResult = pDbcs->Encode(
+                pInput,
+                cInput,
+                pOutput,
+                !(wc2mbFlags & WC_NO_BEST_FIT_CHARS),
+                pDefaultChar ? static_cast<UINT8>(*pDefaultChar) : pDbcs->DefaultChar());
+            if (dbcsResult.UsedDefaultChar && pUsedDefaultChar)
+            {
+                *pUsedDefaultChar = true;
+            }
+            return { dbcsResult.InputUsed, dbcsResult.OutputUsed, false, ERROR_SUCCESS };
         }
-        else
+
+        size_t cchInput = cInput < MultiByteBatchMax ? cInput : MultiByteBatchMax;
+        int const cOutputMax = cOutput < INT_MAX ? (int)cOutput : INT_MAX;
+
+        for (LSTATUS status = ERROR_SUCCESS;;)
         {
-            pOutput[iOutput++] = swap.Output16(UnicodeReplacement);
-            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+            // Don't end with a high surrogate.
+            if (cchInput != 0 && pInput[cchInput - 1] >= 0xD800 && pInput[cchInput - 1] <= 0xDBFF)
+            {
+                cchInput -= 1;
+            }
+
+            if (cchInput == 0)
+            {
+                return { 0, 0, false, status };
+            }
+
+            BOOL localUsedDefaultChar = false;
+            int const cOutputWritten = cOutputMax == 0 ? 0 : WideCharToMultiByte(
+                codePage,
+                wc2mbFlags,
+                reinterpret_cast<PCWCH>(pInput),
+                (int)cchInput,
+                reinterpret_cast<PCH>(pOutput),
+                cOutputMax,
+                pDefaultChar,
+                pUsedDefaultChar ? &localUsedDefaultChar : nullptr);
+            if (cOutputWritten > 0)
+            {
+                if (localUsedDefaultChar && pUsedDefaultChar)
+                {
+                    *pUsedDefaultChar = true;
+                }
+
+                return { cchInput, (size_t)cOutputWritten, false, ERROR_SUCCESS };
+            }
+
+            status = cOutputMax == 0 ? ERROR_INSUFFICIENT_BUFFER : GetLastError();
+            assert(status != ERROR_SUCCESS);
+            if (status != ERROR_INSUFFICIENT_BUFFER)
+            {
+                return { 0, 0, false, status };
+            }
+
+            // Output too small. Try a smaller batch.
+            cchInput /= 2;
         }
     }
 
-    return { &pInput[iInput], &pOutput[iOutput], usedReplacement };
+    return {
+        static_cast<size_t>(static_cast<char16_t const*>(result.InputPos) - pInput),
+        static_cast<size_t>(static_cast<UINT8 const*>(result.OutputPos) - pOutput),
+        result.UsedReplacement != ERROR_SUCCESS,
+        ERROR_SUCCESS };
 }
 
 unsigned
@@ -270,393 +378,484 @@ CodeConvert::ThrowIfNotSupported() const
     return info.Category;
 }
 
-LSTATUS
-CodeConvert::EncodedToUtf16(
-    std::string_view encodedInput,
-    size_t& encodedInputPos,
-    std::u16string& utf16Output,
-    size_t& utf16OutputPos,
-    unsigned mb2wcFlags) const
+// Advances line and column past valid UTF-8.
+static void
+AdvancePosition(CodeConvert::ValidateResult& result, std::string_view utf8) noexcept
 {
-    LSTATUS status;
-
-    auto const pbInputBegin = reinterpret_cast<UINT8 const*>(encodedInput.data());
-    auto const pbInputEnd = pbInputBegin + encodedInput.size();
-    auto pbInput = pbInputBegin + encodedInputPos;
-    auto iOutput = utf16OutputPos;
-
-    assert(pbInputBegin <= pbInput);
-    assert(pbInput <= pbInputEnd);
-    assert(iOutput <= utf16Output.size());
-    if (pbInput < pbInputBegin ||
-        pbInputEnd < pbInput ||
-        utf16Output.size() < iOutput)
+    size_t const cLF = std::count(utf8.begin(), utf8.end(), '\n');
+    size_t lineStart = 0;
+    if (cLF != 0)
     {
-        status = ERROR_INVALID_PARAMETER;
-        goto Done;
+        result.Line += cLF;
+        result.Column = 1;
+        lineStart = utf8.rfind('\n') + 1;
     }
 
-    switch (m_codePage | 1u) // Combine BE and LE cases
+    for (size_t i = lineStart; i != utf8.size(); i += 1)
     {
-    case CodePageUtf16BE: // Includes CodePageUtf16LE
+        // Count lead bytes and ASCII, not trail bytes.
+        result.Column += (utf8[i] & 0xC0) != 0x80;
+    }
+}
+
+// Advances line and column past valid UTF-16.
+static void
+AdvancePosition(CodeConvert::ValidateResult& result, std::u16string_view utf16) noexcept
+{
+    size_t const cLF = std::count(utf16.begin(), utf16.end(), u'\n');
+    size_t lineStart = 0;
+    if (cLF != 0)
     {
-        size_t const cInput = (pbInputEnd - pbInput) / sizeof(char16_t);
-        auto const pInput = reinterpret_cast<char16_t const*>(pbInput);
-
-        // We need one char16 of output for each char16 of input.
-        EnsureSize(utf16Output, iOutput, cInput);
-        auto const pOutput = utf16Output.data() + iOutput;
-
-        auto const result = m_codePage == CodePageUtf16BE
-            ? Utf16ToUtf16<ByteSwap::Input>(pInput, cInput, pOutput)
-            : Utf16ToUtf16<ByteSwap::None>(pInput, cInput, pOutput);
-        encodedInputPos = static_cast<UINT8 const*>(result.InputPos) - pbInputBegin;
-        utf16OutputPos = static_cast<char16_t const*>(result.OutputPos) - utf16Output.data();
-        status = mb2wcFlags & MB_ERR_INVALID_CHARS ? result.UsedReplacement : ERROR_SUCCESS;
-        break;
+        result.Line += cLF;
+        result.Column = 1;
+        lineStart = utf16.rfind(u'\n') + 1;
     }
 
-    case CodePageUtf32BE: // Includes CodePageUtf32LE
+    for (size_t i = lineStart; i != utf16.size(); i += 1)
     {
-        size_t const cInput = (pbInputEnd - pbInput) / sizeof(char32_t);
-        auto const pInput = reinterpret_cast<char32_t const*>(pbInput);
-
-        // We need up to two char16s of output for each char32 of input.
-        EnsureSize(utf16Output, iOutput, cInput * 2);
-        auto const pOutput = utf16Output.data() + iOutput;
-
-        auto const result = m_codePage == CodePageUtf32BE
-            ? Utf32ToUtf16<ByteSwap::Input>(pInput, cInput, pOutput)
-            : Utf32ToUtf16<ByteSwap::None>(pInput, cInput, pOutput);
-        encodedInputPos = static_cast<UINT8 const*>(result.InputPos) - pbInputBegin;
-        utf16OutputPos = static_cast<char16_t const*>(result.OutputPos) - utf16Output.data();
-        status = mb2wcFlags & MB_ERR_INVALID_CHARS ? result.UsedReplacement : ERROR_SUCCESS;
-        break;
+        // Count high surrogates and non-surrogates, not low surrogates.
+        result.Column += (utf16[i] & 0xFC00) != 0xDC00;
     }
+}
 
-    default: // Includes CodePageUtf8
+LSTATUS
+CodeConvert::Validate(
+    std::string_view input,
+    ValidateResult& result) const
+{
+    LSTATUS status = ERROR_SUCCESS;
+    size_t consumed = 0;
 
-        // Split into batches no larger than MultiByteBatchMax.
-        for (int cbInput; pbInput < pbInputEnd; pbInput += cbInput)
+    if (m_codePage == CodePageUtf8)
+    {
+        bool invalid;
+        consumed = ValidateUtf8(reinterpret_cast<UINT8 const*>(input.data()), input.size(), &invalid);
+        AdvancePosition(result, input.substr(0, consumed));
+        status = invalid ? ERROR_NO_UNICODE_TRANSLATION : ERROR_SUCCESS;
+    }
+    else
+    {
+        // No supported code page produces more than one UTF-16 unit per
+        // input byte, so a window of ARRAYSIZE(buffer) bytes always fits in
+        // buffer. Every prefix of a window therefore converts completely,
+        // which the bisection below relies on.
+        char16_t buffer[1024];
+        while (consumed != input.size())
         {
-            // Estimate that we need one char16 of output for each byte of input.
-            EnsureSize(utf16Output, iOutput, pbInputEnd - pbInput);
-
-            int const cbInputMax = pbInputEnd - pbInput < MultiByteBatchMax
-                ? (int)(pbInputEnd - pbInput)
-                : MultiByteBatchMax;
-
-            // Trim off an incomplete character sequence.
-            if (m_codePage != CodePageUtf8)
+            auto const remaining = input.substr(consumed, ARRAYSIZE(buffer));
+            auto decoded = EncodedToUtf16(remaining, buffer, MB_ERR_INVALID_CHARS);
+            if (decoded.Status == ERROR_NO_UNICODE_TRANSLATION)
             {
-                // Assume DBCS. If not DBCS, IsDBCSLeadByteEx returns false and we don't trim anything.
-                // Go backwards until we find a byte that can't possibly be a lead byte.
-                if (!IsDBCSLeadByteEx(m_codePage, pbInput[cbInputMax - 1]))
+                // Find the longest prefix of this window that converts without
+                // error. The invalid character starts where conversion of that
+                // prefix stops. Bisect over the whole window, not
+                // decoded.Consumed: MultiByteToWideChar fails the whole call,
+                // so Consumed may be 0 even if the error is near the end.
+                size_t validMax = 0;
+                size_t invalidMin = remaining.size();
+                while (invalidMin - validMax > 1)
                 {
-                    // Does not end with a lead byte. No trim needed.
-                    cbInput = cbInputMax;
-                }
-                else
-                {
-                    int i = cbInputMax - 1;
-                    while (i != 0 && IsDBCSLeadByteEx(m_codePage, pbInput[i - 1]))
+                    size_t const mid = validMax + (invalidMin - validMax) / 2;
+                    if (EncodedToUtf16(remaining.substr(0, mid), buffer, MB_ERR_INVALID_CHARS).Status == ERROR_SUCCESS)
                     {
-                        i -= 1;
+                        validMax = mid;
                     }
-
-                    // If we had to go back an odd number of bytes, the last byte is a lead byte and must be trimmed.
-                    cbInput = cbInputMax - ((cbInputMax - i) & 1);
-                    if (cbInput == 0)
+                    else
                     {
-                        break;
+                        invalidMin = mid;
                     }
                 }
+
+                decoded = EncodedToUtf16(remaining.substr(0, validMax), buffer, MB_ERR_INVALID_CHARS);
+                status = ERROR_NO_UNICODE_TRANSLATION;
             }
-            else if ((pbInput[cbInputMax - 1] & 0x80) == 0)
+            else if (decoded.Status != ERROR_SUCCESS)
             {
-                // UTF-8, ends with an ASCII byte. No trim needed.
-                cbInput = cbInputMax;
+                status = decoded.Status;
+                break;
             }
-            else
+
+            AdvancePosition(result, std::u16string_view(buffer, decoded.Produced));
+            consumed += decoded.Consumed;
+            if (status != ERROR_SUCCESS || decoded.Consumed == 0)
             {
-                // UTF-8, ends with a non-ASCII byte.
-                // Go backwards up to 4 bytes to find the lead byte.
-                int const cbInputMin = cbInputMax >= 4
-                    ? cbInputMax - 4
-                    : 0;
-                for (cbInput = cbInputMax; cbInput != cbInputMin; cbInput -= 1)
-                {
-                    ULONG firstZeroPos;
-                    UINT8 const pattern = ~pbInput[cbInput - 1]
-                        | 1u; // Make sure pattern isn't 0.
-                    (void)_BitScanReverse(&firstZeroPos, pattern);
-                    int const trailBytes = 6 - firstZeroPos;
+                break;
+            }
+        }
+    }
 
-                    if (trailBytes == 0)
-                    {
-                        // It's a trail byte. Keep looking for lead byte.
-                    }
-                    else if (trailBytes > cbInputMax - cbInput)
-                    {
-                        // Lead byte. Sequence does not complete before end. Trim it.
-                        cbInput -= 1;
-                        break;
-                    }
-                    else
-                    {
-                        // Either the sequence completes before end or it's invalid. Don't trim anything.
-                        cbInput = cbInputMax;
-                        break;
-                    }
-                }
+    result.Consumed = consumed;
+    result.Offset += consumed;
+    return status;
+}
 
-                if (cbInput == 0)
-                {
-                    break;
-                }
+size_t
+CodeConvert::SplitPosition(
+    std::string_view input,
+    size_t pos) const noexcept
+{
+    assert(pos <= input.size());
+    auto const pInput = reinterpret_cast<UINT8 const*>(input.data());
+
+    switch (m_codePage | 1u) // Combine BE and LE cases
+    {
+    case CodePageUtf16BE: // Includes CodePageUtf16LE
+        pos &= ~(size_t)1;
+        if (pos != 0)
+        {
+            // Don't split after a high surrogate.
+            auto const highByte = m_codePage == CodePageUtf16BE ? pInput[pos - 2] : pInput[pos - 1];
+            if ((highByte & 0xFC) == 0xD8)
+            {
+                pos -= 2;
             }
+        }
+        return pos;
+
+    case CodePageUtf32BE: // Includes CodePageUtf32LE
+        return pos & ~(size_t)3;
 
-            // May need to retry the MB2WC after resizing utf16Output.
-            for (;;)
+    case CodePageUtf8: // Also matches 65000 (UTF-7), which is handled by default.
+
+        if (m_codePage == CodePageUtf8)
+        {
+            // Back up over (at most 3) continuation bytes. An invalid run of
+            // more continuation bytes can be split anywhere.
+            for (unsigned i = 0; i != 3 && pos != 0 && pos != input.size() && (pInput[pos] & 0xC0) == 0x80; i += 1)
             {
-                int const cOutput = utf16Output.size() - iOutput < INT_MAX
-                    ? (int)(utf16Output.size() - iOutput)
-                    : INT_MAX;
-
-                assert(cbInput > 0);
-                assert(cOutput > 0);
-                int const cOutputWritten = MultiByteToWideChar(
-                    m_codePage,
-                    mb2wcFlags,
-                    reinterpret_cast<PCCH>(pbInput),
-                    cbInput,
-                    reinterpret_cast<PWCH>(utf16Output.data() + iOutput),
-                    cOutput);
-                if (cOutputWritten > 0)
-                {
-                    // Successful batch.
-                    iOutput += cOutputWritten;
-                    assert(iOutput <= utf16Output.size());
-                    break;
-                }
+                pos -= 1;
+            }
+            return pos;
+        }
+        [[fallthrough]];
+
+    default: // SBCS, DBCS
 
-                auto const lastError = GetLastError();
-                assert(lastError != ERROR_SUCCESS);
-                if (lastError != ERROR_INSUFFICIENT_BUFFER)
+        CPINFOEXW cpInfo;
+        if (!GetCPInfoExW(m_codePage, 0, &cpInfo))
+        {
+            return 0;
+        }
+        else if (cpInfo.MaxCharSize == 1)
+        {
+            return pos;
+        }
+        else if (cpInfo.MaxCharSize == 2)
+        {
+            // Same trimming as DecodeChunk uses for an incomplete character.
+            return LeadByteMap(cpInfo.LeadByte).CompleteLength(pInput, pos);
+        }
+
+        // Stateful or more-complex encoding.
+        return 0;
+    }
+}
+
+CodeConvert::SpanResult
+CodeConvert::EncodedToUtf16(
+    std::string_view encodedInput,
+    std::span<char16_t> utf16Output,
+    unsigned mb2wcFlags) const
+{
+    SpanResult result = {};
+
+    auto const pInput = reinterpret_cast<UINT8 const*>(encodedInput.data());
+    size_t const cInput = encodedInput.size();
+    auto const pOutput = utf16Output.data();
+    size_t const cOutput = utf16Output.size();
+
+    // Size of a code unit, and of the longest character, in bytes.
+    size_t const cbUnit =
+        (m_codePage | 1u) == CodePageUtf16BE ? sizeof(char16_t)
+        : (m_codePage | 1u) == CodePageUtf32BE ? sizeof(char32_t)
+        : 1;
+    size_t const cbCharMax =
+        (m_codePage | 1u) == CodePageUtf16BE || (m_codePage | 1u) == CodePageUtf32BE || m_codePage == CodePageUtf8 ? 4
+        : SbcsCodec::Get(m_codePage) ? 1
+        : 2;
+
+    bool usedReplacement = false;
+    while (result.Consumed != cInput)
+    {
+        size_t const cInputLeft = cInput - result.Consumed;
+        size_t const cOutputLeft = cOutput - result.Produced;
+        size_t const cChunkMax = DecodeChunkMax(m_codePage, cOutputLeft);
+
+        ChunkResult chunk = {};
+        if (cChunkMax != 0)
+        {
+            chunk = DecodeChunk(
+                m_codePage,
+                pInput + result.Consumed,
+                cInputLeft < cChunkMax ? cInputLeft : cChunkMax,
+                pOutput + result.Produced,
+                cOutputLeft,
+                mb2wcFlags);
+            if (chunk.Error != ERROR_SUCCESS && chunk.Error != ERROR_INSUFFICIENT_BUFFER)
+            {
+                result.Status = chunk.Error;
+                break;
+            }
+        }
+
+        if (chunk.Consumed == 0)
+        {
+            // Either the output is too small for the worst case, or the chunk
+            // ended in the middle of a character. Convert the next character
+            // into a small buffer, then copy it if it fits.
+            char16_t temp[8];
+            for (size_t cbTry = cbUnit;; cbTry += cbUnit)
+            {
+                if (cbTry > cInputLeft || cbTry > cbCharMax)
                 {
-                    status = lastError;
+                    // Incomplete character at end of input.
                     goto Done;
                 }
 
-                // Estimate was too small. Enlarge buffer and try again.
-                int const cOutputNeeded = MultiByteToWideChar(
-                    m_codePage,
-                    mb2wcFlags,
-                    reinterpret_cast<PCCH>(pbInput),
-                    cbInput,
-                    nullptr,
-                    0);
-                if (cOutputNeeded <= 0)
+                chunk = DecodeChunk(m_codePage, pInput + result.Consumed, cbTry, temp, ARRAYSIZE(temp), mb2wcFlags);
+                if (chunk.Error != ERROR_SUCCESS)
                 {
-                    status = GetLastError();
-                    assert(status != ERROR_SUCCESS);
+                    result.Status = chunk.Error;
                     goto Done;
                 }
+                else if (chunk.Consumed != 0)
+                {
+                    break;
+                }
+            }
 
-                assert(cOutput < cOutputNeeded);
-                EnsureSize(utf16Output, iOutput, cOutputNeeded);
+            if (chunk.Produced > cOutputLeft)
+            {
+                result.NeedMoreOutput = true;
+                break;
             }
+
+            memcpy(pOutput + result.Produced, temp, chunk.Produced * sizeof(char16_t));
         }
 
-        encodedInputPos = pbInput - pbInputBegin;
-        utf16OutputPos = iOutput;
-        status = ERROR_SUCCESS;
-        break;
+        result.Consumed += chunk.Consumed;
+        result.Produced += chunk.Produced;
+        usedReplacement |= chunk.UsedReplacement;
     }
 
 Done:
 
-    assert(encodedInputPos <= encodedInput.size());
-    assert(utf16OutputPos <= utf16Output.size());
-    return status;
+    if (result.Status == ERROR_SUCCESS && usedReplacement && (mb2wcFlags & MB_ERR_INVALID_CHARS))
+    {
+        result.Status = ERROR_NO_UNICODE_TRANSLATION;
+    }
+
+    assert(result.Consumed <= cInput);
+    assert(result.Produced <= cOutput);
+    return result;
 }
 
 LSTATUS
-CodeConvert::Utf16ToEncoded(
-    std::u16string_view utf16Input,
-    size_t& utf16InputPos,
-    std::string& encodedOutput,
-    size_t& encodedOutputPos,
-    unsigned wc2mbFlags,
-    _In_opt_ PCCH pDefaultChar,
-    _Inout_opt_ bool* pUsedDefaultChar) const
+CodeConvert::EncodedToUtf16(
+    std::string_view encodedInput,
+    size_t& encodedInputPos,
+    std::u16string& utf16Output,
+    size_t& utf16OutputPos,
+    unsigned mb2wcFlags) const
 {
-    LSTATUS status;
-
-    auto const pInputBegin = utf16Input.data();
-    auto const pInputEnd = pInputBegin + utf16Input.size();
-    auto pInput = pInputBegin + utf16InputPos;
-    size_t iOutput = encodedOutputPos;
-    BOOL globalUsedDefaultChar = false;
-    BOOL localUsedDefaultChar = false;
-    BOOL* const pLocalUsedDefaultChar = pUsedDefaultChar ? &localUsedDefaultChar : nullptr;
-
-    assert(pInputBegin <= pInput);
-    assert(pInput <= pInputEnd);
-    assert(iOutput <= encodedOutput.size());
-    if (pInput < pInputBegin ||
-        pInputEnd < pInput ||
-        encodedOutput.size() < iOutput)
+    LSTATUS status = ERROR_SUCCESS;
+
+    assert(encodedInputPos <= encodedInput.size());
+    assert(utf16OutputPos <= utf16Output.size());
+    if (encodedInput.size() < encodedInputPos ||
+        utf16Output.size() < utf16OutputPos)
     {
-        status = ERROR_INVALID_PARAMETER;
-        goto Done;
+        return ERROR_INVALID_PARAMETER;
     }
 
-    switch (m_codePage | 1u) // Combine BE and LE cases
+    size_t cOutputNeeded = DecodeCapacity(m_codePage, encodedInput.size() - encodedInputPos);
+    for (;;)
     {
-    case CodePageUtf16BE: // Includes CodePageUtf16LE
-
-        if (pDefaultChar || pUsedDefaultChar)
+        EnsureSize(utf16Output, utf16OutputPos, cOutputNeeded);
+
+        auto const result = EncodedToUtf16(
+            encodedInput.substr(encodedInputPos),
+            std::span<char16_t>(utf16Output.data() + utf16OutputPos, utf16Output.size() - utf16OutputPos),
+            mb2wcFlags);
+        encodedInputPos += result.Consumed;
+        utf16OutputPos += result.Produced;
+        if (status == ERROR_SUCCESS)
         {
-            status = ERROR_INVALID_PARAMETER;
+            status = result.Status;
         }
-        else
+
+        if (!result.NeedMoreOutput)
         {
-            size_t const cInput = pInputEnd - pInput;
-
-            // We need one char16 of output for each char16 of input.
-            EnsureSize(encodedOutput, iOutput, cInput * sizeof(char16_t));
-            auto const pOutput = reinterpret_cast<char16_t*>(encodedOutput.data() + iOutput);
-
-            auto const result = m_codePage == CodePageUtf16BE
-                ? Utf16ToUtf16<ByteSwap::Output>(pInput, cInput, pOutput)
-                : Utf16ToUtf16<ByteSwap::None>(pInput, cInput, pOutput);
-            utf16InputPos = static_cast<char16_t const*>(result.InputPos) - pInputBegin;
-            encodedOutputPos = static_cast<char const*>(result.OutputPos) - encodedOutput.data();
-            status = wc2mbFlags & WC_ERR_INVALID_CHARS ? result.UsedReplacement : ERROR_SUCCESS;
+            break;
         }
-        break;
 
-    case CodePageUtf32BE: // Includes CodePageUtf32LE
+        // Estimate was too small. Enlarge buffer and try again.
+        cOutputNeeded = (utf16Output.size() - utf16OutputPos) * 2 + 16;
+    }
 
-        if (pDefaultChar || pUsedDefaultChar)
-        {
-            status = ERROR_INVALID_PARAMETER;
-        }
-        else
-        {
-            size_t const cInput = pInputEnd - pInput;
-
-            // We need up to one char32 of output for each char16 of input.
-            EnsureSize(encodedOutput, iOutput, cInput * sizeof(char32_t));
-            auto const pOutput = reinterpret_cast<char32_t*>(encodedOutput.data() + iOutput);
-
-            auto const result = m_codePage == CodePageUtf32BE
-                ? Utf16ToUtf32<ByteSwap::Output>(pInput, cInput, pOutput)
-                : Utf16ToUtf32<ByteSwap::None>(pInput, cInput, pOutput);
-            utf16InputPos = static_cast<char16_t const*>(result.InputPos) - pInputBegin;
-            encodedOutputPos = static_cast<char const*>(result.OutputPos) - encodedOutput.data();
-            status = wc2mbFlags & WC_ERR_INVALID_CHARS ? result.UsedReplacement : ERROR_SUCCESS;
-        }
-        break;
+    assert(encodedInputPos <= encodedInput.size());
+    assert(utf16OutputPos <= utf16Output.size());
+    return status;
+}
 
-    default: // Includes CodePageUtf8
+CodeConvert::SpanResult
+CodeConvert::Utf16ToEncoded(
+    std::u16string_view utf16Input,
+    std::span<char> encodedOutput,
+    unsigned wc2mbFlags,
+    _In_opt_ PCCH pDefaultChar,
+    _Inout_opt_ bool* pUsedDefaultChar) const
+{
+    SpanResult result = {};
+
+    auto const pInput = utf16Input.data();
+    size_t const cInput = utf16Input.size();
+    auto const pOutput = reinterpret_cast<UINT8*>(encodedOutput.data());
+    size_t const cOutput = encodedOutput.size();
+
+    if ((pDefaultChar || pUsedDefaultChar) &&
+        ((m_codePage | 1u) == CodePageUtf16BE || (m_codePage | 1u) == CodePageUtf32BE || m_codePage == CodePageUtf8))
+    {
+        result.Status = ERROR_INVALID_PARAMETER;
+        return result;
+    }
 
-        // Split into batches no larger than MultiByteBatchMax.
-        for (int cInput; pInput < pInputEnd; pInput += cInput)
+    bool usedReplacement = false;
+    bool usedDefaultChar = false;
+    bool* const pLocalUsedDefaultChar = pUsedDefaultChar ? &usedDefaultChar : nullptr;
+    while (result.Consumed != cInput)
+    {
+        size_t const cInputLeft = cInput - result.Consumed;
+        size_t const cOutputLeft = cOutput - result.Produced;
+        size_t const cChunkMax = EncodeChunkMax(m_codePage, cOutputLeft);
+
+        ChunkResult chunk = {};
+        if (cChunkMax != 0)
         {
-            int const cInputMax = pInputEnd - pInput < MultiByteBatchMax
-                ? (int)(pInputEnd - pInput)
-                : MultiByteBatchMax;
-            if (pInput[cInputMax - 1] < 0xD800 || pInput[cInputMax - 1] > 0xDBFF)
+            chunk = EncodeChunk(
+                m_codePage,
+                pInput + result.Consumed,
+                cInputLeft < cChunkMax ? cInputLeft : cChunkMax,
+                pOutput + result.Produced,
+                cOutputLeft,
+                wc2mbFlags,
+                pDefaultChar,
+                pLocalUsedDefaultChar);
+            if (chunk.Error != ERROR_SUCCESS && chunk.Error != ERROR_INSUFFICIENT_BUFFER)
             {
-                cInput = cInputMax;
+                result.Status = chunk.Error;
+                break;
             }
-            else
-            {
-                // Don't end with a high surrogate.
-                cInput = cInputMax - 1;
-                if (cInput == 0)
-                {
-                    break;
-                }
-            }
-
-            // Estimate that we need two bytes of output for each char16 of input.
-            EnsureSize(encodedOutput, iOutput, (pInputEnd - pInput) * 2);
+        }
 
-            // May need to retry the WC2MB after resizing encodedOutput.
-            for (;;)
+        if (chunk.Consumed == 0)
+        {
+            // Either the output is too small for the worst case, or the chunk
+            // ended with a high surrogate. Convert the next character into a
+            // small buffer, then copy it if it fits.
+            alignas(char32_t) UINT8 temp[16];
+            bool tempUsedDefaultChar = false;
+            for (size_t cchTry = 1;; cchTry += 1)
             {
-                int const cOutput = encodedOutput.size() - iOutput < INT_MAX
-                    ? (int)(encodedOutput.size() - iOutput)
-                    : INT_MAX;
-
-                assert(cInput > 0);
-                assert(cOutput > 0);
-                localUsedDefaultChar = false;
-                int const cOutputWritten = WideCharToMultiByte(
-                    m_codePage,
-                    wc2mbFlags,
-                    reinterpret_cast<PCWCH>(pInput),
-                    cInput,
-                    encodedOutput.data() + iOutput,
-                    cOutput,
-                    pDefaultChar,
-                    pLocalUsedDefaultChar);
-                if (cOutputWritten > 0)
+                if (cchTry > cInputLeft || cchTry > 2)
                 {
-                    // Successful batch.
-                    iOutput += cOutputWritten;
-                    globalUsedDefaultChar |= localUsedDefaultChar;
-                    assert(iOutput <= encodedOutput.size());
-                    break;
+                    // High surrogate at end of input.
+                    goto Done;
                 }
 
-                auto const lastError = GetLastError();
-                assert(lastError != ERROR_SUCCESS);
-                if (lastError != ERROR_INSUFFICIENT_BUFFER)
+                chunk = EncodeChunk(m_codePage, pInput + result.Consumed, cchTry, temp, ARRAYSIZE(temp),
+                    wc2mbFlags, pDefaultChar, pUsedDefaultChar ? &tempUsedDefaultChar : nullptr);
+                if (chunk.Error != ERROR_SUCCESS)
                 {
-                    status = lastError;
+                    result.Status = chunk.Error;
                     goto Done;
                 }
-
-                // Estimate was too small. Enlarge buffer and try again.
-                int const cOutputNeeded = WideCharToMultiByte(
-                    m_codePage,
-                    wc2mbFlags,
-                    reinterpret_cast<PCWCH>(pInput),
-                    cInput,
-                    nullptr,
-                    0,
-                    pDefaultChar,
-                    nullptr);
-                if (cOutputNeeded <= 0)
+                else if (chunk.Consumed != 0)
                 {
-                    status = GetLastError();
-                    assert(status != ERROR_SUCCESS);
-                    goto Done;
+                    break;
                 }
+            }
 
-                assert(cOutput < cOutputNeeded);
-                EnsureSize(encodedOutput, iOutput, cOutputNeeded);
+            if (chunk.Produced > cOutputLeft)
+            {
+                result.NeedMoreOutput = true;
+                break;
             }
-        }
 
-        utf16InputPos = pInput - pInputBegin;
-        encodedOutputPos = iOutput;
-        if (globalUsedDefaultChar)
-        {
-            *pUsedDefaultChar = true;
+            memcpy(pOutput + result.Produced, temp, chunk.Produced);
+            usedDefaultChar |= tempUsedDefaultChar;
         }
-        status = ERROR_SUCCESS;
-        break;
+
+        result.Consumed += chunk.Consumed;
+        result.Produced += chunk.Produced;
+        usedReplacement |= chunk.UsedReplacement;
     }
 
 Done:
 
+    if (result.Status == ERROR_SUCCESS && usedReplacement && (wc2mbFlags & WC_ERR_INVALID_CHARS))
+    {
+        result.Status = ERROR_NO_UNICODE_TRANSLATION;
+    }
+
+    if (usedDefaultChar && pUsedDefaultChar)
+    {
+        *pUsedDefaultChar = true;
+    }
+
+    assert(result.Consumed <= cInput);
+    assert(result.Produced <= cOutput);
+    return result;
+}
+
+LSTATUS
+CodeConvert::Utf16ToEncoded(
+    std::u16string_view utf16Input,
+    size_t& utf16InputPos,
+    std::string& encodedOutput,
+    size_t& encodedOutputPos,
+    unsigned wc2mbFlags,
+    _In_opt_ PCCH pDefaultChar,
+    _Inout_opt_ bool* pUsedDefaultChar) const
+{
+    LSTATUS status = ERROR_SUCCESS;
+
     assert(utf16InputPos <= utf16Input.size());
     assert(encodedOutputPos <= encodedOutput.size());
+    if (utf16Input.size() < utf16InputPos ||
+        encodedOutput.size() < encodedOutputPos)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    size_t cOutputNeeded = EncodeCapacity(m_codePage, utf16Input.size() - utf16InputPos);
+    for (;;)
+    {
+        EnsureSize(encodedOutput, encodedOutputPos, cOutputNeeded);
+
+        auto const result = Utf16ToEncoded(
+            utf16Input.substr(utf16InputPos),
+            std::span<char>(encodedOutput.data() + encodedOutputPos, encodedOutput.size() - encodedOutputPos),
+            wc2mbFlags,
+            pDefaultChar,
+            pUsedDefaultChar);
+        utf16InputPos += result.Consumed;
+        encodedOutputPos += result.Produced;
+        if (status == ERROR_SUCCESS)
+        {
+            status = result.Status;
+        }
+
+        if (!result.NeedMoreOutput)
+        {
+            break;
+        }
 
+        // Estimate was too small. Enlarge buffer and try again.
+        cOutputNeeded = (encodedOutput.size() - encodedOutputPos) * 2 + 16;
+    }
+
+    assert(utf16InputPos <= utf16Input.size());
+    assert(encodedOutputPos <= encodedOutput.size());
     return status;
 }
@@ -0,0 +1,540 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+// Portable (no pch.h) so that it builds without Windows headers. Without
+// Windows, codecs come only from FromMappingText.
+#include "DbcsCodec.h"
+#include "SimdKernels.h"
+#include "Utility.h"
+
+#include <assert.h>
+#include <charconv>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+using namespace TextToolsImpl;
+
+// Bytes below this value are never trail bytes in the supported code pages.
+static constexpr UINT8 TrailByteMin = 0x40;
+
+LeadByteMap::LeadByteMap(_In_reads_(MAX_LEADBYTES) BYTE const* pLeadByteRanges) noexcept
+    : m_bits()
+{
+    for (unsigned i = 0; i + 1 < MAX_LEADBYTES && pLeadByteRanges[i] != 0; i += 2)
+    {
+        for (unsigned b = pLeadByteRanges[i]; b <= pLeadByteRanges[i + 1]; b += 1)
+        {
+            Add(static_cast<UINT8>(b));
+        }
+    }
+}
+
+size_t
+LeadByteMap::CompleteLength(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput) const noexcept
+{
+    // Count the trailing run of possible lead bytes, 8 bytes per step. The
+    // inner loop has no data-dependent branches: once a non-lead byte is seen,
+    // alive becomes 0 and the remaining bytes of the step are not counted.
+    size_t run = 0;
+    for (;;)
+    {
+        size_t const cStep = cInput - run < 8 ? cInput - run : 8;
+        unsigned alive = 1;
+        unsigned count = 0;
+        for (size_t i = 0; i != cStep; i += 1)
+        {
+            alive &= static_cast<unsigned>(Contains(pInput[cInput - run - 1 - i]));
+            count += alive;
+        }
+
+        run += count;
+        if (count != 8)
+        {
+            break;
+        }
+    }
+
+    // If the run has odd length, the last byte is a lead byte.
+    return cInput - (run & 1);
+}
+
+DbcsCodec::EncodeTable::EncodeTable()
+    : Index()
+    , Pages(256)
+{
+    return;
+}
+
+void
+DbcsCodec::EncodeTable::Add(char16_t ch, UINT16 value)
+{
+    auto& page = Index[ch >> 8];
+    if (page == 0)
+    {
+        page = static_cast<UINT16>(Pages.size() / 256);
+        Pages.resize(Pages.size() + 256);
+    }
+
+    auto& entry = Pages[page * 256u + (ch & 0xFF)];
+    if (entry == 0)
+    {
+        // First mapping wins.
+        entry = value;
+    }
+}
+
+DbcsCodec::DbcsCodec(unsigned codePage, UINT8 defaultChar, char16_t unicodeDefaultChar) noexcept
+    : m_codePage(codePage)
+    , m_defaultChar(defaultChar)
+    , m_unicodeDefaultChar(unicodeDefaultChar)
+    , m_asciiCompatible()
+    , m_leadBytes()
+    , m_singleInvalid()
+    , m_single()
+    , m_pairIndex()
+    , m_pairPages(256)
+{
+    return;
+}
+
+#ifdef _WIN32
+
+// Converts every BMP non-surrogate with WideCharToMultiByte and adds the
+// mapped characters to table. Converts twice with different default chars to
+// tell "unmapped" apart from "maps to the default char". Each char16 becomes
+// exactly one encoded character, so the output is split using leadBytes.
+static void
+AddSystemMappings(
+    unsigned codePage,
+    DWORD wc2mbFlags,
+    LeadByteMap const& leadBytes,
+    std::vector<std::pair<char16_t, UINT16>>& mappings)
+{
+    std::u16string chars;
+    chars.reserve(0x10000 - 0x800);
+    for (unsigned ch = 0; ch != 0x10000; ch += 1)
+    {
+        if (ch < 0xD800 || ch >= 0xE000)
+        {
+            chars.push_back(static_cast<char16_t>(ch));
+        }
+    }
+
+    auto const cChars = static_cast<int>(chars.size());
+    std::string bytes1(chars.size() * 2, '\0');
+    std::string bytes2(chars.size() * 2, '\0');
+    char const default1 = '?';
+    char const default2 = '_';
+    int const cBytes1 = WideCharToMultiByte(codePage, wc2mbFlags, reinterpret_cast<PCWCH>(chars.data()), cChars,
+        bytes1.data(), cChars * 2, &default1, nullptr);
+    int const cBytes2 = WideCharToMultiByte(codePage, wc2mbFlags, reinterpret_cast<PCWCH>(chars.data()), cChars,
+        bytes2.data(), cChars * 2, &default2, nullptr);
+    if (cBytes1 <= 0 || cBytes2 <= 0)
+    {
+        return;
+    }
+
+    size_t i1 = 0;
+    size_t i2 = 0;
+    for (auto const ch : chars)
+    {
+        if (i1 >= static_cast<size_t>(cBytes1) || i2 >= static_cast<size_t>(cBytes2))
+        {
+            break;
+        }
+
+        UINT16 value1 = static_cast<UINT8>(bytes1[i1++]);
+        if (leadBytes.Contains(static_cast<UINT8>(value1)) && i1 < static_cast<size_t>(cBytes1))
+        {
+            value1 = static_cast<UINT16>(value1 << 8 | static_cast<UINT8>(bytes1[i1++]));
+        }
+
+        UINT16 value2 = static_cast<UINT8>(bytes2[i2++]);
+        if (leadBytes.Contains(static_cast<UINT8>(value2)) && i2 < static_cast<size_t>(cBytes2))
+        {
+            value2 = static_cast<UINT16>(value2 << 8 | static_cast<UINT8>(bytes2[i2++]));
+        }
+
+        if (value1 == value2)
+        {
+            mappings.emplace_back(ch, value1);
+        }
+    }
+}
+
+#endif // _WIN32
+
+std::unique_ptr<DbcsCodec>
+DbcsCodec::Create(unsigned codePage)
+{
+    std::unique_ptr<DbcsCodec> codec;
+
+    if (codePage != 932 && codePage != 936 && codePage != 949 && codePage != 950)
+    {
+        return codec;
+    }
+
+#ifdef _WIN32
+
+    CPINFOEXW info;
+    if (!GetCPInfoExW(codePage, 0, &info) ||
+        info.MaxCharSize != 2)
+    {
+        return codec;
+    }
+
+    codec.reset(new DbcsCodec(codePage, info.DefaultChar[0], info.UnicodeDefaultChar));
+    codec->m_leadBytes = LeadByteMap(info.LeadByte);
+
+    for (unsigned b = 0; b != 256; b += 1)
+    {
+        if (codec->m_leadBytes.Contains(static_cast<UINT8>(b)))
+        {
+            continue;
+        }
+
+        char const byte = static_cast<char>(b);
+        WCHAR ch;
+        if (MultiByteToWideChar(codePage, MB_ERR_INVALID_CHARS, &byte, 1, &ch, 1) == 1)
+        {
+            codec->m_single[b] = ch;
+        }
+        else
+        {
+            codec->m_single[b] = codec->m_unicodeDefaultChar;
+            codec->m_singleInvalid.Add(static_cast<UINT8>(b));
+        }
+    }
+
+    for (unsigned lead = 0; lead != 256; lead += 1)
+    {
+        if (!codec->m_leadBytes.Contains(static_cast<UINT8>(lead)))
+        {
+            continue;
+        }
+
+        for (unsigned trail = TrailByteMin; trail != 256; trail += 1)
+        {
+            char const bytes[2] = { static_cast<char>(lead), static_cast<char>(trail) };
+            WCHAR ch;
+            if (MultiByteToWideChar(codePage, MB_ERR_INVALID_CHARS, bytes, 2, &ch, 1) == 1)
+            {
+                codec->AddPair(static_cast<UINT8>(lead), static_cast<UINT8>(trail), ch);
+            }
+        }
+    }
+
+    // Let the OS choose among duplicate mappings.
+    std::vector<std::pair<char16_t, UINT16>> mappings;
+    AddSystemMappings(codePage, WC_NO_BEST_FIT_CHARS, codec->m_leadBytes, mappings);
+    for (auto const& mapping : mappings)
+    {
+        codec->m_exact.Add(mapping.first, mapping.second);
+    }
+
+    codec->Initialize();
+
+#endif // _WIN32
+
+    return codec;
+}
+
+std::unique_ptr<DbcsCodec>
+DbcsCodec::FromMappingText(
+    unsigned codePage,
+    std::string_view mappingText,
+    UINT8 defaultChar,
+    char16_t unicodeDefaultChar)
+{
+    std::unique_ptr<DbcsCodec> codec(new DbcsCodec(codePage, defaultChar, unicodeDefaultChar));
+    LeadByteMap singleValid;
+
+    auto const isSpace = [](char ch) { return ch == ' ' || ch == '\t' || ch == '\r'; };
+    auto const parseHex = [](std::string_view& text, unsigned& value)
+    {
+        if (text.size() < 3 || text[0] != '0' || (text[1] | 32) != 'x')
+        {
+            return false;
+        }
+
+        auto const result = std::from_chars(text.data() + 2, text.data() + text.size(), value, 16);
+        if (result.ec != std::errc())
+        {
+            return false;
+        }
+
+        text.remove_prefix(result.ptr - text.data());
+        return true;
+    };
+
+    while (!mappingText.empty())
+    {
+        auto const lineEnd = mappingText.find('\n');
+        auto line = mappingText.substr(0, lineEnd);
+        mappingText.remove_prefix(lineEnd == mappingText.npos ? mappingText.size() : lineEnd + 1);
+
+        unsigned encoded;
+        unsigned unicode;
+        while (!line.empty() && isSpace(line[0])) line.remove_prefix(1);
+        if (!parseHex(line, encoded))
+        {
+            continue;
+        }
+
+        while (!line.empty() && isSpace(line[0])) line.remove_prefix(1);
+        if (!parseHex(line, unicode) ||
+            encoded > 0xFFFF ||
+            unicode > 0xFFFF ||
+            (unicode >= 0xD800 && unicode < 0xE000))
+        {
+            continue;
+        }
+
+        auto const ch = static_cast<char16_t>(unicode);
+        if (encoded <= 0xFF)
+        {
+            if (!singleValid.Contains(static_cast<UINT8>(encoded)))
+            {
+                singleValid.Add(static_cast<UINT8>(encoded));
+                codec->m_single[encoded] = ch;
+            }
+        }
+        else if ((encoded & 0xFF) >= TrailByteMin && ch != 0)
+        {
+            auto const lead = static_cast<UINT8>(encoded >> 8);
+            if (!codec->m_leadBytes.Contains(lead))
+            {
+                codec->m_leadBytes.Add(lead);
+            }
+
+            codec->AddPair(lead, static_cast<UINT8>(encoded), ch);
+        }
+        else
+        {
+            continue;
+        }
+
+        codec->m_exact.Add(ch, static_cast<UINT16>(encoded));
+    }
+
+    if (codec->m_leadBytes.Empty())
+    {
+        throw std::runtime_error("Mapping text for code page " + std::to_string(codePage) +
+            " contains no double-byte characters.");
+    }
+
+    for (unsigned b = 0; b != 256; b += 1)
+    {
+        if (!singleValid.Contains(static_cast<UINT8>(b)))
+        {
+            codec->m_single[b] = unicodeDefaultChar;
+            codec->m_singleInvalid.Add(static_cast<UINT8>(b));
+        }
+    }
+
+    codec->Initialize();
+    return codec;
+}
+
+void
+DbcsCodec::AddPair(UINT8 lead, UINT8 trail, char16_t ch)
+{
+    auto& page = m_pairIndex[lead];
+    if (page == 0)
+    {
+        assert(m_pairPages.size() < 256 * 256);
+        page = static_cast<UINT8>(m_pairPages.size() / 256);
+        m_pairPages.resize(m_pairPages.size() + 256);
+    }
+
+    auto& entry = m_pairPages[page * 256u + trail];
+    if (entry == 0)
+    {
+        entry = ch;
+    }
+}
+
+void
+DbcsCodec::Initialize()
+{
+    m_asciiCompatible = true;
+    for (unsigned b = 0; b != 0x80; b += 1)
+    {
+        if (m_single[b] != b ||
+            m_leadBytes.Contains(static_cast<UINT8>(b)) ||
+            m_singleInvalid.Contains(static_cast<UINT8>(b)) ||
+            m_exact.Lookup(static_cast<char16_t>(b)) != b)
+        {
+            m_asciiCompatible = false;
+        }
+    }
+}
+
+void
+DbcsCodec::BuildBestFit() const
+{
+    m_bestFit = m_exact;
+
+#ifdef _WIN32
+
+    std::vector<std::pair<char16_t, UINT16>> mappings;
+    AddSystemMappings(m_codePage, 0, m_leadBytes, mappings);
+    for (auto const& mapping : mappings)
+    {
+        m_bestFit.Add(mapping.first, mapping.second);
+    }
+
+#endif // _WIN32
+}
+
+DbcsCodec const*
+DbcsCodec::Get(unsigned codePage)
+{
+    // Most threads use only one code page, so check the last one used first.
+    thread_local unsigned lastCodePage = 0;
+    thread_local DbcsCodec const* lastCodec = nullptr;
+    if (codePage == lastCodePage)
+    {
+        return lastCodec;
+    }
+
+    static std::mutex mutex;
+    static std::map<unsigned, std::unique_ptr<DbcsCodec>> codecs;
+
+    std::lock_guard lock(mutex);
+    auto it = codecs.find(codePage);
+    if (it == codecs.end())
+    {
+        // Also caches null for unsupported code pages.
+        it = codecs.emplace(codePage, Create(codePage)).first;
+    }
+
+    lastCodePage = codePage;
+    lastCodec = it->second.get();
+    return lastCodec;
+}
+
+DbcsCodec::DecodeResult
+DbcsCodec::Decode(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return.OutputUsed) char16_t* pOutput) const noexcept
+{
+    bool anyInvalid = false;
+    size_t iInput = 0;
+    size_t iOutput = 0;
+
+    while (iInput != cInput)
+    {
+        auto const b0 = pInput[iInput];
+        if (b0 < 0x80 && m_asciiCompatible)
+        {
+            auto const cAscii = WidenAscii(&pInput[iInput], cInput - iInput, &pOutput[iOutput]);
+            iInput += cAscii;
+            iOutput += cAscii;
+            continue;
+        }
+
+        if (!m_leadBytes.Contains(b0))
+        {
+            pOutput[iOutput++] = m_single[b0];
+            anyInvalid |= m_singleInvalid.Contains(b0);
+            iInput += 1;
+            continue;
+        }
+
+        if (iInput + 1 == cInput)
+        {
+            // Lead byte at end of input. Don't consume it.
+            break;
+        }
+
+        auto const b1 = pInput[iInput + 1];
+        auto const ch = m_pairPages[m_pairIndex[b0] * 256u + b1];
+        if (ch != 0)
+        {
+            pOutput[iOutput++] = ch;
+            iInput += 2;
+        }
+        else
+        {
+            pOutput[iOutput++] = m_unicodeDefaultChar;
+            anyInvalid = true;
+            iInput += b1 < TrailByteMin ? 1 : 2;
+        }
+    }
+
+    return { iInput, iOutput, anyInvalid };
+}
+
+DbcsCodec::EncodeResult
+DbcsCodec::Encode(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput * 2, return.OutputUsed) UINT8* pOutput,
+    bool bestFit,
+    UINT8 defaultChar) const
+{
+    if (bestFit)
+    {
+        std::call_once(m_bestFitOnce, &DbcsCodec::BuildBestFit, this);
+    }
+
+    auto const& table = bestFit ? m_bestFit : m_exact;
+    bool usedDefaultChar = false;
+    size_t iInput = 0;
+    size_t iOutput = 0;
+
+    while (iInput != cInput)
+    {
+        auto const ch = pInput[iInput];
+        if (ch < 0x80 && m_asciiCompatible)
+        {
+            auto const cAscii = NarrowAscii(&pInput[iInput], cInput - iInput, &pOutput[iOutput]);
+            iInput += cAscii;
+            iOutput += cAscii;
+            continue;
+        }
+
+        if (ch < 0xD800 || ch >= 0xE000)
+        {
+            auto const value = table.Lookup(ch);
+            if (value > 0xFF)
+            {
+                pOutput[iOutput++] = static_cast<UINT8>(value >> 8);
+                pOutput[iOutput++] = static_cast<UINT8>(value);
+                iInput += 1;
+                continue;
+            }
+            else if (value != 0 || ch == 0)
+            {
+                pOutput[iOutput++] = static_cast<UINT8>(value);
+                iInput += 1;
+                continue;
+            }
+        }
+        else if (ch < 0xDC00)
+        {
+            if (iInput + 1 == cInput)
+            {
+                // High surrogate at end of input. Don't consume it.
+                break;
+            }
+
+            if (pInput[iInput + 1] >= 0xDC00 && pInput[iInput + 1] < 0xE000)
+            {
+                // Surrogate pair. Consume both, replace with one default char.
+                iInput += 1;
+            }
+        }
+
+        pOutput[iOutput++] = defaultChar;
+        usedDefaultChar = true;
+        iInput += 1;
+    }
+
+    return { iInput, iOutput, usedDefaultChar };
+}
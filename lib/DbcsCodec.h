@@ -0,0 +1,201 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+#pragma once
+#include "PortableTypes.h"
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace TextToolsImpl
+{
+    /*
+    256-bit set of the lead bytes of a DBCS code page.
+    */
+    class LeadByteMap
+    {
+        UINT64 m_bits[4];
+
+    public:
+
+        constexpr
+        LeadByteMap() noexcept
+            : m_bits() {}
+
+        /*
+        Initializes from the LeadByte ranges of a CPINFO.
+        */
+        explicit
+        LeadByteMap(_In_reads_(MAX_LEADBYTES) BYTE const* pLeadByteRanges) noexcept;
+
+        void
+        Add(UINT8 b) noexcept
+        {
+            m_bits[b >> 6] |= UINT64(1) << (b & 63);
+        }
+
+        bool
+        Contains(UINT8 b) const noexcept
+        {
+            return (m_bits[b >> 6] >> (b & 63)) & 1;
+        }
+
+        bool
+        Empty() const noexcept
+        {
+            return (m_bits[0] | m_bits[1] | m_bits[2] | m_bits[3]) == 0;
+        }
+
+        /*
+        Returns the length of the longest prefix of pInput that does not end
+        with an incomplete (lead byte only) character. Scans backwards over the
+        trailing run of bytes that could be lead bytes: if the run has odd
+        length, the last byte is a lead byte and is excluded.
+        */
+        size_t
+        CompleteLength(
+            _In_reads_(cInput) UINT8 const* pInput,
+            size_t cInput) const noexcept;
+    };
+
+    /*
+    Table-driven conversion between a DBCS code page (932, 936, 949, 950) and
+    UTF-16. On Windows, the tables are built from MultiByteToWideChar and
+    WideCharToMultiByte on first use. Tables can also be loaded from a mapping
+    file in the format used by unicode.org (e.g. CP932.TXT), which allows the
+    codec to be used without Windows.
+    */
+    class DbcsCodec
+    {
+        // Two-level decode of double-byte characters: m_pairIndex[lead] selects
+        // a 256-entry page of m_pairPages, indexed by trail byte. Page 0 is
+        // all-invalid. 0 means invalid.
+        //
+        // Two-level encode: Index[ch >> 8] selects a 256-entry page of Pages.
+        // Page 0 is all-unmapped. Entries are a single byte (<= 0xFF) or
+        // lead << 8 | trail. 0 means unmapped (except for U+0000).
+        struct EncodeTable
+        {
+            UINT16 Index[256];
+            std::vector<UINT16> Pages;
+
+            EncodeTable();
+
+            void
+            Add(char16_t ch, UINT16 value);
+
+            UINT16
+            Lookup(char16_t ch) const noexcept
+            {
+                return Pages[Index[ch >> 8] * 256u + (ch & 0xFF)];
+            }
+        };
+
+        unsigned m_codePage;
+        UINT8 m_defaultChar;
+        char16_t m_unicodeDefaultChar;
+        bool m_asciiCompatible;
+        LeadByteMap m_leadBytes;
+        LeadByteMap m_singleInvalid;
+        char16_t m_single[256];
+        UINT8 m_pairIndex[256];
+        std::vector<char16_t> m_pairPages;
+        EncodeTable m_exact;
+        mutable std::once_flag m_bestFitOnce;
+        mutable EncodeTable m_bestFit;
+
+        DbcsCodec(unsigned codePage, UINT8 defaultChar, char16_t unicodeDefaultChar) noexcept;
+
+        static std::unique_ptr<DbcsCodec>
+        Create(unsigned codePage);
+
+        void
+        AddPair(UINT8 lead, UINT8 trail, char16_t ch);
+
+        void
+        Initialize();
+
+        void
+        BuildBestFit() const;
+
+    public:
+
+        struct DecodeResult
+        {
+            size_t InputUsed;
+            size_t OutputUsed;
+            bool AnyInvalid;
+        };
+
+        struct EncodeResult
+        {
+            size_t InputUsed;
+            size_t OutputUsed;
+            bool UsedDefaultChar;
+        };
+
+        /*
+        Returns the codec for the specified code page, or null if the code page
+        is not a supported DBCS code page. The returned codec lives until the
+        process exits.
+        */
+        static DbcsCodec const*
+        Get(unsigned codePage);
+
+        /*
+        Creates a codec from the text of a mapping file with lines of the form
+        "0xXXXX<tab>0xXXXX" (encoded value, Unicode value). '#' starts a comment.
+        Lines without a Unicode value are ignored. If a character has more than
+        one encoded value, the first one is used for encoding. Throws
+        std::runtime_error if the text contains no double-byte mappings.
+        */
+        static std::unique_ptr<DbcsCodec>
+        FromMappingText(
+            unsigned codePage,
+            std::string_view mappingText,
+            UINT8 defaultChar = '?',
+            char16_t unicodeDefaultChar = u'?');
+
+        UINT8
+        DefaultChar() const noexcept
+        {
+            return m_defaultChar;
+        }
+
+        LeadByteMap const&
+        LeadBytes() const noexcept
+        {
+            return m_leadBytes;
+        }
+
+        /*
+        Converts bytes to UTF-16, writing at most one char16 per byte. Stops
+        before a lead byte at the end of input. Invalid bytes or byte pairs are
+        replaced with the code page's Unicode default char, and AnyInvalid is
+        set. If a lead byte is followed by a byte that cannot be a trail byte
+        (< 0x40), only the lead byte is replaced.
+        */
+        DecodeResult
+        Decode(
+            _In_reads_(cInput) UINT8 const* pInput,
+            size_t cInput,
+            _Out_writes_to_(cInput, return.OutputUsed) char16_t* pOutput) const noexcept;
+
+        /*
+        Converts UTF-16 to bytes, writing at most two bytes per char16. Stops
+        before a high surrogate at the end of input. Characters without a
+        mapping (including surrogate pairs and unmatched surrogates) are
+        replaced with defaultChar. If bestFit is true, characters without an
+        exact mapping may be replaced with a similar-looking character instead
+        (on Windows, as chosen by WideCharToMultiByte).
+        */
+        EncodeResult
+        Encode(
+            _In_reads_(cInput) char16_t const* pInput,
+            size_t cInput,
+            _Out_writes_to_(cInput * 2, return.OutputUsed) UINT8* pOutput,
+            bool bestFit,
+            UINT8 defaultChar) const;
+    };
+}
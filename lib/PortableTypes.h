@@ -0,0 +1,60 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+#pragma once
+
+/*
+Types, status codes, and SAL annotations used by the portable kernels and
+codecs (SimdKernels, UtfKernels, SbcsCodec, DbcsCodec). On Windows, these
+come from windows.h. Elsewhere (e.g. the unit tests in ../test, which build
+on Linux), they are defined here so that this code builds without Windows
+headers.
+*/
+
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <windows.h>
+#include <stdlib.h> // _byteswap_ushort, _byteswap_ulong
+
+#else // _WIN32
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t BYTE;
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int32_t LSTATUS;
+
+#define ERROR_SUCCESS 0
+#define ERROR_NO_UNICODE_TRANSLATION 1113
+#define MAX_LEADBYTES 12
+
+#define _In_reads_(size)
+#define _Inout_
+#define _Inout_updates_(size)
+#define _Out_
+#define _Out_writes_(size)
+#define _Out_writes_to_(size, count)
+#define _Pre_cap_(size)
+
+inline UINT16
+_byteswap_ushort(UINT16 n) noexcept
+{
+    return __builtin_bswap16(n);
+}
+
+inline UINT32
+_byteswap_ulong(UINT32 n) noexcept
+{
+    return __builtin_bswap32(n);
+}
+
+#endif // _WIN32
@@ -0,0 +1,135 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+#pragma once
+#include "PortableTypes.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace TextToolsImpl
+{
+    /*
+    Table-driven conversion between a single-byte code page and UTF-16.
+    Tables for code pages 1252, 437, 850, and the ISO-8859 family are built in
+    and do not depend on the OS. On Windows, tables for other SBCS code pages
+    are built from MultiByteToWideChar and WideCharToMultiByte on first use.
+    */
+    class SbcsCodec
+    {
+        // Two-level reverse lookup: Index[ch >> 8] selects a 256-byte page of
+        // Pages. Page 0 is all-unmapped. 0 means unmapped (except for U+0000).
+        struct EncodeTable
+        {
+            UINT8 Index[256];
+            std::vector<UINT8> Pages;
+
+            EncodeTable();
+
+            void
+            Add(char16_t ch, UINT8 b);
+
+            UINT8
+            Lookup(char16_t ch) const noexcept
+            {
+                return Pages[Index[ch >> 8] * 256u + (ch & 0xFF)];
+            }
+        };
+
+        unsigned m_codePage;
+        UINT8 m_defaultChar;
+        bool m_asciiCompatible;
+        bool m_anyInvalid;
+        UINT64 m_invalid[4]; // Bytes rejected by MB_ERR_INVALID_CHARS.
+        char16_t m_decode[256];
+        UINT32 m_decodeUtf8[256]; // UTF-8 of m_decode in bits 0..23, length in bits 24..31.
+        EncodeTable m_exact;
+        mutable std::once_flag m_bestFitOnce;
+        mutable EncodeTable m_bestFit;
+
+        explicit
+        SbcsCodec(unsigned codePage, UINT8 defaultChar) noexcept;
+
+        static std::unique_ptr<SbcsCodec>
+        Create(unsigned codePage);
+
+        void
+        Initialize();
+
+        void
+        BuildBestFit() const;
+
+        bool
+        IsInvalid(UINT8 b) const noexcept
+        {
+            return (m_invalid[b >> 6] >> (b & 63)) & 1;
+        }
+
+    public:
+
+        struct EncodeResult
+        {
+            size_t InputUsed;
+            size_t OutputUsed;
+            bool UsedDefaultChar;
+        };
+
+        /*
+        Returns the codec for the specified code page, or null if the code page
+        is not a single-byte code page with a known table. The returned codec
+        lives until the process exits.
+        */
+        static SbcsCodec const*
+        Get(unsigned codePage);
+
+        UINT8
+        DefaultChar() const noexcept
+        {
+            return m_defaultChar;
+        }
+
+        /*
+        Converts cInput bytes to cInput char16s. Returns true if any byte
+        would be rejected by MB_ERR_INVALID_CHARS (such bytes are still
+        converted).
+        */
+        bool
+        Decode(
+            _In_reads_(cInput) UINT8 const* pInput,
+            size_t cInput,
+            _Out_writes_(cInput) char16_t* pOutput) const noexcept;
+
+        struct DecodeToUtf8Result
+        {
+            size_t OutputUsed;
+            bool AnyInvalid;
+        };
+
+        /*
+        Converts cInput bytes directly to UTF-8, writing at most three bytes
+        per input byte. AnyInvalid is set if any byte would be rejected by
+        MB_ERR_INVALID_CHARS (such bytes are still converted).
+        */
+        DecodeToUtf8Result
+        DecodeToUtf8(
+            _In_reads_(cInput) UINT8 const* pInput,
+            size_t cInput,
+            _Out_writes_to_(cInput * 3, return.OutputUsed) UINT8* pOutput) const noexcept;
+
+        /*
+        Converts UTF-16 to bytes, writing at most one byte per char16. Stops
+        before a high surrogate at the end of input. Characters without a
+        mapping (including surrogate pairs and unmatched surrogates) are
+        replaced with defaultChar. If bestFit is true, characters without an
+        exact mapping may be replaced with a similar-looking character instead
+        (on Windows, as chosen by WideCharToMultiByte).
+        */
+        EncodeResult
+        Encode(
+            _In_reads_(cInput) char16_t const* pInput,
+            size_t cInput,
+            _Out_writes_to_(cInput, return.OutputUsed) UINT8* pOutput,
+            bool bestFit,
+            UINT8 defaultChar) const;
+    };
+}
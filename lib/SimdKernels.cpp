@@ -0,0 +1,1681 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+// Portable (no pch.h) so that it builds without Windows headers.
+#include "SimdKernels.h"
+#include "Utility.h"
+
+#include <assert.h>
+
+#include <bit>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TEXTTOOLS_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define TEXTTOOLS_SIMD_X86 0
+#endif
+
+// MSVC allows any intrinsic in any function. GCC and Clang need to be told
+// which functions may use AVX2.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#ifndef PF_AVX2_INSTRUCTIONS_AVAILABLE
+#define PF_AVX2_INSTRUCTIONS_AVAILABLE 40
+#endif
+
+using namespace TextToolsImpl;
+
+static SimdLevel
+DetectSimdLevel() noexcept
+{
+#if !TEXTTOOLS_SIMD_X86
+    return SimdLevel::Scalar;
+#elif defined(_WIN32)
+    return IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE)
+        ? SimdLevel::Avx2
+        : SimdLevel::Sse2;
+#else
+    return __builtin_cpu_supports("avx2")
+        ? SimdLevel::Avx2
+        : SimdLevel::Sse2;
+#endif
+}
+
+static SimdLevel g_simdLevel = DetectSimdLevel(); // Changed only by LimitSimdLevel.
+
+SimdLevel
+TextToolsImpl::LimitSimdLevel(SimdLevel maxLevel) noexcept
+{
+    auto const detected = DetectSimdLevel();
+    g_simdLevel = maxLevel < detected ? maxLevel : detected;
+    return g_simdLevel;
+}
+
+static constexpr char16_t
+Swap16(char16_t ch) noexcept
+{
+    return static_cast<char16_t>((ch << 8) | (ch >> 8));
+}
+
+static size_t
+WidenAsciiScalar(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+    size_t i = 0;
+
+    // 8 bytes at a time while all are ASCII.
+    for (; cInput - i >= 8; i += 8)
+    {
+        UINT64 block;
+        memcpy(&block, pInput + i, sizeof(block));
+        if (block & 0x8080808080808080u)
+        {
+            break;
+        }
+
+        for (unsigned j = 0; j != 8; j += 1)
+        {
+            pOutput[i + j] = pInput[i + j];
+        }
+    }
+
+    for (; i != cInput && pInput[i] < 0x80; i += 1)
+    {
+        pOutput[i] = pInput[i];
+    }
+
+    return i;
+}
+
+static size_t
+NarrowAsciiScalar(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept
+{
+    size_t i = 0;
+
+    // 4 char16s at a time while all are ASCII.
+    for (; cInput - i >= 4; i += 4)
+    {
+        UINT64 block;
+        memcpy(&block, pInput + i, sizeof(block));
+        if (block & 0xFF80FF80FF80FF80u)
+        {
+            break;
+        }
+
+        for (unsigned j = 0; j != 4; j += 1)
+        {
+            pOutput[i + j] = static_cast<UINT8>(pInput[i + j]);
+        }
+    }
+
+    for (; i != cInput && pInput[i] < 0x80; i += 1)
+    {
+        pOutput[i] = static_cast<UINT8>(pInput[i]);
+    }
+
+    return i;
+}
+
+static size_t
+CopyAsciiScalar(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept
+{
+    size_t i = 0;
+
+    // 8 bytes at a time while all are ASCII.
+    for (; cInput - i >= 8; i += 8)
+    {
+        UINT64 block;
+        memcpy(&block, pInput + i, sizeof(block));
+        if (block & 0x8080808080808080u)
+        {
+            break;
+        }
+
+        memcpy(pOutput + i, &block, sizeof(block));
+    }
+
+    for (; i != cInput && pInput[i] < 0x80; i += 1)
+    {
+        pOutput[i] = pInput[i];
+    }
+
+    return i;
+}
+
+static size_t
+SkipValidUtf8Scalar(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput) noexcept
+{
+    size_t i = 0;
+
+    // 8 bytes at a time while all are ASCII.
+    for (; cInput - i >= 8; i += 8)
+    {
+        UINT64 block;
+        memcpy(&block, pInput + i, sizeof(block));
+        if (block & 0x8080808080808080u)
+        {
+            break;
+        }
+    }
+
+    for (; i != cInput && pInput[i] < 0x80; i += 1)
+    {
+    }
+
+    return i;
+}
+
+template<ByteSwap Swap>
+static size_t
+CopyValidUtf16Scalar(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+    size_t i = 0;
+    while (i != cInput)
+    {
+        auto const ch0 = Swap == ByteSwap::Input ? Swap16(pInput[i]) : pInput[i];
+        if (ch0 < 0xD800 || ch0 >= 0xE000)
+        {
+            // Not a surrogate.
+            pOutput[i] = Swap != ByteSwap::None ? Swap16(pInput[i]) : pInput[i];
+            i += 1;
+        }
+        else if (ch0 >= 0xDC00 || i + 1 == cInput)
+        {
+            // Unmatched low surrogate or high surrogate at end of input.
+            break;
+        }
+        else if (
+            auto const ch1 = Swap == ByteSwap::Input ? Swap16(pInput[i + 1]) : pInput[i + 1];
+            ch1 >= 0xDC00 && ch1 < 0xE000)
+        {
+            // Surrogate pair.
+            pOutput[i] = Swap != ByteSwap::None ? Swap16(pInput[i]) : pInput[i];
+            pOutput[i + 1] = Swap != ByteSwap::None ? Swap16(pInput[i + 1]) : pInput[i + 1];
+            i += 2;
+        }
+        else
+        {
+            // Unmatched high surrogate.
+            break;
+        }
+    }
+
+    return i;
+}
+
+static constexpr char32_t
+Swap32(char32_t ch) noexcept
+{
+    return (ch << 24) | ((ch & 0xFF00) << 8) | ((ch >> 8) & 0xFF00) | (ch >> 24);
+}
+
+template<ByteSwap Swap>
+static size_t
+Utf16ToUtf32BmpScalar(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char32_t* pOutput) noexcept
+{
+    size_t i = 0;
+    for (; i != cInput; i += 1)
+    {
+        char32_t const ch = Swap == ByteSwap::Input ? Swap16(pInput[i]) : pInput[i];
+        if (ch >= 0xD800 && ch < 0xE000)
+        {
+            break;
+        }
+
+        pOutput[i] = Swap == ByteSwap::Output ? Swap32(ch) : ch;
+    }
+
+    return i;
+}
+
+template<ByteSwap Swap>
+static size_t
+Utf32ToUtf16BmpScalar(
+    _In_reads_(cInput) char32_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+    size_t i = 0;
+    for (; i != cInput; i += 1)
+    {
+        char32_t const ch = Swap == ByteSwap::Input ? Swap32(pInput[i]) : pInput[i];
+        if (ch > 0xFFFF || (ch >= 0xD800 && ch < 0xE000))
+        {
+            break;
+        }
+
+        auto const ch16 = static_cast<char16_t>(ch);
+        pOutput[i] = Swap == ByteSwap::Output ? Swap16(ch16) : ch16;
+    }
+
+    return i;
+}
+
+// Folds pData[i..cData) into pData[o..). Requires o <= i.
+template<class T>
+static size_t
+FoldCRLFScalar(
+    _Inout_updates_(cData) T* pData,
+    size_t cData,
+    size_t i,
+    size_t o,
+    bool& prevCR) noexcept
+{
+    for (; i != cData; i += 1)
+    {
+        T const ch = pData[i];
+        bool const isCR = ch == T('\r');
+        pData[o] = isCR ? T('\n') : ch;
+        o += !(ch == T('\n') && prevCR); // Drop LF of CRLF (the CR became LF).
+        prevCR = isCR;
+    }
+
+    return o;
+}
+
+template<class T>
+static size_t
+CountLFScalar(
+    _In_reads_(cInput) T const* pInput,
+    size_t cInput) noexcept
+{
+    size_t cLF = 0;
+    for (size_t i = 0; i != cInput; i += 1)
+    {
+        cLF += pInput[i] == T('\n');
+    }
+
+    return cLF;
+}
+
+// Expands pInput[i..cInput) into pOutput[o..).
+template<class T>
+static void
+ExpandCRLFScalar(
+    _In_reads_(cInput) T const* pInput,
+    size_t cInput,
+    _Out_ T* pOutput,
+    size_t i,
+    size_t o) noexcept
+{
+    for (; i != cInput; i += 1)
+    {
+        T const ch = pInput[i];
+        pOutput[o] = T('\r'); // Overwritten by ch unless ch is LF.
+        o += ch == T('\n');
+        pOutput[o++] = ch;
+    }
+}
+
+#if TEXTTOOLS_SIMD_X86
+
+static size_t
+WidenAsciiSse2(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+    __m128i const zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; cInput - i >= 16; i += 16)
+    {
+        __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i));
+        if (_mm_movemask_epi8(bytes) != 0)
+        {
+            break;
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + i), _mm_unpacklo_epi8(bytes, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + i + 8), _mm_unpackhi_epi8(bytes, zero));
+    }
+
+    // Finish the partial block, stopping at the first non-ASCII byte.
+    return i + WidenAsciiScalar(pInput + i, cInput - i, pOutput + i);
+}
+
+static size_t
+NarrowAsciiSse2(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const nonAsciiBits = _mm_set1_epi16(static_cast<short>(0xFF80));
+    size_t i = 0;
+
+    for (; cInput - i >= 16; i += 16)
+    {
+        __m128i const lo = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i));
+        __m128i const hi = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i + 8));
+        __m128i const nonAscii = _mm_and_si128(_mm_or_si128(lo, hi), nonAsciiBits);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(nonAscii, zero)) != 0xFFFF)
+        {
+            break;
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + i), _mm_packus_epi16(lo, hi));
+    }
+
+    // Finish the partial block, stopping at the first non-ASCII char16.
+    return i + NarrowAsciiScalar(pInput + i, cInput - i, pOutput + i);
+}
+
+static size_t
+CopyAsciiSse2(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept
+{
+    size_t i = 0;
+
+    for (; cInput - i >= 16; i += 16)
+    {
+        __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i));
+        if (_mm_movemask_epi8(bytes) != 0)
+        {
+            break;
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + i), bytes);
+    }
+
+    return i + CopyAsciiScalar(pInput + i, cInput - i, pOutput + i);
+}
+
+static size_t
+SkipValidUtf8Sse2(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput) noexcept
+{
+    size_t i = 0;
+
+    for (; cInput - i >= 16; i += 16)
+    {
+        __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i));
+        if (_mm_movemask_epi8(bytes) != 0)
+        {
+            break;
+        }
+    }
+
+    return i + SkipValidUtf8Scalar(pInput + i, cInput - i);
+}
+
+static __m128i
+Swap16Sse2(__m128i value) noexcept
+{
+    return _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+}
+
+/*
+Vector check for valid UTF-16: each low surrogate must immediately follow a
+high surrogate, i.e. lowMask == (highMask << 1 | carry), where carry is set
+if the previous block ended with a high surrogate.
+*/
+template<ByteSwap Swap>
+static size_t
+CopyValidUtf16Sse2(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+    __m128i const surrogateBits = _mm_set1_epi16(static_cast<short>(0xFC00));
+    __m128i const highSurrogate = _mm_set1_epi16(static_cast<short>(0xD800));
+    __m128i const lowSurrogate = _mm_set1_epi16(static_cast<short>(0xDC00));
+    unsigned carry = 0;
+    size_t i = 0;
+
+    for (; cInput - i >= 16; i += 16)
+    {
+        __m128i const in0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i));
+        __m128i const in1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i + 8));
+        __m128i const native0 = Swap == ByteSwap::Input ? Swap16Sse2(in0) : in0;
+        __m128i const native1 = Swap == ByteSwap::Input ? Swap16Sse2(in1) : in1;
+        __m128i const kind0 = _mm_and_si128(native0, surrogateBits);
+        __m128i const kind1 = _mm_and_si128(native1, surrogateBits);
+        unsigned const highMask = _mm_movemask_epi8(_mm_packs_epi16(
+            _mm_cmpeq_epi16(kind0, highSurrogate), _mm_cmpeq_epi16(kind1, highSurrogate)));
+        unsigned const lowMask = _mm_movemask_epi8(_mm_packs_epi16(
+            _mm_cmpeq_epi16(kind0, lowSurrogate), _mm_cmpeq_epi16(kind1, lowSurrogate)));
+        if (lowMask != (((highMask << 1) | carry) & 0xFFFF))
+        {
+            break;
+        }
+
+        carry = highMask >> 15;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + i), Swap != ByteSwap::None ? Swap16Sse2(in0) : in0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + i + 8), Swap != ByteSwap::None ? Swap16Sse2(in1) : in1);
+    }
+
+    // If the last block ended with a high surrogate, let the scalar loop
+    // re-check it together with its low surrogate.
+    i -= carry;
+    return i + CopyValidUtf16Scalar<Swap>(pInput + i, cInput - i, pOutput + i);
+}
+
+static __m128i
+Swap32Sse2(__m128i value) noexcept
+{
+    // Swap the 16-bit halves, then the bytes within each half.
+    value = _mm_shufflehi_epi16(_mm_shufflelo_epi16(value, 0xB1), 0xB1);
+    return Swap16Sse2(value);
+}
+
+template<ByteSwap Swap>
+static size_t
+Utf16ToUtf32BmpSse2(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char32_t* pOutput) noexcept
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const surrogateBits = _mm_set1_epi16(static_cast<short>(0xF800));
+    __m128i const surrogate = _mm_set1_epi16(static_cast<short>(0xD800));
+    size_t i = 0;
+
+    for (; cInput - i >= 8; i += 8)
+    {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i));
+        if constexpr (Swap == ByteSwap::Input)
+        {
+            in = Swap16Sse2(in);
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(in, surrogateBits), surrogate)) != 0)
+        {
+            break;
+        }
+
+        __m128i lo = _mm_unpacklo_epi16(in, zero);
+        __m128i hi = _mm_unpackhi_epi16(in, zero);
+        if constexpr (Swap == ByteSwap::Output)
+        {
+            lo = Swap32Sse2(lo);
+            hi = Swap32Sse2(hi);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + i + 4), hi);
+    }
+
+    return i + Utf16ToUtf32BmpScalar<Swap>(pInput + i, cInput - i, pOutput + i);
+}
+
+template<ByteSwap Swap>
+static size_t
+Utf32ToUtf16BmpSse2(
+    _In_reads_(cInput) char32_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const surrogateBits = _mm_set1_epi32(static_cast<int>(0xFFFFF800));
+    __m128i const surrogate = _mm_set1_epi32(0xD800);
+    __m128i const bias32 = _mm_set1_epi32(0x8000);
+    __m128i const bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+    size_t i = 0;
+
+    for (; cInput - i >= 8; i += 8)
+    {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i + 4));
+        if constexpr (Swap == ByteSwap::Input)
+        {
+            lo = Swap32Sse2(lo);
+            hi = Swap32Sse2(hi);
+        }
+
+        // Every value must be <= 0xFFFF and not a surrogate.
+        __m128i const aboveBmp = _mm_or_si128(_mm_srli_epi32(lo, 16), _mm_srli_epi32(hi, 16));
+        __m128i const isSurrogate = _mm_or_si128(
+            _mm_cmpeq_epi32(_mm_and_si128(lo, surrogateBits), surrogate),
+            _mm_cmpeq_epi32(_mm_and_si128(hi, surrogateBits), surrogate));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(aboveBmp, zero)) != 0xFFFF ||
+            _mm_movemask_epi8(isSurrogate) != 0)
+        {
+            break;
+        }
+
+        // SSE2 has no unsigned 32-to-16 pack. Bias into signed range, pack, unbias.
+        __m128i out = _mm_add_epi16(
+            _mm_packs_epi32(_mm_sub_epi32(lo, bias32), _mm_sub_epi32(hi, bias32)),
+            bias16);
+        if constexpr (Swap == ByteSwap::Output)
+        {
+            out = Swap16Sse2(out);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + i), out);
+    }
+
+    return i + Utf32ToUtf16BmpScalar<Swap>(pInput + i, cInput - i, pOutput + i);
+}
+
+// Folds 16 code units per step. Blocks that drop an LF are compacted with a
+// branchless scalar loop (SSE2 has no byte shuffle).
+template<class T>
+static size_t
+FoldCRLFSse2(
+    _Inout_updates_(cData) T* pData,
+    size_t cData,
+    bool& prevCR) noexcept
+{
+    constexpr unsigned VectorCount = sizeof(T); // 16 bytes or 2 x 8 char16s.
+    constexpr unsigned VectorUnits = 16 / sizeof(T);
+    __m128i const cr = sizeof(T) == 1 ? _mm_set1_epi8('\r') : _mm_set1_epi16('\r');
+    __m128i const lf = sizeof(T) == 1 ? _mm_set1_epi8('\n') : _mm_set1_epi16('\n');
+    __m128i const crMinusLf = sizeof(T) == 1 ? _mm_set1_epi8('\r' - '\n') : _mm_set1_epi16('\r' - '\n');
+    unsigned carry = prevCR;
+    size_t i = 0;
+    size_t o = 0;
+
+    for (; cData - i >= 16; i += 16)
+    {
+        __m128i values[VectorCount];
+        __m128i isCR[VectorCount];
+        __m128i isLF[VectorCount];
+        for (unsigned v = 0; v != VectorCount; v += 1)
+        {
+            values[v] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pData + i + v * VectorUnits));
+            isCR[v] = sizeof(T) == 1 ? _mm_cmpeq_epi8(values[v], cr) : _mm_cmpeq_epi16(values[v], cr);
+            isLF[v] = sizeof(T) == 1 ? _mm_cmpeq_epi8(values[v], lf) : _mm_cmpeq_epi16(values[v], lf);
+            values[v] = sizeof(T) == 1
+                ? _mm_sub_epi8(values[v], _mm_and_si128(isCR[v], crMinusLf))
+                : _mm_sub_epi16(values[v], _mm_and_si128(isCR[v], crMinusLf));
+        }
+
+        unsigned const crMask = static_cast<unsigned>(_mm_movemask_epi8(
+            sizeof(T) == 1 ? isCR[0] : _mm_packs_epi16(isCR[0], isCR[VectorCount - 1])));
+        unsigned const lfMask = static_cast<unsigned>(_mm_movemask_epi8(
+            sizeof(T) == 1 ? isLF[0] : _mm_packs_epi16(isLF[0], isLF[VectorCount - 1])));
+        unsigned const dropMask = lfMask & ((crMask << 1) | carry);
+        carry = crMask >> 15;
+
+        if (dropMask == 0)
+        {
+            if (crMask != 0 || o != i)
+            {
+                for (unsigned v = 0; v != VectorCount; v += 1)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(pData + o + v * VectorUnits), values[v]);
+                }
+            }
+
+            o += 16;
+        }
+        else
+        {
+            alignas(16) T block[16];
+            for (unsigned v = 0; v != VectorCount; v += 1)
+            {
+                _mm_store_si128(reinterpret_cast<__m128i*>(block + v * VectorUnits), values[v]);
+            }
+
+            for (unsigned j = 0; j != 16; j += 1)
+            {
+                pData[o] = block[j];
+                o += ((dropMask >> j) & 1) ^ 1;
+            }
+        }
+    }
+
+    prevCR = carry != 0;
+    return FoldCRLFScalar(pData, cData, i, o, prevCR);
+}
+
+template<class T>
+static size_t
+CountLFSse2(
+    _In_reads_(cInput) T const* pInput,
+    size_t cInput) noexcept
+{
+    constexpr unsigned VectorUnits = 16 / sizeof(T);
+    __m128i const lf = sizeof(T) == 1 ? _mm_set1_epi8('\n') : _mm_set1_epi16('\n');
+    size_t cLF = 0;
+    size_t i = 0;
+
+    for (; cInput - i >= VectorUnits; i += VectorUnits)
+    {
+        __m128i const values = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i));
+        unsigned const lfMask = static_cast<unsigned>(_mm_movemask_epi8(
+            sizeof(T) == 1 ? _mm_cmpeq_epi8(values, lf) : _mm_cmpeq_epi16(values, lf)));
+        cLF += std::popcount(lfMask) / sizeof(T);
+    }
+
+    return cLF + CountLFScalar(pInput + i, cInput - i);
+}
+
+// Copies 16 code units per step. Blocks with an LF are expanded with a
+// branchless scalar loop (SSE2 has no byte shuffle).
+template<class T>
+static void
+ExpandCRLFSse2(
+    _In_reads_(cInput) T const* pInput,
+    size_t cInput,
+    _Out_ T* pOutput) noexcept
+{
+    constexpr unsigned VectorCount = sizeof(T); // 16 bytes or 2 x 8 char16s.
+    constexpr unsigned VectorUnits = 16 / sizeof(T);
+    __m128i const lf = sizeof(T) == 1 ? _mm_set1_epi8('\n') : _mm_set1_epi16('\n');
+    __m128i const zero = _mm_setzero_si128();
+    size_t i = 0;
+    size_t o = 0;
+
+    for (; cInput - i >= 16; i += 16)
+    {
+        __m128i values[VectorCount];
+        __m128i anyLF = zero;
+        for (unsigned v = 0; v != VectorCount; v += 1)
+        {
+            values[v] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pInput + i + v * VectorUnits));
+            anyLF = _mm_or_si128(anyLF,
+                sizeof(T) == 1 ? _mm_cmpeq_epi8(values[v], lf) : _mm_cmpeq_epi16(values[v], lf));
+        }
+
+        if (_mm_movemask_epi8(anyLF) == 0)
+        {
+            for (unsigned v = 0; v != VectorCount; v += 1)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + o + v * VectorUnits), values[v]);
+            }
+
+            o += 16;
+        }
+        else
+        {
+            ExpandCRLFScalar(pInput, i + 16, pOutput, i, o);
+            o += 16 + CountLFScalar(pInput + i, 16);
+        }
+    }
+
+    ExpandCRLFScalar(pInput, cInput, pOutput, i, o);
+}
+
+TARGET_AVX2 static size_t
+WidenAsciiAvx2(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+    size_t i = 0;
+
+    for (; cInput - i >= 32; i += 32)
+    {
+        __m256i const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i));
+        if (_mm256_movemask_epi8(bytes) != 0)
+        {
+            break;
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + i),
+            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + i + 16),
+            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+    }
+
+    return i + WidenAsciiScalar(pInput + i, cInput - i, pOutput + i);
+}
+
+TARGET_AVX2 static size_t
+NarrowAsciiAvx2(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept
+{
+    __m256i const nonAsciiBits = _mm256_set1_epi16(static_cast<short>(0xFF80));
+    size_t i = 0;
+
+    for (; cInput - i >= 32; i += 32)
+    {
+        __m256i const lo = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i));
+        __m256i const hi = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i + 16));
+        if (!_mm256_testz_si256(_mm256_or_si256(lo, hi), nonAsciiBits))
+        {
+            break;
+        }
+
+        // packus works within 128-bit lanes. Permute to restore the order.
+        __m256i const packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + i), packed);
+    }
+
+    return i + NarrowAsciiScalar(pInput + i, cInput - i, pOutput + i);
+}
+
+TARGET_AVX2 static size_t
+CopyAsciiAvx2(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept
+{
+    size_t i = 0;
+
+    for (; cInput - i >= 32; i += 32)
+    {
+        __m256i const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i));
+        if (_mm256_movemask_epi8(bytes) != 0)
+        {
+            break;
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + i), bytes);
+    }
+
+    return i + CopyAsciiScalar(pInput + i, cInput - i, pOutput + i);
+}
+
+// Returns the 32 bytes ending n bytes before the start of input, i.e. the
+// bytes of input shifted right by n with the last n bytes of prev shifted in.
+template<int n>
+TARGET_AVX2 static __m256i
+PrevBytesAvx2(__m256i input, __m256i prev) noexcept
+{
+    return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - n);
+}
+
+// Looks up each nibble of indexes (0..15) in a 16-entry table.
+TARGET_AVX2 static __m256i
+Lookup16Avx2(__m256i indexes, __m256i table) noexcept
+{
+    return _mm256_shuffle_epi8(table, indexes);
+}
+
+TARGET_AVX2 static __m256i
+HighNibblesAvx2(__m256i bytes) noexcept
+{
+    return _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0F));
+}
+
+// Returns nonzero bytes where input (with the preceding bytes from prev) is
+// not valid UTF-8. Does not detect a sequence that is incomplete at the end
+// of input; that shows up as an error in the next block.
+TARGET_AVX2 static __m256i
+CheckUtf8BlockAvx2(__m256i input, __m256i prev) noexcept
+{
+    // Each bit flags one kind of error for a pair of adjacent bytes. A pair
+    // is invalid if the bit is set in all three lookups.
+    constexpr char TooShort = 1 << 0;   // 11______ 0_______ or 11______ 11______
+    constexpr char TooLong = 1 << 1;    // 0_______ 10______
+    constexpr char Overlong3 = 1 << 2;  // 11100000 100_____
+    constexpr char TooLarge = 1 << 3;   // 11110100 1001____ (or larger)
+    constexpr char Surrogate = 1 << 4;  // 11101101 101_____
+    constexpr char Overlong2 = 1 << 5;  // 1100000_ 10______
+    constexpr char TooLarge1000 = 1 << 6; // 11110101 1000____ (or larger)
+    constexpr char Overlong4 = 1 << 6;  // 11110000 1000____
+    constexpr char TwoConts = static_cast<char>(1 << 7); // 10______ 10______
+    constexpr char Carry = TooShort | TooLong | TwoConts;
+
+    __m256i const byte1HighTable = _mm256_setr_epi8(
+        TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+        TwoConts, TwoConts, TwoConts, TwoConts,
+        TooShort | Overlong2,
+        TooShort,
+        TooShort | Overlong3 | Surrogate,
+        TooShort | TooLarge | TooLarge1000 | Overlong4,
+        TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+        TwoConts, TwoConts, TwoConts, TwoConts,
+        TooShort | Overlong2,
+        TooShort,
+        TooShort | Overlong3 | Surrogate,
+        TooShort | TooLarge | TooLarge1000 | Overlong4);
+    __m256i const byte1LowTable = _mm256_setr_epi8(
+        Carry | Overlong3 | Overlong2 | Overlong4,
+        Carry | Overlong2,
+        Carry,
+        Carry,
+        Carry | TooLarge,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000 | Surrogate,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | Overlong3 | Overlong2 | Overlong4,
+        Carry | Overlong2,
+        Carry,
+        Carry,
+        Carry | TooLarge,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000 | Surrogate,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000);
+    constexpr char Cont1000 = TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge1000 | Overlong4;
+    constexpr char Cont1001 = TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge;
+    constexpr char Cont101 = TooLong | Overlong2 | TwoConts | Surrogate | TooLarge;
+    __m256i const byte2HighTable = _mm256_setr_epi8(
+        TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort,
+        Cont1000, Cont1001, Cont101, Cont101,
+        TooShort, TooShort, TooShort, TooShort,
+        TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort,
+        Cont1000, Cont1001, Cont101, Cont101,
+        TooShort, TooShort, TooShort, TooShort);
+
+    __m256i const prev1 = PrevBytesAvx2<1>(input, prev);
+    __m256i const specialCases = _mm256_and_si256(
+        _mm256_and_si256(
+            Lookup16Avx2(HighNibblesAvx2(prev1), byte1HighTable),
+            Lookup16Avx2(_mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)), byte1LowTable)),
+        Lookup16Avx2(HighNibblesAvx2(input), byte2HighTable));
+
+    // The third and fourth bytes of 3- and 4-byte sequences must be
+    // continuations, i.e. must have TwoConts set (and nothing else).
+    __m256i const prev2 = PrevBytesAvx2<2>(input, prev);
+    __m256i const prev3 = PrevBytesAvx2<3>(input, prev);
+    __m256i const isThirdByte = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+    __m256i const isFourthByte = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+    __m256i const mustBeCont = _mm256_and_si256(
+        _mm256_or_si256(isThirdByte, isFourthByte),
+        _mm256_set1_epi8(static_cast<char>(0x80)));
+    return _mm256_xor_si256(mustBeCont, specialCases);
+}
+
+TARGET_AVX2 static size_t
+SkipValidUtf8Avx2(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput) noexcept
+{
+    __m256i prev = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; cInput - i >= 32; i += 32)
+    {
+        __m256i const input = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i));
+
+        // Skip the check if the block and the last 3 bytes of the previous
+        // block are all ASCII.
+        if (_mm256_movemask_epi8(input) == 0 &&
+            (static_cast<unsigned>(_mm256_movemask_epi8(prev)) >> 29) == 0)
+        {
+            prev = input;
+            continue;
+        }
+
+        __m256i const error = CheckUtf8BlockAvx2(input, prev);
+        if (!_mm256_testz_si256(error, error))
+        {
+            break;
+        }
+
+        prev = input;
+    }
+
+    // Everything before i is valid except that the last character might
+    // continue past i. Back up to the start of that character.
+    size_t end = i;
+    for (unsigned j = 0; j != 3 && end != 0 && (pInput[end - 1] & 0xC0) == 0x80; j += 1)
+    {
+        end -= 1;
+    }
+
+    if (end != 0 && pInput[end - 1] >= 0xC0)
+    {
+        end -= 1;
+    }
+
+    return end + SkipValidUtf8Scalar(pInput + end, cInput - end);
+}
+
+TARGET_AVX2 static __m256i
+Swap16Avx2(__m256i value) noexcept
+{
+    __m256i const shuffle = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    return _mm256_shuffle_epi8(value, shuffle);
+}
+
+// Packs two vectors of 16-bit compare results into a 32-bit mask, in order.
+TARGET_AVX2 static unsigned
+MoveMask16Avx2(__m256i cmp0, __m256i cmp1) noexcept
+{
+    return static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_permute4x64_epi64(_mm256_packs_epi16(cmp0, cmp1), 0xD8)));
+}
+
+template<ByteSwap Swap>
+TARGET_AVX2 static size_t
+CopyValidUtf16Avx2(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+    __m256i const surrogateBits = _mm256_set1_epi16(static_cast<short>(0xFC00));
+    __m256i const highSurrogate = _mm256_set1_epi16(static_cast<short>(0xD800));
+    __m256i const lowSurrogate = _mm256_set1_epi16(static_cast<short>(0xDC00));
+    unsigned carry = 0;
+    size_t i = 0;
+
+    for (; cInput - i >= 32; i += 32)
+    {
+        __m256i const in0 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i));
+        __m256i const in1 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i + 16));
+        __m256i const native0 = Swap == ByteSwap::Input ? Swap16Avx2(in0) : in0;
+        __m256i const native1 = Swap == ByteSwap::Input ? Swap16Avx2(in1) : in1;
+        __m256i const kind0 = _mm256_and_si256(native0, surrogateBits);
+        __m256i const kind1 = _mm256_and_si256(native1, surrogateBits);
+        unsigned const highMask = MoveMask16Avx2(
+            _mm256_cmpeq_epi16(kind0, highSurrogate), _mm256_cmpeq_epi16(kind1, highSurrogate));
+        unsigned const lowMask = MoveMask16Avx2(
+            _mm256_cmpeq_epi16(kind0, lowSurrogate), _mm256_cmpeq_epi16(kind1, lowSurrogate));
+        if (lowMask != ((highMask << 1) | carry))
+        {
+            break;
+        }
+
+        carry = highMask >> 31;
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + i), Swap != ByteSwap::None ? Swap16Avx2(in0) : in0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + i + 16), Swap != ByteSwap::None ? Swap16Avx2(in1) : in1);
+    }
+
+    i -= carry;
+    return i + CopyValidUtf16Scalar<Swap>(pInput + i, cInput - i, pOutput + i);
+}
+
+TARGET_AVX2 static __m256i
+Swap32Avx2(__m256i value) noexcept
+{
+    __m256i const shuffle = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    return _mm256_shuffle_epi8(value, shuffle);
+}
+
+template<ByteSwap Swap>
+TARGET_AVX2 static size_t
+Utf16ToUtf32BmpAvx2(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char32_t* pOutput) noexcept
+{
+    __m256i const surrogateBits = _mm256_set1_epi16(static_cast<short>(0xF800));
+    __m256i const surrogate = _mm256_set1_epi16(static_cast<short>(0xD800));
+    size_t i = 0;
+
+    for (; cInput - i >= 16; i += 16)
+    {
+        __m256i in = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i));
+        if constexpr (Swap == ByteSwap::Input)
+        {
+            in = Swap16Avx2(in);
+        }
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(in, surrogateBits), surrogate)) != 0)
+        {
+            break;
+        }
+
+        __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(in));
+        __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(in, 1));
+        if constexpr (Swap == ByteSwap::Output)
+        {
+            lo = Swap32Avx2(lo);
+            hi = Swap32Avx2(hi);
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + i), lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + i + 8), hi);
+    }
+
+    return i + Utf16ToUtf32BmpScalar<Swap>(pInput + i, cInput - i, pOutput + i);
+}
+
+template<ByteSwap Swap>
+TARGET_AVX2 static size_t
+Utf32ToUtf16BmpAvx2(
+    _In_reads_(cInput) char32_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+    __m256i const aboveBmpBits = _mm256_set1_epi32(static_cast<int>(0xFFFF0000));
+    __m256i const surrogateBits = _mm256_set1_epi32(static_cast<int>(0xFFFFF800));
+    __m256i const surrogate = _mm256_set1_epi32(0xD800);
+    size_t i = 0;
+
+    for (; cInput - i >= 16; i += 16)
+    {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i + 8));
+        if constexpr (Swap == ByteSwap::Input)
+        {
+            lo = Swap32Avx2(lo);
+            hi = Swap32Avx2(hi);
+        }
+
+        // Every value must be <= 0xFFFF and not a surrogate.
+        __m256i const isSurrogate = _mm256_or_si256(
+            _mm256_cmpeq_epi32(_mm256_and_si256(lo, surrogateBits), surrogate),
+            _mm256_cmpeq_epi32(_mm256_and_si256(hi, surrogateBits), surrogate));
+        if (!_mm256_testz_si256(_mm256_or_si256(lo, hi), aboveBmpBits) ||
+            !_mm256_testz_si256(isSurrogate, isSurrogate))
+        {
+            break;
+        }
+
+        // packus works within 128-bit lanes. Permute to restore the order.
+        __m256i out = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+        if constexpr (Swap == ByteSwap::Output)
+        {
+            out = Swap16Avx2(out);
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + i), out);
+    }
+
+    return i + Utf32ToUtf16BmpScalar<Swap>(pInput + i, cInput - i, pOutput + i);
+}
+
+// Shuffle controls that move the selected bytes of an 8-byte group to the
+// front: Entries[mask] lists the positions of the bits set in mask.
+struct CompactShuffleTable
+{
+    UINT8 Entries[256][8];
+
+    constexpr
+    CompactShuffleTable() noexcept
+        : Entries()
+    {
+        for (unsigned mask = 0; mask != 256; mask += 1)
+        {
+            unsigned n = 0;
+            for (unsigned j = 0; j != 8; j += 1)
+            {
+                if ((mask >> j) & 1)
+                {
+                    Entries[mask][n++] = static_cast<UINT8>(j);
+                }
+            }
+        }
+    }
+};
+
+alignas(16) static constexpr CompactShuffleTable g_compactShuffle;
+
+// Widens a mask of 4 char16s to a mask of their 8 bytes.
+static constexpr unsigned
+ByteMaskFromChar16Mask(unsigned mask4) noexcept
+{
+    return
+        ((mask4 & 1) * 0x03) |
+        ((mask4 & 2) * 0x06) |
+        ((mask4 & 4) * 0x0C) |
+        ((mask4 & 8) * 0x18);
+}
+
+// Folds 32 code units per step. Blocks that drop an LF are compacted 8 bytes
+// at a time with a shuffle from g_compactShuffle.
+template<class T>
+TARGET_AVX2 static size_t
+FoldCRLFAvx2(
+    _Inout_updates_(cData) T* pData,
+    size_t cData,
+    bool& prevCR) noexcept
+{
+    constexpr unsigned VectorCount = sizeof(T); // 32 bytes or 2 x 16 char16s.
+    constexpr unsigned VectorUnits = 32 / sizeof(T);
+    __m256i const cr = sizeof(T) == 1 ? _mm256_set1_epi8('\r') : _mm256_set1_epi16('\r');
+    __m256i const lf = sizeof(T) == 1 ? _mm256_set1_epi8('\n') : _mm256_set1_epi16('\n');
+    __m256i const crMinusLf = sizeof(T) == 1 ? _mm256_set1_epi8('\r' - '\n') : _mm256_set1_epi16('\r' - '\n');
+    unsigned carry = prevCR;
+    size_t i = 0;
+    size_t o = 0;
+
+    for (; cData - i >= 32; i += 32)
+    {
+        __m256i values[VectorCount];
+        __m256i isCR[VectorCount];
+        __m256i isLF[VectorCount];
+        for (unsigned v = 0; v != VectorCount; v += 1)
+        {
+            values[v] = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pData + i + v * VectorUnits));
+            isCR[v] = sizeof(T) == 1 ? _mm256_cmpeq_epi8(values[v], cr) : _mm256_cmpeq_epi16(values[v], cr);
+            isLF[v] = sizeof(T) == 1 ? _mm256_cmpeq_epi8(values[v], lf) : _mm256_cmpeq_epi16(values[v], lf);
+            values[v] = sizeof(T) == 1
+                ? _mm256_sub_epi8(values[v], _mm256_and_si256(isCR[v], crMinusLf))
+                : _mm256_sub_epi16(values[v], _mm256_and_si256(isCR[v], crMinusLf));
+        }
+
+        unsigned const crMask = sizeof(T) == 1
+            ? static_cast<unsigned>(_mm256_movemask_epi8(isCR[0]))
+            : MoveMask16Avx2(isCR[0], isCR[VectorCount - 1]);
+        unsigned const lfMask = sizeof(T) == 1
+            ? static_cast<unsigned>(_mm256_movemask_epi8(isLF[0]))
+            : MoveMask16Avx2(isLF[0], isLF[VectorCount - 1]);
+        unsigned const dropMask = lfMask & ((crMask << 1) | carry);
+        carry = crMask >> 31;
+
+        if (dropMask == 0)
+        {
+            if (crMask != 0 || o != i)
+            {
+                for (unsigned v = 0; v != VectorCount; v += 1)
+                {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pData + o + v * VectorUnits), values[v]);
+                }
+            }
+
+            o += 32;
+        }
+        else
+        {
+            alignas(32) T block[32];
+            for (unsigned v = 0; v != VectorCount; v += 1)
+            {
+                _mm256_store_si256(reinterpret_cast<__m256i*>(block + v * VectorUnits), values[v]);
+            }
+
+            // Each 8-byte store lands at or before the group's input position,
+            // so it never overwrites input that has not been loaded yet.
+            auto const pBlock = reinterpret_cast<UINT8 const*>(block);
+            auto pOutput = reinterpret_cast<UINT8*>(pData + o);
+            unsigned const keepMask = ~dropMask;
+            for (unsigned g = 0; g != sizeof(block) / 8; g += 1)
+            {
+                unsigned const keepBytes = sizeof(T) == 1
+                    ? (keepMask >> (g * 8)) & 0xFF
+                    : ByteMaskFromChar16Mask((keepMask >> (g * 4)) & 0xF);
+                __m128i const group = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(pBlock + g * 8));
+                __m128i const shuffle = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(g_compactShuffle.Entries[keepBytes]));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(pOutput), _mm_shuffle_epi8(group, shuffle));
+                pOutput += std::popcount(keepBytes);
+            }
+
+            o = reinterpret_cast<T*>(pOutput) - pData;
+        }
+    }
+
+    prevCR = carry != 0;
+    return FoldCRLFScalar(pData, cData, i, o, prevCR);
+}
+
+// Shuffle controls that expand an 8-byte group (in the low half of the
+// source) by inserting the byte or char16 at source offset 8 (CR) before each
+// LF. Bytes[mask] is for 8 bytes with LFs at the bits set in mask. Char16s[mask]
+// is for 4 char16s. Unused entries are 0x80 (zero).
+struct ExpandShuffleTable
+{
+    UINT8 Bytes[256][16];
+    UINT8 Char16s[16][16];
+
+    constexpr
+    ExpandShuffleTable() noexcept
+        : Bytes()
+        , Char16s()
+    {
+        for (unsigned mask = 0; mask != 256; mask += 1)
+        {
+            unsigned n = 0;
+            for (unsigned j = 0; j != 8; j += 1)
+            {
+                if ((mask >> j) & 1)
+                {
+                    Bytes[mask][n++] = 8;
+                }
+
+                Bytes[mask][n++] = static_cast<UINT8>(j);
+            }
+
+            for (; n != 16; n += 1)
+            {
+                Bytes[mask][n] = 0x80;
+            }
+        }
+
+        for (unsigned mask = 0; mask != 16; mask += 1)
+        {
+            unsigned n = 0;
+            for (unsigned j = 0; j != 4; j += 1)
+            {
+                if ((mask >> j) & 1)
+                {
+                    Char16s[mask][n++] = 8;
+                    Char16s[mask][n++] = 9;
+                }
+
+                Char16s[mask][n++] = static_cast<UINT8>(j * 2);
+                Char16s[mask][n++] = static_cast<UINT8>(j * 2 + 1);
+            }
+
+            for (; n != 16; n += 1)
+            {
+                Char16s[mask][n] = 0x80;
+            }
+        }
+    }
+};
+
+alignas(16) static constexpr ExpandShuffleTable g_expandShuffle;
+
+template<class T>
+TARGET_AVX2 static size_t
+CountLFAvx2(
+    _In_reads_(cInput) T const* pInput,
+    size_t cInput) noexcept
+{
+    constexpr unsigned VectorUnits = 32 / sizeof(T);
+    __m256i const lf = sizeof(T) == 1 ? _mm256_set1_epi8('\n') : _mm256_set1_epi16('\n');
+    size_t cLF = 0;
+    size_t i = 0;
+
+    for (; cInput - i >= VectorUnits; i += VectorUnits)
+    {
+        __m256i const values = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i));
+        unsigned const lfMask = static_cast<unsigned>(_mm256_movemask_epi8(
+            sizeof(T) == 1 ? _mm256_cmpeq_epi8(values, lf) : _mm256_cmpeq_epi16(values, lf)));
+        cLF += std::popcount(lfMask) / sizeof(T);
+    }
+
+    return cLF + CountLFScalar(pInput + i, cInput - i);
+}
+
+// Copies 32 code units per step. Blocks with an LF are expanded 8 bytes at a
+// time with a shuffle from g_expandShuffle.
+template<class T>
+TARGET_AVX2 static void
+ExpandCRLFAvx2(
+    _In_reads_(cInput) T const* pInput,
+    size_t cInput,
+    _Out_ T* pOutput) noexcept
+{
+    constexpr unsigned VectorCount = sizeof(T); // 32 bytes or 2 x 16 char16s.
+    constexpr unsigned VectorUnits = 32 / sizeof(T);
+    __m256i const lf = sizeof(T) == 1 ? _mm256_set1_epi8('\n') : _mm256_set1_epi16('\n');
+    __m128i const cr = sizeof(T) == 1 ? _mm_set1_epi8('\r') : _mm_set1_epi16('\r');
+    size_t i = 0;
+    size_t o = 0;
+
+    // Each group's 16-byte store can write up to 8 bytes past the group's
+    // output. Keep 8 code units of input after the block so those bytes are
+    // still inside the output (and get overwritten later).
+    for (; cInput - i >= 32 + 8; i += 32)
+    {
+        __m256i values[VectorCount];
+        __m256i isLF[VectorCount];
+        for (unsigned v = 0; v != VectorCount; v += 1)
+        {
+            values[v] = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pInput + i + v * VectorUnits));
+            isLF[v] = sizeof(T) == 1 ? _mm256_cmpeq_epi8(values[v], lf) : _mm256_cmpeq_epi16(values[v], lf);
+        }
+
+        unsigned const lfMask = sizeof(T) == 1
+            ? static_cast<unsigned>(_mm256_movemask_epi8(isLF[0]))
+            : MoveMask16Avx2(isLF[0], isLF[VectorCount - 1]);
+        if (lfMask == 0)
+        {
+            for (unsigned v = 0; v != VectorCount; v += 1)
+            {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + o + v * VectorUnits), values[v]);
+            }
+
+            o += 32;
+            continue;
+        }
+
+        auto const pBlock = reinterpret_cast<UINT8 const*>(pInput + i);
+        auto pGroupOutput = reinterpret_cast<UINT8*>(pOutput + o);
+        for (unsigned g = 0; g != 32 * sizeof(T) / 8; g += 1)
+        {
+            unsigned const groupMask = sizeof(T) == 1
+                ? (lfMask >> (g * 8)) & 0xFF
+                : (lfMask >> (g * 4)) & 0xF;
+            UINT8 const* const pShuffle = sizeof(T) == 1
+                ? g_expandShuffle.Bytes[groupMask]
+                : g_expandShuffle.Char16s[groupMask];
+            __m128i const source = _mm_unpacklo_epi64(
+                _mm_loadl_epi64(reinterpret_cast<__m128i const*>(pBlock + g * 8)),
+                cr);
+            __m128i const shuffle = _mm_load_si128(reinterpret_cast<__m128i const*>(pShuffle));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pGroupOutput), _mm_shuffle_epi8(source, shuffle));
+            pGroupOutput += 8 + std::popcount(groupMask) * sizeof(T);
+        }
+
+        o = reinterpret_cast<T*>(pGroupOutput) - pOutput;
+    }
+
+    ExpandCRLFScalar(pInput, cInput, pOutput, i, o);
+}
+
+#endif // TEXTTOOLS_SIMD_X86
+
+size_t
+TextToolsImpl::WidenAscii(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return WidenAsciiAvx2(pInput, cInput, pOutput);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return WidenAsciiSse2(pInput, cInput, pOutput);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return WidenAsciiScalar(pInput, cInput, pOutput);
+}
+
+size_t
+TextToolsImpl::NarrowAscii(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return NarrowAsciiAvx2(pInput, cInput, pOutput);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return NarrowAsciiSse2(pInput, cInput, pOutput);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return NarrowAsciiScalar(pInput, cInput, pOutput);
+}
+
+size_t
+TextToolsImpl::CopyAscii(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return CopyAsciiAvx2(pInput, cInput, pOutput);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return CopyAsciiSse2(pInput, cInput, pOutput);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return CopyAsciiScalar(pInput, cInput, pOutput);
+}
+
+size_t
+TextToolsImpl::SkipValidUtf8(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return SkipValidUtf8Avx2(pInput, cInput);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return SkipValidUtf8Sse2(pInput, cInput);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return SkipValidUtf8Scalar(pInput, cInput);
+}
+
+template<ByteSwap Swap>
+static size_t
+CopyValidUtf16Impl(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return CopyValidUtf16Avx2<Swap>(pInput, cInput, pOutput);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return CopyValidUtf16Sse2<Swap>(pInput, cInput, pOutput);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return CopyValidUtf16Scalar<Swap>(pInput, cInput, pOutput);
+}
+
+size_t
+TextToolsImpl::CopyValidUtf16(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput,
+    ByteSwap swap) noexcept
+{
+    switch (swap)
+    {
+    case ByteSwap::Input:
+        return CopyValidUtf16Impl<ByteSwap::Input>(pInput, cInput, pOutput);
+    case ByteSwap::Output:
+        return CopyValidUtf16Impl<ByteSwap::Output>(pInput, cInput, pOutput);
+    default:
+        return CopyValidUtf16Impl<ByteSwap::None>(pInput, cInput, pOutput);
+    }
+}
+
+template<ByteSwap Swap>
+static size_t
+Utf16ToUtf32BmpImpl(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char32_t* pOutput) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return Utf16ToUtf32BmpAvx2<Swap>(pInput, cInput, pOutput);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return Utf16ToUtf32BmpSse2<Swap>(pInput, cInput, pOutput);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return Utf16ToUtf32BmpScalar<Swap>(pInput, cInput, pOutput);
+}
+
+size_t
+TextToolsImpl::Utf16ToUtf32Bmp(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char32_t* pOutput,
+    ByteSwap swap) noexcept
+{
+    switch (swap)
+    {
+    case ByteSwap::Input:
+        return Utf16ToUtf32BmpImpl<ByteSwap::Input>(pInput, cInput, pOutput);
+    case ByteSwap::Output:
+        return Utf16ToUtf32BmpImpl<ByteSwap::Output>(pInput, cInput, pOutput);
+    default:
+        return Utf16ToUtf32BmpImpl<ByteSwap::None>(pInput, cInput, pOutput);
+    }
+}
+
+template<ByteSwap Swap>
+static size_t
+Utf32ToUtf16BmpImpl(
+    _In_reads_(cInput) char32_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return Utf32ToUtf16BmpAvx2<Swap>(pInput, cInput, pOutput);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return Utf32ToUtf16BmpSse2<Swap>(pInput, cInput, pOutput);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return Utf32ToUtf16BmpScalar<Swap>(pInput, cInput, pOutput);
+}
+
+size_t
+TextToolsImpl::Utf32ToUtf16Bmp(
+    _In_reads_(cInput) char32_t const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) char16_t* pOutput,
+    ByteSwap swap) noexcept
+{
+    switch (swap)
+    {
+    case ByteSwap::Input:
+        return Utf32ToUtf16BmpImpl<ByteSwap::Input>(pInput, cInput, pOutput);
+    case ByteSwap::Output:
+        return Utf32ToUtf16BmpImpl<ByteSwap::Output>(pInput, cInput, pOutput);
+    default:
+        return Utf32ToUtf16BmpImpl<ByteSwap::None>(pInput, cInput, pOutput);
+    }
+}
+
+template<class T>
+static size_t
+FoldCRLFImpl(
+    _Inout_updates_(cData) T* pData,
+    size_t cData,
+    _Inout_ bool* pPrevCR) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return FoldCRLFAvx2(pData, cData, *pPrevCR);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return FoldCRLFSse2(pData, cData, *pPrevCR);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return FoldCRLFScalar(pData, cData, 0, 0, *pPrevCR);
+}
+
+size_t
+TextToolsImpl::FoldCRLF(
+    _Inout_updates_(cData) UINT8* pData,
+    size_t cData,
+    _Inout_ bool* pPrevCR) noexcept
+{
+    return FoldCRLFImpl(pData, cData, pPrevCR);
+}
+
+size_t
+TextToolsImpl::FoldCRLF(
+    _Inout_updates_(cData) char16_t* pData,
+    size_t cData,
+    _Inout_ bool* pPrevCR) noexcept
+{
+    return FoldCRLFImpl(pData, cData, pPrevCR);
+}
+
+template<class T>
+static size_t
+CountLFImpl(
+    _In_reads_(cInput) T const* pInput,
+    size_t cInput) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return CountLFAvx2(pInput, cInput);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return CountLFSse2(pInput, cInput);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return CountLFScalar(pInput, cInput);
+}
+
+size_t
+TextToolsImpl::CountLF(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput) noexcept
+{
+    return CountLFImpl(pInput, cInput);
+}
+
+size_t
+TextToolsImpl::CountLF(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput) noexcept
+{
+    return CountLFImpl(pInput, cInput);
+}
+
+template<class T>
+static void
+ExpandCRLFImpl(
+    _In_reads_(cInput) T const* pInput,
+    size_t cInput,
+    _Out_ T* pOutput) noexcept
+{
+#if TEXTTOOLS_SIMD_X86
+    if (g_simdLevel >= SimdLevel::Avx2)
+    {
+        return ExpandCRLFAvx2(pInput, cInput, pOutput);
+    }
+    else if (g_simdLevel >= SimdLevel::Sse2)
+    {
+        return ExpandCRLFSse2(pInput, cInput, pOutput);
+    }
+#endif // TEXTTOOLS_SIMD_X86
+
+    return ExpandCRLFScalar(pInput, cInput, pOutput, 0, 0);
+}
+
+void
+TextToolsImpl::ExpandCRLF(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_ UINT8* pOutput) noexcept
+{
+    ExpandCRLFImpl(pInput, cInput, pOutput);
+}
+
+void
+TextToolsImpl::ExpandCRLF(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Out_ char16_t* pOutput) noexcept
+{
+    ExpandCRLFImpl(pInput, cInput, pOutput);
+}
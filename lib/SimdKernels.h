@@ -0,0 +1,172 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+#pragma once
+#include "PortableTypes.h"
+
+/*
+Vectorized helper kernels used by the conversion routines. Each kernel picks
+the best implementation for the current processor (AVX2, SSE2, or portable
+scalar) at runtime.
+*/
+namespace TextToolsImpl
+{
+    enum class ByteSwap : UINT8
+    {
+        None,
+        Input,
+        Output
+    };
+
+    enum class SimdLevel : UINT8
+    {
+        Scalar,
+        Sse2, // Baseline for x86 and x64.
+        Avx2,
+    };
+
+    /*
+    For tests: makes the kernels use implementations no higher than maxLevel
+    (and no higher than the processor supports). Returns the level now in
+    use. Not thread-safe: call only while no kernel is running.
+    */
+    SimdLevel
+    LimitSimdLevel(SimdLevel maxLevel) noexcept;
+
+    /*
+    Converts the leading run of ASCII bytes (< 0x80) of pInput to UTF-16.
+    Stops at the first non-ASCII byte. Returns the number of bytes converted
+    (which is also the number of char16s written to pOutput).
+    */
+    size_t
+    WidenAscii(
+        _In_reads_(cInput) UINT8 const* pInput,
+        size_t cInput,
+        _Out_writes_to_(cInput, return) char16_t* pOutput) noexcept;
+
+    /*
+    Converts the leading run of ASCII char16s (< 0x80) of pInput to bytes.
+    Stops at the first non-ASCII char16. Returns the number of char16s
+    converted (which is also the number of bytes written to pOutput).
+    */
+    size_t
+    NarrowAscii(
+        _In_reads_(cInput) char16_t const* pInput,
+        size_t cInput,
+        _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept;
+
+    /*
+    Copies the leading run of ASCII bytes (< 0x80) of pInput to pOutput.
+    Stops at the first non-ASCII byte. Returns the number of bytes copied.
+    */
+    size_t
+    CopyAscii(
+        _In_reads_(cInput) UINT8 const* pInput,
+        size_t cInput,
+        _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept;
+
+    /*
+    Returns the length of a leading run of pInput that is valid UTF-8 and
+    ends on a character boundary. May stop before the end of the valid input
+    (e.g. near the end of input or near an invalid sequence), so callers must
+    check the remainder with a scalar validator. The AVX2 implementation uses
+    the lookup-table algorithm from Keiser and Lemire, "Validating UTF-8 In
+    Less Than One Instruction Per Byte". The other implementations skip ASCII.
+    */
+    size_t
+    SkipValidUtf8(
+        _In_reads_(cInput) UINT8 const* pInput,
+        size_t cInput) noexcept;
+
+    /*
+    Copies the leading run of valid UTF-16 from pInput to pOutput, i.e.
+    non-surrogates and complete surrogate pairs. Stops at the first unmatched
+    surrogate, or before a high surrogate at the end of input. If swap is
+    Input, pInput is byte-swapped (validation uses the swapped value). If swap
+    is Output, pOutput is byte-swapped. Returns the number of char16s copied.
+    */
+    size_t
+    CopyValidUtf16(
+        _In_reads_(cInput) char16_t const* pInput,
+        size_t cInput,
+        _Out_writes_to_(cInput, return) char16_t* pOutput,
+        ByteSwap swap) noexcept;
+
+    /*
+    Converts the leading run of BMP non-surrogate char16s of pInput to UTF-32.
+    Stops at the first surrogate. If swap is Input, pInput is byte-swapped.
+    If swap is Output, pOutput is byte-swapped. Returns the number of char16s
+    converted (which is also the number of char32s written to pOutput).
+    */
+    size_t
+    Utf16ToUtf32Bmp(
+        _In_reads_(cInput) char16_t const* pInput,
+        size_t cInput,
+        _Out_writes_to_(cInput, return) char32_t* pOutput,
+        ByteSwap swap) noexcept;
+
+    /*
+    Converts the leading run of BMP non-surrogate char32s of pInput to UTF-16.
+    Stops at the first value that is a surrogate or above U+FFFF. If swap is
+    Input, pInput is byte-swapped. If swap is Output, pOutput is byte-swapped.
+    Returns the number of char32s converted (which is also the number of
+    char16s written to pOutput).
+    */
+    size_t
+    Utf32ToUtf16Bmp(
+        _In_reads_(cInput) char32_t const* pInput,
+        size_t cInput,
+        _Out_writes_to_(cInput, return) char16_t* pOutput,
+        ByteSwap swap) noexcept;
+
+    /*
+    Folds line endings in place: CRLF becomes LF and a lone CR becomes LF.
+    Returns the new length. *pPrevCR carries state between chunks: on input,
+    true if the previous chunk ended with CR (so a leading LF is dropped); on
+    output, true if this chunk ended with CR. The byte version works for any
+    encoding whose multi-byte sequences never contain 0x0A or 0x0D bytes,
+    e.g. UTF-8.
+    */
+    size_t
+    FoldCRLF(
+        _Inout_updates_(cData) UINT8* pData,
+        size_t cData,
+        _Inout_ bool* pPrevCR) noexcept;
+
+    size_t
+    FoldCRLF(
+        _Inout_updates_(cData) char16_t* pData,
+        size_t cData,
+        _Inout_ bool* pPrevCR) noexcept;
+
+    /*
+    Returns the number of LFs in pInput.
+    */
+    size_t
+    CountLF(
+        _In_reads_(cInput) UINT8 const* pInput,
+        size_t cInput) noexcept;
+
+    size_t
+    CountLF(
+        _In_reads_(cInput) char16_t const* pInput,
+        size_t cInput) noexcept;
+
+    /*
+    Copies pInput to pOutput, inserting CR before each LF. pOutput must have
+    room for cInput + CountLF(pInput, cInput) code units and must not overlap
+    pInput. The byte version works for any encoding whose multi-byte
+    sequences never contain 0x0A bytes, e.g. UTF-8.
+    */
+    void
+    ExpandCRLF(
+        _In_reads_(cInput) UINT8 const* pInput,
+        size_t cInput,
+        _Out_ UINT8* pOutput) noexcept;
+
+    void
+    ExpandCRLF(
+        _In_reads_(cInput) char16_t const* pInput,
+        size_t cInput,
+        _Out_ char16_t* pOutput) noexcept;
+}
@@ -5,6 +5,7 @@
 #include <TextInput.h>
 #include <CodePageInfo.h>
 #include "ByteOrderMark.h"
+#include "SimdKernels.h"
 #include "Utility.h"
 
 #include <stdexcept>
@@ -14,8 +15,56 @@
 using namespace TextToolsImpl;
 
 static constexpr unsigned ReadMax = 0x1fffffff; // Max value to be used in ReadFile or ReadConsole.
-static constexpr unsigned FileBufferSize = 4096;
 static constexpr unsigned ConsoleBufferSize = 2048;
+static constexpr uint64_t MappedMinFileSize = 0x100000; // Smaller files use ReadFile.
+static constexpr size_t MappedViewSize = 0x4000000; // 64 MB per view (or 2 * MappedChunkSize if larger).
+static constexpr size_t MappedPrefetchSize = 0x400000; // Prefetch this far ahead of the pending bytes.
+
+struct TextToolsImpl::TextInputReadAhead
+{
+    PTP_WORK Work = nullptr;
+    TextToolsUniqueHandle Done; // Manual-reset event, set when Callback returns.
+    HANDLE InputHandle = nullptr;
+    std::string Buffer;
+    DWORD CbToRead = 0;
+    DWORD CbRead = 0;
+    DWORD LastError = ERROR_SUCCESS;
+    bool Pending = false;
+
+    static void CALLBACK
+    Callback(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_WORK) noexcept
+    {
+        auto const self = static_cast<TextInputReadAhead*>(context);
+        SetEventWhenCallbackReturns(instance, self->Done.get());
+        self->CbRead = 0;
+        self->LastError = ReadFile(self->InputHandle, self->Buffer.data(), self->CbToRead, &self->CbRead, nullptr)
+            ? ERROR_SUCCESS
+            : GetLastError();
+    }
+};
+
+void
+TextToolsImpl::TextInputReadAhead_delete::operator()(TextInputReadAhead* p) const noexcept
+{
+    if (p->Work)
+    {
+        if (p->Pending)
+        {
+            // A read from a pipe can block until the producer writes again
+            // or closes the pipe, so cancel it instead of waiting. Retry in
+            // case the callback had not yet started the read.
+            while (WaitForSingleObject(p->Done.get(), 10) == WAIT_TIMEOUT)
+            {
+                CancelIoEx(p->InputHandle, nullptr);
+            }
+        }
+
+        WaitForThreadpoolWorkCallbacks(p->Work, FALSE);
+        CloseThreadpoolWork(p->Work);
+    }
+
+    delete p;
+}
 
 constexpr bool
 TextInput::IsFlagSet(TextInputFlags flag) const noexcept
@@ -23,6 +72,18 @@ TextInput::IsFlagSet(TextInputFlags flag) const noexcept
     return (m_flags & flag) != TextInputFlags::None;
 }
 
+constexpr bool
+TextInput::IsViewMode() const noexcept
+{
+    return m_mode == TextInputMode::Mapped || m_mode == TextInputMode::BorrowedBytes;
+}
+
+bool
+TextInput::HasMoreInput() const noexcept
+{
+    return m_inputHandle || m_source;
+}
+
 void
 TextInput::SetCodeConvert(unsigned codePage)
 {
@@ -41,65 +102,39 @@ TextInput::FoldCRLF() noexcept
         return;
     }
 
-    bool const skipNextCharIfNewline = m_skipNextCharIfNewline;
-    m_skipNextCharIfNewline = false;
-
-    auto const pChars = m_chars.data();
-    size_t iInput, iOutput;
-    if (skipNextCharIfNewline && pChars[0] == L'\n')
-    {
-        // Last chunk ended on "\r", which we converted to "\n".
-        // This chunk starts with "\n", so it was a "\r\n" sequence.
-        // We already wrote the corresponding "\n" so skip it.
-        iInput = 1;
-        iOutput = 0;
-    }
-    else
-    {
-        auto const pFirstCR = (char16_t*)wmemchr((WCHAR*)pChars, L'\r', m_charsPos);
-        if (!pFirstCR)
-        {
-            // If there is nothing to skip or convert, we're done.
-            return;
-        }
+    // m_skipNextCharIfNewline: last chunk ended on "\r", which was converted
+    // to "\n". If this chunk starts with "\n", it was a "\r\n" sequence.
+    m_charsPos = TextToolsImpl::FoldCRLF(m_chars.data(), m_charsPos, &m_skipNextCharIfNewline);
+}
 
-        iInput = pFirstCR - pChars;
-        iOutput = iInput;
-    }
+void
+TextInput::FoldCRLFBytes(size_t pos) noexcept
+{
+    assert(pos <= m_bytesPos);
 
-    for (; iInput != m_charsPos; iInput += 1)
+    if (!IsFlagSet(TextInputFlags::FoldCRLF) || pos == m_bytesPos)
     {
-        auto const ch = pChars[iInput];
-        if (ch != L'\r')
-        {
-            pChars[iOutput++] = ch;
-        }
-        else if (iInput + 1 == m_charsPos)
-        {
-            // "\r" at end of chunk. Assume lone "\r" and convert it to "\n".
-            // If next chunk starts with "\n" we will need to skip it.
-            m_skipNextCharIfNewline = true;
-            pChars[iOutput++] = L'\n';
-            break;
-        }
-        else if (pChars[iInput + 1] != L'\n')
-        {
-            // Lone "\r", convert to "\n".
-            pChars[iOutput++] = L'\n';
-        }
-        else
-        {
-            // "\r\n" sequence, ignore the "\r".
-        }
+        return;
     }
 
-    m_charsPos = iOutput;
+    assert(m_codeConvert.CodePage() == CodePageUtf8);
+
+    // UTF-8 never uses bytes < 0x80 in multi-byte sequences, so this can work
+    // directly on the bytes.
+    m_bytesPos = pos + TextToolsImpl::FoldCRLF(
+        reinterpret_cast<UINT8*>(m_bytes.data() + pos), m_bytesPos - pos, &m_skipNextCharIfNewline);
 }
 
 void
 TextInput::ConsumeBytes(size_t consumedBytes) noexcept
 {
-    if (consumedBytes >= m_bytesPos)
+    if (IsViewMode())
+    {
+        // No copy: just advance within the view.
+        assert(consumedBytes <= m_mappedEnd - m_mappedPos);
+        m_mappedPos += consumedBytes;
+    }
+    else if (consumedBytes >= m_bytesPos)
     {
         assert(consumedBytes == m_bytesPos);
         m_bytesPos = 0;
@@ -111,17 +146,33 @@ TextInput::ConsumeBytes(size_t consumedBytes) noexcept
     }
 }
 
+std::string_view
+TextInput::PendingBytes() const noexcept
+{
+    if (m_mode == TextInputMode::Mapped)
+    {
+        return { static_cast<char const*>(m_view.get()) + m_mappedPos, m_mappedEnd - m_mappedPos };
+    }
+    else if (m_mode == TextInputMode::BorrowedBytes)
+    {
+        return m_borrowedBytes.substr(m_mappedPos, m_mappedEnd - m_mappedPos);
+    }
+
+    return { m_bytes.data(), m_bytesPos };
+}
+
 void
 TextInput::Convert()
 {
-    assert(m_mode == TextInputMode::Bytes || m_mode == TextInputMode::File);
+    assert(m_mode == TextInputMode::Bytes || m_mode == TextInputMode::File ||
+        IsViewMode() || m_mode == TextInputMode::Source);
     assert(m_bytesPos <= m_bytes.size());
 
     m_charsPos = 0;
 
     size_t consumedBytes = 0;
     LSTATUS status = m_codeConvert.EncodedToUtf16(
-        std::string_view(m_bytes.data(), m_bytesPos), consumedBytes,
+        PendingBytes(), consumedBytes,
         m_chars, m_charsPos,
         IsFlagSet(TextInputFlags::InvalidMbcsError) ? MB_ERR_INVALID_CHARS : 0);
     ConsumeBytes(consumedBytes);
@@ -144,30 +195,136 @@ TextInput::Convert()
     }
 }
 
+void
+TextInput::GrowReadSize() noexcept
+{
+    // A full read means the source can keep up with larger reads.
+    if (m_readSize < m_options.MaxBufferSize)
+    {
+        m_readSize = m_options.MaxBufferSize / 2 < m_readSize
+            ? m_options.MaxBufferSize
+            : m_readSize * 2;
+    }
+}
+
+void
+TextInput::StartReadAhead()
+{
+    auto& readAhead = *m_readAhead;
+    assert(!readAhead.Pending);
+    assert(m_inputHandle);
+
+    EnsureSize(readAhead.Buffer, m_readSize);
+    readAhead.InputHandle = m_inputHandle;
+    readAhead.CbToRead = m_readSize < ReadMax
+        ? m_readSize
+        : ReadMax;
+    readAhead.Pending = true;
+    ResetEvent(readAhead.Done.get());
+    SubmitThreadpoolWork(readAhead.Work);
+}
+
+void
+TextInput::FinishReadAhead()
+{
+    auto& readAhead = *m_readAhead;
+    if (!readAhead.Pending)
+    {
+        // First read: nothing to overlap with yet.
+        StartReadAhead();
+    }
+
+    WaitForThreadpoolWorkCallbacks(readAhead.Work, FALSE);
+    readAhead.Pending = false;
+
+    if (readAhead.LastError != ERROR_SUCCESS &&
+        readAhead.LastError != ERROR_BROKEN_PIPE &&
+        readAhead.LastError != ERROR_OPERATION_ABORTED)
+    {
+        throw std::runtime_error("ReadFile error " + std::to_string(readAhead.LastError));
+    }
+
+    DWORD const cbRead = readAhead.CbRead;
+    if (cbRead == 0)
+    {
+        m_inputOwner.reset();
+        m_inputHandle = nullptr;
+        return;
+    }
+
+    if (m_bytesPos == 0)
+    {
+        // No carry-over bytes, so the read buffer becomes the input buffer.
+        m_bytes.swap(readAhead.Buffer);
+    }
+    else
+    {
+        // Append after the carry-over bytes (e.g. a split multi-byte sequence).
+        EnsureSize(m_bytes, m_bytesPos, cbRead);
+        memcpy(m_bytes.data() + m_bytesPos, readAhead.Buffer.data(), cbRead);
+    }
+
+    m_bytesPos += cbRead;
+
+    if (cbRead == readAhead.CbToRead)
+    {
+        GrowReadSize();
+    }
+
+    // Read the next chunk while the caller processes this one.
+    StartReadAhead();
+}
+
 void
 TextInput::ReadBytesFromFile()
 {
-    auto const cbRemainingBuffer = m_bytes.size() - m_bytesPos;
-    ReadBytesFromFile(cbRemainingBuffer < ReadMax
-        ? (DWORD)cbRemainingBuffer
-        : ReadMax);
+    if (m_readAhead)
+    {
+        FinishReadAhead();
+        return;
+    }
+
+    EnsureSize(m_bytes, m_bytesPos, m_readSize);
+
+    DWORD const cbMaxToRead = m_readSize < ReadMax
+        ? m_readSize
+        : ReadMax;
+    size_t const oldBytesPos = m_bytesPos;
+    ReadBytesFromFile(cbMaxToRead);
+
+    if (m_bytesPos - oldBytesPos == cbMaxToRead)
+    {
+        GrowReadSize();
+    }
 }
 
 void
 TextInput::ReadBytesFromFile(DWORD cbMaxToRead)
 {
-    assert(m_inputHandle);
+    assert(HasMoreInput());
     assert(m_bytes.size() > m_bytesPos);
     assert(m_bytes.size() - m_bytesPos >= cbMaxToRead);
 
-    DWORD cbRead = 0;
-    if (!ReadFile(m_inputHandle, m_bytes.data() + m_bytesPos, cbMaxToRead, &cbRead, nullptr))
+    size_t cbRead = 0;
+    if (m_source)
     {
-        auto lastError = GetLastError();
-        if (lastError != ERROR_BROKEN_PIPE)
+        cbRead = m_source->Read(m_bytes.data() + m_bytesPos, cbMaxToRead);
+        assert(cbRead <= cbMaxToRead);
+    }
+    else
+    {
+        DWORD cbReadFile = 0;
+        if (!ReadFile(m_inputHandle, m_bytes.data() + m_bytesPos, cbMaxToRead, &cbReadFile, nullptr))
         {
-            throw std::runtime_error("ReadFile error " + std::to_string(lastError));
+            auto lastError = GetLastError();
+            if (lastError != ERROR_BROKEN_PIPE &&
+                lastError != ERROR_OPERATION_ABORTED) // CancelSynchronousIo: treat as end of input.
+            {
+                throw std::runtime_error("ReadFile error " + std::to_string(lastError));
+            }
         }
+
+        cbRead = cbReadFile;
     }
 
     m_bytesPos += cbRead;
@@ -176,6 +333,7 @@ TextInput::ReadBytesFromFile(DWORD cbMaxToRead)
     {
         m_inputOwner.reset();
         m_inputHandle = nullptr;
+        m_source = nullptr;
     }
 }
 
@@ -200,7 +358,12 @@ TextInput::ReadCharsFromConsole()
     if (!ReadConsoleW(m_inputHandle, m_chars.data(), cchMaxToRead, &cchRead, &control))
     {
         auto lastError = GetLastError();
-        throw std::runtime_error("ReadConsoleW error " + std::to_string(lastError));
+        if (lastError != ERROR_OPERATION_ABORTED) // CancelSynchronousIo: treat as end of input.
+        {
+            throw std::runtime_error("ReadConsoleW error " + std::to_string(lastError));
+        }
+
+        cchRead = 0;
     }
 
     m_charsPos = cchRead;
@@ -212,12 +375,285 @@ TextInput::ReadCharsFromConsole()
     }
 }
 
+bool
+TextInput::MapFile() noexcept
+{
+    assert(m_inputHandle);
+    assert(!m_mapping);
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_inputHandle, &fileSize) ||
+        (uint64_t)fileSize.QuadPart < MappedMinFileSize)
+    {
+        return false;
+    }
+
+    m_mapping.reset(CreateFileMappingW(m_inputHandle, nullptr, PAGE_READONLY, 0, 0, nullptr));
+    if (!m_mapping)
+    {
+        return false;
+    }
+
+    m_fileSize = fileSize.QuadPart;
+    if (!MapView(0, 1))
+    {
+        m_mapping.reset();
+        return false;
+    }
+
+    m_mappedEnd = m_mappedPos;
+    return true;
+}
+
+bool
+TextInput::MapView(uint64_t fileOffset, size_t cbMin) noexcept
+{
+    assert(m_mapping);
+    assert(fileOffset < m_fileSize);
+
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+
+    // View offset must be a multiple of the allocation granularity.
+    uint64_t const viewOffset = fileOffset - fileOffset % systemInfo.dwAllocationGranularity;
+    size_t const maxViewSize = m_options.MappedChunkSize > MappedViewSize / 2
+        ? (size_t)m_options.MappedChunkSize * 2
+        : MappedViewSize;
+    size_t viewSize = m_fileSize - viewOffset < maxViewSize
+        ? (size_t)(m_fileSize - viewOffset)
+        : maxViewSize;
+    size_t const minViewSize = (size_t)(fileOffset - viewOffset) + cbMin;
+    assert(minViewSize <= viewSize);
+
+    void* pView;
+    for (;;)
+    {
+        pView = MapViewOfFile(
+            m_mapping.get(),
+            FILE_MAP_READ,
+            (DWORD)(viewOffset >> 32),
+            (DWORD)viewOffset,
+            viewSize);
+        if (pView)
+        {
+            break;
+        }
+        else if (viewSize == minViewSize)
+        {
+            return false;
+        }
+
+        // Address space may be exhausted or fragmented (e.g. 32-bit), so
+        // try a smaller view.
+        viewSize = viewSize / 2 > minViewSize
+            ? viewSize / 2
+            : minViewSize;
+    }
+
+    m_view.reset(pView);
+    m_viewOffset = viewOffset;
+    m_viewSize = viewSize;
+    m_mappedPos = (size_t)(fileOffset - viewOffset);
+    m_prefetchEnd = m_mappedPos;
+    return true;
+}
+
+bool
+TextInput::MapNextBytes()
+{
+    assert(m_mode == TextInputMode::Mapped);
+    assert(m_mappedPos <= m_mappedEnd);
+    assert(m_mappedEnd <= m_viewSize);
+
+    if (m_viewOffset + m_mappedEnd == m_fileSize)
+    {
+        return false;
+    }
+
+    if (m_mappedEnd == m_viewSize)
+    {
+        // Slide the view forward so it starts near the first pending byte.
+        size_t const cbPending = m_mappedEnd - m_mappedPos;
+        if (!MapView(m_viewOffset + m_mappedPos, cbPending + 1))
+        {
+            return UnmapAndReadFile();
+        }
+
+        m_mappedEnd = m_mappedPos + cbPending;
+    }
+
+    m_mappedEnd = m_viewSize - m_mappedEnd > m_options.MappedChunkSize
+        ? m_mappedEnd + m_options.MappedChunkSize
+        : m_viewSize;
+
+    if (m_prefetchEnd < m_viewSize &&
+        m_prefetchEnd < m_mappedEnd + MappedPrefetchSize / 2)
+    {
+        // Hint only: ask the memory manager to start reading ahead using large
+        // I/Os instead of faulting in the pages one at a time.
+        size_t const prefetchEnd = m_viewSize - m_mappedEnd > MappedPrefetchSize
+            ? m_mappedEnd + MappedPrefetchSize
+            : m_viewSize;
+        WIN32_MEMORY_RANGE_ENTRY range = {
+            const_cast<char*>(static_cast<char const*>(m_view.get())) + m_prefetchEnd,
+            prefetchEnd - m_prefetchEnd };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+        m_prefetchEnd = prefetchEnd;
+    }
+
+    return true;
+}
+
+bool
+TextInput::UnmapAndReadFile()
+{
+    assert(m_mode == TextInputMode::Mapped);
+    assert(m_inputHandle);
+
+    // Continue from the end of the pending bytes, which move to m_bytes.
+    LARGE_INTEGER filePos;
+    filePos.QuadPart = m_viewOffset + m_mappedEnd;
+    if (!SetFilePointerEx(m_inputHandle, filePos, nullptr, FILE_BEGIN))
+    {
+        auto lastError = GetLastError();
+        throw std::runtime_error("SetFilePointerEx error " + std::to_string(lastError));
+    }
+
+    auto const pending = PendingBytes();
+    m_readSize = m_options.FileBufferSize < m_options.MaxBufferSize
+        ? m_options.FileBufferSize
+        : m_options.MaxBufferSize;
+    EnsureSize(m_bytes, pending.size(), m_readSize);
+    memcpy(m_bytes.data(), pending.data(), pending.size());
+    m_bytesPos = pending.size();
+
+    m_view.reset();
+    m_mapping.reset();
+    m_fileSize = {};
+    m_viewOffset = {};
+    m_viewSize = {};
+    m_mappedPos = {};
+    m_mappedEnd = {};
+    m_prefetchEnd = {};
+    m_mode = TextInputMode::File;
+
+    size_t const cbPending = m_bytesPos;
+    while (HasMoreInput() && m_bytesPos == cbPending)
+    {
+        ReadBytesFromFile();
+    }
+
+    return m_bytesPos != cbPending;
+}
+
+bool
+TextInput::NextViewBytes()
+{
+    if (m_mode == TextInputMode::Mapped)
+    {
+        return MapNextBytes();
+    }
+
+    assert(m_mode == TextInputMode::BorrowedBytes);
+    assert(m_mappedPos <= m_mappedEnd);
+    assert(m_mappedEnd <= m_borrowedBytes.size());
+
+    if (m_mappedEnd == m_borrowedBytes.size())
+    {
+        return false;
+    }
+
+    m_mappedEnd = m_borrowedBytes.size() - m_mappedEnd > m_options.MappedChunkSize
+        ? m_mappedEnd + m_options.MappedChunkSize
+        : m_borrowedBytes.size();
+    return true;
+}
+
+void
+TextInput::ReadBom()
+{
+    assert(m_mode == TextInputMode::File || m_mode == TextInputMode::Source);
+
+    EnsureSize(m_bytes, m_readSize);
+
+    if (IsFlagSet(TextInputFlags::ConsumeBom))
+    {
+        ReadBytesFromFile(4);
+        for (auto& bomInfo : ByteOrderMark::Standard)
+        {
+            for (;;)
+            {
+                auto match = bomInfo.Match({ m_bytes.data(), m_bytesPos });
+                if (match == ByteOrderMatch::Yes)
+                {
+                    ConsumeBytes(bomInfo.Size);
+                    m_codeConvert = CodeConvert(bomInfo.CodePage);
+                    return;
+                }
+                else if (match == ByteOrderMatch::No)
+                {
+                    break;
+                }
+                else if (!HasMoreInput())
+                {
+                    // NeedMoreData but EOF. Keep checking.  Consider a 2-byte file with
+                    // UTF16 BOM. UTF32 will want more data but we want UTF16 to match.
+                    break;
+                }
+                else
+                {
+                    assert(bomInfo.Size > m_bytesPos);
+                    ReadBytesFromFile(bomInfo.Size - (DWORD)m_bytesPos);
+                }
+            }
+        }
+    }
+}
+
+void
+TextInput::FinishOpen()
+{
+    if ((m_mode != TextInputMode::File && !IsViewMode() && m_mode != TextInputMode::Source) ||
+        (IsFlagSet(TextInputFlags::FoldCRLF) && m_codeConvert.CodePage() != CodePageUtf8))
+    {
+        m_flags &= ~TextInputFlags::RawBytes;
+    }
+
+    if (m_mode == TextInputMode::File && m_inputHandle && IsFlagSet(TextInputFlags::ReadAhead))
+    {
+        std::unique_ptr<TextInputReadAhead, TextInputReadAhead_delete> readAhead(new TextInputReadAhead());
+        readAhead->Done.reset(CreateEventW(nullptr, TRUE, TRUE, nullptr));
+        if (readAhead->Done)
+        {
+            readAhead->Work = CreateThreadpoolWork(TextInputReadAhead::Callback, readAhead.get(), nullptr);
+            if (readAhead->Work)
+            {
+                m_readAhead = std::move(readAhead);
+            }
+        }
+
+        // Else fall back to synchronous reads.
+    }
+
+    if (IsFlagSet(TextInputFlags::RawBytes))
+    {
+        // Fold any bytes read while checking for a BOM.
+        FoldCRLFBytes(0);
+        ReadNextBytes(0);
+    }
+    else
+    {
+        ReadNextChars();
+    }
+}
+
 void
 TextInput::OpenHandle(
     TextToolsUniqueHandle inputOwner,
     _In_ HANDLE inputHandle,
     unsigned codePage,
-    TextInputFlags flags)
+    TextInputFlags flags,
+    bool mapFile)
 {
     auto const fileType = GetFileType(inputHandle);
     if (fileType == FILE_TYPE_UNKNOWN)
@@ -251,52 +687,70 @@ TextInput::OpenHandle(
         }
     }
 
-    EnsureSize(m_bytes, FileBufferSize);
-
-    if (IsFlagSet(TextInputFlags::ConsumeBom))
+    // Folding raw bytes modifies them in place, so it needs m_bytes.
+    if (mapFile && fileType == FILE_TYPE_DISK &&
+        !(IsFlagSet(TextInputFlags::RawBytes) && IsFlagSet(TextInputFlags::FoldCRLF)) &&
+        MapFile())
     {
-        ReadBytesFromFile(4);
-        for (auto& bomInfo : ByteOrderMark::Standard)
+        m_mode = TextInputMode::Mapped;
+
+        if (IsFlagSet(TextInputFlags::ConsumeBom))
         {
-            for (;;)
+            // File is at least MappedMinFileSize, so Match never needs more data.
+            std::string_view const firstBytes(static_cast<char const*>(m_view.get()), 4);
+            for (auto& bomInfo : ByteOrderMark::Standard)
             {
-                auto match = bomInfo.Match({ m_bytes.data(), m_bytesPos });
-                if (match == ByteOrderMatch::Yes)
+                if (bomInfo.Match(firstBytes) == ByteOrderMatch::Yes)
                 {
-                    ConsumeBytes(bomInfo.Size);
+                    m_mappedPos = m_mappedEnd = bomInfo.Size;
                     m_codeConvert = CodeConvert(bomInfo.CodePage);
-                    goto Done;
-                }
-                else if (match == ByteOrderMatch::No)
-                {
                     break;
                 }
-                else if (!m_inputHandle)
-                {
-                    // NeedMoreData but EOF. Don't goto Done.  Consider a 2-byte file with
-                    // UTF16 BOM. UTF32 will want more data but we want UTF16 to match.
-                    break;
-                }
-                else
-                {
-                    assert(bomInfo.Size > m_bytesPos);
-                    ReadBytesFromFile(bomInfo.Size - (DWORD)m_bytesPos);
-                }
             }
         }
+
+        goto Done;
     }
 
+    m_readSize = fileType == FILE_TYPE_DISK
+        ? m_options.FileBufferSize
+        : m_options.PipeBufferSize;
+    if (m_readSize > m_options.MaxBufferSize)
+    {
+        m_readSize = m_options.MaxBufferSize;
+    }
+
+    ReadBom();
+
 Done:
 
-    ReadNextChars();
-    return;
+    FinishOpen();
 }
 
 TextInput::TextInput() noexcept
+    : TextInput(TextInputOptions())
+{
+    return;
+}
+
+TextInput::TextInput(TextInputOptions const& options) noexcept
     : m_bytes()
     , m_chars()
     , m_inputOwner()
     , m_inputHandle()
+    , m_source()
+    , m_options(options)
+    , m_readSize()
+    , m_readAhead()
+    , m_mapping()
+    , m_view()
+    , m_fileSize()
+    , m_viewOffset()
+    , m_viewSize()
+    , m_mappedPos()
+    , m_mappedEnd()
+    , m_prefetchEnd()
+    , m_borrowedBytes()
     , m_codeConvert()
     , m_mode()
     , m_flags()
@@ -307,11 +761,39 @@ TextInput::TextInput() noexcept
     return;
 }
 
+TextInputOptions const&
+TextInput::Options() const noexcept
+{
+    return m_options;
+}
+
+void
+TextInput::SetOptions(TextInputOptions const& options) noexcept
+{
+    assert(options.PipeBufferSize != 0);
+    assert(options.FileBufferSize != 0);
+    assert(options.MaxBufferSize != 0);
+    assert(options.MappedChunkSize != 0);
+    m_options = options;
+}
+
 void
 TextInput::Close() noexcept
 {
+    m_readAhead.reset(); // Cancels and waits for any pending read.
+    m_view.reset();
+    m_mapping.reset();
+    m_fileSize = {};
+    m_viewOffset = {};
+    m_viewSize = {};
+    m_mappedPos = {};
+    m_mappedEnd = {};
+    m_prefetchEnd = {};
+    m_borrowedBytes = {};
     m_inputOwner.reset();
     m_inputHandle = {};
+    m_source = {};
+    m_readSize = {};
     m_codeConvert = {};
     m_mode = {};
     m_flags = {};
@@ -377,6 +859,20 @@ TextInput::OpenBytes(
         }
     }
 
+    if (IsFlagSet(TextInputFlags::FoldCRLF) && m_codeConvert.CodePage() != CodePageUtf8)
+    {
+        m_flags &= ~TextInputFlags::RawBytes;
+    }
+
+    if (IsFlagSet(TextInputFlags::RawBytes))
+    {
+        EnsureSize(m_bytes, inputBytes.size() - consumedBytes);
+        memcpy(m_bytes.data(), inputBytes.data() + consumedBytes, inputBytes.size() - consumedBytes);
+        m_bytesPos = inputBytes.size() - consumedBytes;
+        FoldCRLFBytes(0);
+        return;
+    }
+
     LSTATUS status = m_codeConvert.EncodedToUtf16(
         inputBytes, consumedBytes,
         m_chars, m_charsPos,
@@ -394,13 +890,53 @@ TextInput::OpenBytes(
     }
 }
 
+void
+TextInput::OpenBorrowedBytes(
+    std::string_view inputBytes,
+    unsigned codePage,
+    TextInputFlags flags)
+{
+    // Folding raw bytes modifies them in place, so it needs m_bytes.
+    if ((flags & TextInputFlags::RawBytes) != TextInputFlags::None &&
+        (flags & TextInputFlags::FoldCRLF) != TextInputFlags::None)
+    {
+        OpenBytes(inputBytes, codePage, flags);
+        return;
+    }
+
+    Close();
+
+    // Note: Even if the text ends up having a BOM, we want to validate the codePage parameter.
+    SetCodeConvert(codePage);
+    m_mode = TextInputMode::BorrowedBytes;
+    m_flags = flags;
+    m_borrowedBytes = inputBytes;
+
+    if (IsFlagSet(TextInputFlags::ConsumeBom))
+    {
+        for (auto& bomInfo : ByteOrderMark::Standard)
+        {
+            if (bomInfo.Match(inputBytes) == ByteOrderMatch::Yes)
+            {
+                m_mappedPos = m_mappedEnd = bomInfo.Size;
+                m_codeConvert = CodeConvert(bomInfo.CodePage);
+                break;
+            }
+        }
+    }
+
+    FinishOpen();
+}
+
 void
 TextInput::OpenBorrowedHandle(
     _In_ HANDLE inputHandle,
     unsigned codePage,
     TextInputFlags flags)
 {
-    OpenHandle({}, inputHandle, codePage, flags);
+    // Don't map borrowed handles: the owner might share write access, and
+    // truncating a mapped file would fault instead of returning an error.
+    OpenHandle({}, inputHandle, codePage, flags, false);
 }
 
 LSTATUS
@@ -413,7 +949,7 @@ TextInput::OpenFile(
 
     HANDLE const inputHandle = CreateFileW(
         inputFile,
-        FILE_READ_DATA,
+        GENERIC_READ,
         FILE_SHARE_READ | FILE_SHARE_DELETE,
         nullptr,
         OPEN_EXISTING,
@@ -425,13 +961,41 @@ TextInput::OpenFile(
     }
     else
     {
-        OpenHandle(TextToolsUniqueHandle(inputHandle), inputHandle, codePage, flags);
+        OpenHandle(TextToolsUniqueHandle(inputHandle), inputHandle, codePage, flags, true);
         status = ERROR_SUCCESS;
     }
 
     return status;
 }
 
+void
+TextInput::OpenSource(
+    TextInputSource& source,
+    unsigned codePage,
+    TextInputFlags flags)
+{
+    Close();
+
+    SetCodeConvert(codePage);
+    m_mode = TextInputMode::Source;
+    m_flags = flags;
+    m_source = &source;
+
+    // Sources are treated like pipes: start small and grow as reads fill up.
+    m_readSize = m_options.PipeBufferSize < m_options.MaxBufferSize
+        ? m_options.PipeBufferSize
+        : m_options.MaxBufferSize;
+
+    ReadBom();
+    FinishOpen();
+}
+
+unsigned
+TextInput::CodePage() const noexcept
+{
+    return m_codeConvert.CodePage();
+}
+
 std::u16string_view
 TextInput::Chars() const noexcept
 {
@@ -454,12 +1018,65 @@ TextInput::ReadNextChars()
     }
     else
     {
-        while (m_inputHandle && m_charsPos == 0)
+        // Checks IsViewMode each time: Mapped input can switch to File mode
+        // (see UnmapAndReadFile).
+        while (m_charsPos == 0)
         {
-            ReadBytesFromFile();
+            if (IsViewMode())
+            {
+                if (!NextViewBytes())
+                {
+                    break;
+                }
+            }
+            else if (HasMoreInput())
+            {
+                ReadBytesFromFile();
+            }
+            else
+            {
+                break;
+            }
+
             Convert();
         }
     }
 
     return m_charsPos != 0;
 }
+
+bool
+TextInput::IsRawBytes() const noexcept
+{
+    return IsFlagSet(TextInputFlags::RawBytes) &&
+        (m_mode == TextInputMode::Bytes || m_mode == TextInputMode::File ||
+            IsViewMode() || m_mode == TextInputMode::Source);
+}
+
+std::string_view
+TextInput::Bytes() const noexcept
+{
+    assert(IsRawBytes());
+    return PendingBytes();
+}
+
+bool
+TextInput::ReadNextBytes(size_t cbConsumed)
+{
+    assert(IsRawBytes());
+    ConsumeBytes(cbConsumed);
+
+    if (IsViewMode())
+    {
+        return NextViewBytes();
+    }
+
+    size_t const cbRemaining = m_bytesPos;
+    while (HasMoreInput() && m_bytesPos == cbRemaining)
+    {
+        ReadBytesFromFile();
+        FoldCRLFBytes(cbRemaining);
+    }
+
+    return m_bytesPos != cbRemaining;
+}
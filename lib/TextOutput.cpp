@@ -5,23 +5,167 @@
 #include <TextOutput.h>
 #include <CodePageInfo.h>
 #include "ByteOrderMark.h"
+#include "SimdKernels.h"
 #include "Utility.h"
 
+#include <atomic>
+#include <new>
 #include <stdexcept>
+#include <vector>
 #include <assert.h>
 #include <stdio.h>
 
 using namespace TextToolsImpl;
 
 unsigned constexpr WriteMax = 1u << 20;
+unsigned constexpr FileFlushSize = 16384;
+unsigned constexpr WriteBehindFlushSize = 0x40000; // Larger buffers amortize the hand-off to the writer.
+size_t constexpr ParallelChunkMin = 0x100000;
 char16_t constexpr BomChar = u'\xFEFF';
 
+// Returns ERROR_SUCCESS or the WriteFile error.
+static DWORD
+WriteAllBytes(HANDLE outputHandle, _In_reads_(cbToWrite) char const* pBytes, size_t cbToWrite) noexcept
+{
+    size_t cbWritten = 0;
+    while (cbWritten != cbToWrite)
+    {
+        DWORD cbBatch = cbToWrite - cbWritten > WriteMax
+            ? WriteMax
+            : static_cast<DWORD>(cbToWrite - cbWritten);
+        if (!WriteFile(outputHandle, pBytes + cbWritten, cbBatch, &cbBatch, nullptr))
+        {
+            return GetLastError();
+        }
+
+        assert(cbBatch != 0);
+        cbWritten += cbBatch;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+struct TextToolsImpl::TextOutputWriteBehind
+{
+    PTP_WORK Work = nullptr;
+    HANDLE OutputHandle = nullptr;
+    std::string Buffer;
+    size_t CbToWrite = 0;
+    std::atomic<DWORD> LastError = ERROR_SUCCESS;
+    bool Pending = false;
+
+    static void CALLBACK
+    Callback(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WORK) noexcept
+    {
+        auto const self = static_cast<TextOutputWriteBehind*>(context);
+        auto const lastError = WriteAllBytes(self->OutputHandle, self->Buffer.data(), self->CbToWrite);
+        if (lastError != ERROR_SUCCESS)
+        {
+            self->LastError.store(lastError, std::memory_order_release);
+        }
+    }
+};
+
+void
+TextToolsImpl::TextOutputWriteBehind_delete::operator()(TextOutputWriteBehind* p) const noexcept
+{
+    if (p->Work)
+    {
+        WaitForThreadpoolWorkCallbacks(p->Work, FALSE);
+        CloseThreadpoolWork(p->Work);
+    }
+
+    delete p;
+}
+
+struct TextToolsImpl::TextOutputParallel
+{
+    struct Chunk
+    {
+        std::string_view Input;
+        std::string Output;
+        size_t Consumed;
+        size_t OutputPos;
+        LSTATUS Status;
+        bool UsedDefaultChar;
+    };
+
+    PTP_WORK Work = nullptr;
+    Transcoder const* pTranscoder = nullptr;
+    unsigned Mb2wcFlags = 0;
+    unsigned Wc2mbFlags = 0;
+    PCCH pDefaultChar = nullptr;
+    bool TrackUsedDefaultChar = false;
+    std::vector<Chunk> Chunks;
+    std::atomic<size_t> NextChunk = 0;
+
+    // Submitted once per chunk. Each callback converts the next unclaimed chunk.
+    static void CALLBACK
+    Callback(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WORK) noexcept
+    {
+        auto const self = static_cast<TextOutputParallel*>(context);
+        auto& chunk = self->Chunks[self->NextChunk.fetch_add(1, std::memory_order_relaxed)];
+        chunk.Consumed = 0;
+        chunk.OutputPos = 0;
+        chunk.UsedDefaultChar = false;
+        try
+        {
+            chunk.Status = self->pTranscoder->Transcode(
+                chunk.Input, chunk.Consumed,
+                chunk.Output, chunk.OutputPos,
+                self->Mb2wcFlags,
+                self->Wc2mbFlags,
+                self->pDefaultChar,
+                self->TrackUsedDefaultChar ? &chunk.UsedDefaultChar : nullptr);
+        }
+        catch (std::bad_alloc const&)
+        {
+            chunk.Status = ERROR_NOT_ENOUGH_MEMORY;
+        }
+    }
+};
+
+void
+TextToolsImpl::TextOutputParallel_delete::operator()(TextOutputParallel* p) const noexcept
+{
+    if (p->Work)
+    {
+        WaitForThreadpoolWorkCallbacks(p->Work, FALSE);
+        CloseThreadpoolWork(p->Work);
+    }
+
+    delete p;
+}
+
+static void
+ThrowTranscodeError(LSTATUS status, Transcoder const& transcoder)
+{
+    if (status == ERROR_NO_UNICODE_TRANSLATION)
+    {
+        throw std::range_error("Input is not valid for encoding " +
+            std::to_string(transcoder.From().CodePage()) +
+            ".");
+    }
+    else
+    {
+        throw std::runtime_error("Transcoding error " +
+            std::to_string(status) +
+            ".");
+    }
+}
+
 constexpr bool
 TextOutput::IsFlagSet(TextOutputFlags flag) const noexcept
 {
     return (m_flags & flag) != TextOutputFlags::None;
 }
 
+constexpr bool
+TextOutput::IsFlushMode() const noexcept
+{
+    return m_mode == TextOutputMode::File || m_mode == TextOutputMode::Sink;
+}
+
 void
 TextOutput::SetCodeConvert(unsigned codePage)
 {
@@ -52,25 +196,62 @@ TextOutput::InsertBom()
 void
 TextOutput::FlushFile()
 {
-    assert(m_mode == TextOutputMode::File);
+    assert(IsFlushMode());
 
-    size_t cbWritten = 0;
     size_t const cbToWrite = m_bytesPos;
     m_bytesPos = 0;
 
-    while (cbWritten != cbToWrite)
+    if (m_sink)
     {
-        DWORD cbBatch = cbToWrite - cbWritten > WriteMax
-            ? WriteMax
-            : static_cast<DWORD>(cbToWrite - cbWritten);
-        if (!WriteFile(m_outputHandle, &m_bytes[cbWritten], cbBatch, &cbBatch, nullptr))
+        if (cbToWrite != 0)
+        {
+            m_sink->Write({ m_bytes.data(), cbToWrite });
+        }
+    }
+    else if (m_writeBehind)
+    {
+        // Buffer N+1 can't be handed off until buffer N is written.
+        FinishWriteBehind();
+        if (cbToWrite != 0)
+        {
+            auto& writeBehind = *m_writeBehind;
+            m_bytes.swap(writeBehind.Buffer);
+            writeBehind.CbToWrite = cbToWrite;
+            writeBehind.Pending = true;
+            SubmitThreadpoolWork(writeBehind.Work);
+        }
+    }
+    else
+    {
+        auto const lastError = WriteAllBytes(m_outputHandle, m_bytes.data(), cbToWrite);
+        if (lastError != ERROR_SUCCESS)
         {
-            auto lastError = GetLastError();
             throw std::runtime_error("WriteFile error " + std::to_string(lastError));
         }
+    }
+}
 
-        assert(cbBatch != 0);
-        cbWritten += cbBatch;
+void
+TextOutput::FinishWriteBehind()
+{
+    auto& writeBehind = *m_writeBehind;
+    if (writeBehind.Pending)
+    {
+        WaitForThreadpoolWorkCallbacks(writeBehind.Work, FALSE);
+        writeBehind.Pending = false;
+    }
+
+    ThrowIfWriteBehindFailed();
+}
+
+void
+TextOutput::ThrowIfWriteBehindFailed()
+{
+    // Report each failure once.
+    auto const lastError = m_writeBehind->LastError.exchange(ERROR_SUCCESS, std::memory_order_acquire);
+    if (lastError != ERROR_SUCCESS)
+    {
+        throw std::runtime_error("WriteFile error " + std::to_string(lastError));
     }
 }
 
@@ -187,45 +368,62 @@ TextOutput::ConsumePendingChars(std::u16string_view newChars)
 void
 TextOutput::AppendCharsAndExpandCRLF(std::u16string_view newChars)
 {
-    auto const pchSrc = newChars.data();
-    auto const cchSrc = newChars.size();
-    auto cchDest = m_charsPos;
-    auto cchDestRequired = cchDest + cchSrc < cchDest
-        ? ~(size_t)0 // Force exception from EnsureSize.
-        : cchDest + cchSrc;
+    // Count first so that m_chars is resized at most once.
+    size_t const cLF = TextToolsImpl::CountLF(newChars.data(), newChars.size());
+    size_t const cchAppend = newChars.size() + cLF;
+    EnsureSize(m_chars, m_charsPos, cchAppend);
+    TextToolsImpl::ExpandCRLF(newChars.data(), newChars.size(), m_chars.data() + m_charsPos);
+    m_charsPos += cchAppend;
+}
 
-    EnsureSize(m_chars, cchDestRequired);
-    auto pchDest = m_chars.data();
+void
+TextOutput::AppendChars(std::u16string_view newChars)
+{
+    EnsureSize(m_chars, m_charsPos, newChars.size());
+    memcpy(m_chars.data() + m_charsPos, newChars.data(), newChars.size() * sizeof(char16_t));
+    m_charsPos += newChars.size();
+}
 
-    for (size_t i = 0; i != cchSrc; i++)
+void
+TextOutput::AppendEncodedBytes(std::string& encoded, size_t encodedSize)
+{
+    if (IsFlagSet(TextOutputFlags::ExpandCRLF))
     {
-        auto const ch = pchSrc[i];
-        if (ch != L'\n')
-        {
-            // Tight loop in the non-LF case.
-            pchDest[cchDest++] = ch;
-        }
-        else
-        {
-            // Possible resize needed in the LF case.
-            cchDestRequired += 1;
-            EnsureSize(m_chars, cchDestRequired);
-            pchDest = m_chars.data();
-
-            pchDest[cchDest++] = L'\r';
-            pchDest[cchDest++] = L'\n';
-        }
+        AppendBytesAndExpandCRLF({ encoded.data(), encodedSize });
+    }
+    else if (IsFlushMode())
+    {
+        // Hand the buffer to FlushFile instead of copying it.
+        FlushFile();
+        m_bytes.swap(encoded);
+        m_bytesPos = encodedSize;
+    }
+    else
+    {
+        EnsureSize(m_bytes, m_bytesPos, encodedSize);
+        memcpy(m_bytes.data() + m_bytesPos, encoded.data(), encodedSize);
+        m_bytesPos += encodedSize;
     }
 
-    m_charsPos = cchDest;
+    if (IsFlushMode() && m_bytesPos >= m_flushSize)
+    {
+        FlushFile();
+    }
 }
 
 void
-TextOutput::AppendChars(std::u16string_view newChars)
+TextOutput::AppendBytesAndExpandCRLF(std::string_view newBytes)
 {
-    EnsureSize(m_chars, m_charsPos, newChars.size());
-    memcpy(m_chars.data() + m_charsPos, newChars.data(), newChars.size() * sizeof(char16_t));
-    m_charsPos += newChars.size();
+    assert(m_codeConvert.CodePage() == CodePageUtf8);
+
+    // Count first so that m_bytes is resized at most once.
+    auto const pSrc = reinterpret_cast<UINT8 const*>(newBytes.data());
+    size_t const cLF = TextToolsImpl::CountLF(pSrc, newBytes.size());
+    size_t const cbAppend = newBytes.size() + cLF;
+    EnsureSize(m_bytes, m_bytesPos, cbAppend);
+    TextToolsImpl::ExpandCRLF(pSrc, newBytes.size(),
+        reinterpret_cast<UINT8*>(m_bytes.data() + m_bytesPos));
+    m_bytesPos += cbAppend;
 }
 
 void
@@ -268,6 +466,21 @@ TextOutput::OpenHandle(
         }
     }
 
+    m_flushSize = FileFlushSize;
+    if (IsFlagSet(TextOutputFlags::WriteBehind))
+    {
+        std::unique_ptr<TextOutputWriteBehind, TextOutputWriteBehind_delete> writeBehind(new TextOutputWriteBehind());
+        writeBehind->OutputHandle = m_outputHandle;
+        writeBehind->Work = CreateThreadpoolWork(TextOutputWriteBehind::Callback, writeBehind.get(), nullptr);
+        if (writeBehind->Work)
+        {
+            m_writeBehind = std::move(writeBehind);
+            m_flushSize = WriteBehindFlushSize;
+        }
+
+        // Else fall back to synchronous writes.
+    }
+
     InsertBom();
 
 Done:
@@ -283,8 +496,12 @@ TextOutput::~TextOutput()
 TextOutput::TextOutput() noexcept
     : m_bytes()
     , m_chars()
+    , m_crlfBytes()
     , m_outputOwner()
     , m_outputHandle()
+    , m_sink()
+    , m_writeBehind()
+    , m_parallel()
     , m_codeConvert()
     , m_codeConvertUtf()
     , m_mode()
@@ -292,6 +509,7 @@ TextOutput::TextOutput() noexcept
     , m_wc2mbFlags()
     , m_bytesPos()
     , m_charsPos()
+    , m_flushSize()
 {
     return;
 }
@@ -299,9 +517,13 @@ TextOutput::TextOutput() noexcept
 void
 TextOutput::Flush()
 {
-    if (m_mode == TextOutputMode::File)
+    if (IsFlushMode())
     {
         FlushFile();
+        if (m_writeBehind)
+        {
+            FinishWriteBehind();
+        }
     }
 }
 
@@ -309,8 +531,11 @@ void
 TextOutput::Close() noexcept
 {
     Flush();
+    m_parallel.reset();
+    m_writeBehind.reset();
     m_outputOwner.reset();
     m_outputHandle = {};
+    m_sink = {};
     m_codeConvert = {};
     m_codeConvertUtf = {};
     m_mode = {};
@@ -318,6 +543,7 @@ TextOutput::Close() noexcept
     m_wc2mbFlags = {};
     m_bytesPos = {};
     m_charsPos = {};
+    m_flushSize = {};
 }
 
 TextOutputMode
@@ -392,6 +618,29 @@ TextOutput::OpenFile(
     return status;
 }
 
+void
+TextOutput::OpenSink(
+    TextOutputSink& sink,
+    unsigned codePage,
+    TextOutputFlags flags)
+{
+    Close();
+
+    SetCodeConvert(codePage);
+    m_mode = TextOutputMode::Sink;
+    SetFlags(flags);
+    m_sink = &sink;
+    m_flushSize = FileFlushSize;
+
+    InsertBom();
+}
+
+unsigned
+TextOutput::CodePage() const noexcept
+{
+    return m_codeConvert.CodePage();
+}
+
 std::u16string_view
 TextOutput::BufferedChars() const
 {
@@ -438,8 +687,14 @@ TextOutput::WriteChars(
         break;
 
     case TextOutputMode::File:
+    case TextOutputMode::Sink:
+        if (m_writeBehind)
+        {
+            ThrowIfWriteBehindFailed();
+        }
+
         ConvertAndAppendBytes(ConsumePendingChars(chars), pDefaultChar, pUsedDefaultChar);
-        if (m_bytesPos >= 16384)
+        if (m_bytesPos >= m_flushSize)
         {
             FlushFile();
         }
@@ -448,3 +703,168 @@ TextOutput::WriteChars(
 
     return;
 }
+
+size_t
+TextOutput::WriteBytes(
+    Transcoder const& transcoder,
+    std::string_view bytes,
+    unsigned mb2wcFlags,
+    _In_opt_ PCCH pDefaultChar,
+    _Inout_opt_ bool* pUsedDefaultChar)
+{
+    assert(m_mode == TextOutputMode::Bytes || IsFlushMode());
+    assert(transcoder.To().CodePage() == m_codeConvert.CodePage());
+
+    if (m_writeBehind)
+    {
+        ThrowIfWriteBehindFailed();
+    }
+
+    // With ExpandCRLF, transcode into m_crlfBytes and then expand into m_bytes.
+    bool const expandCRLF = IsFlagSet(TextOutputFlags::ExpandCRLF);
+    size_t bytesPos = 0;
+    size_t crlfBytesPos = 0;
+    LSTATUS status = transcoder.Transcode(
+        bytes, bytesPos,
+        expandCRLF ? m_crlfBytes : m_bytes,
+        expandCRLF ? crlfBytesPos : m_bytesPos,
+        mb2wcFlags,
+        m_wc2mbFlags,
+        m_codeConvertUtf ? nullptr : pDefaultChar,
+        m_codeConvertUtf ? nullptr : pUsedDefaultChar);
+
+    if (expandCRLF)
+    {
+        AppendBytesAndExpandCRLF({ m_crlfBytes.data(), crlfBytesPos });
+    }
+
+    if (status != ERROR_SUCCESS)
+    {
+        ThrowTranscodeError(status, transcoder);
+    }
+
+    if (IsFlushMode() && m_bytesPos >= m_flushSize)
+    {
+        FlushFile();
+    }
+
+    return bytesPos;
+}
+
+size_t
+TextOutput::WriteBytesParallel(
+    Transcoder const& transcoder,
+    std::string_view bytes,
+    unsigned mb2wcFlags,
+    _In_opt_ PCCH pDefaultChar,
+    _Inout_opt_ bool* pUsedDefaultChar)
+{
+    assert(m_mode == TextOutputMode::Bytes || IsFlushMode());
+    assert(transcoder.To().CodePage() == m_codeConvert.CodePage());
+
+    if (bytes.size() < ParallelChunkMin * 2)
+    {
+        return WriteBytes(transcoder, bytes, mb2wcFlags, pDefaultChar, pUsedDefaultChar);
+    }
+
+    if (!m_parallel)
+    {
+        std::unique_ptr<TextOutputParallel, TextOutputParallel_delete> parallel(new TextOutputParallel());
+        parallel->Work = CreateThreadpoolWork(TextOutputParallel::Callback, parallel.get(), nullptr);
+        if (!parallel->Work)
+        {
+            return WriteBytes(transcoder, bytes, mb2wcFlags, pDefaultChar, pUsedDefaultChar);
+        }
+
+        m_parallel = std::move(parallel);
+    }
+
+    if (m_writeBehind)
+    {
+        ThrowIfWriteBehindFailed();
+    }
+
+    // Aim for one chunk per processor.
+    auto& parallel = *m_parallel;
+    size_t const processorCount = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    size_t const chunkSize = bytes.size() / processorCount > ParallelChunkMin
+        ? bytes.size() / processorCount
+        : ParallelChunkMin;
+    auto const from = transcoder.From();
+    size_t chunkCount = 0;
+    for (size_t pos = 0; pos != bytes.size(); chunkCount += 1)
+    {
+        auto const remaining = bytes.substr(pos);
+        size_t chunkLength = remaining.size() > chunkSize + ParallelChunkMin
+            ? from.SplitPosition(remaining, chunkSize)
+            : 0;
+        if (chunkLength == 0)
+        {
+            // Last chunk, or no split point found.
+            chunkLength = remaining.size();
+        }
+
+        if (chunkCount == parallel.Chunks.size())
+        {
+            parallel.Chunks.emplace_back();
+        }
+
+        parallel.Chunks[chunkCount].Input = remaining.substr(0, chunkLength);
+        pos += chunkLength;
+    }
+
+    parallel.pTranscoder = &transcoder;
+    parallel.Mb2wcFlags = mb2wcFlags;
+    parallel.Wc2mbFlags = m_wc2mbFlags;
+    parallel.pDefaultChar = m_codeConvertUtf ? nullptr : pDefaultChar;
+    parallel.TrackUsedDefaultChar = !m_codeConvertUtf && pUsedDefaultChar;
+    parallel.NextChunk.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i != chunkCount; i += 1)
+    {
+        SubmitThreadpoolWork(parallel.Work);
+    }
+
+    WaitForThreadpoolWorkCallbacks(parallel.Work, FALSE);
+
+    // Write the results in order. Only the last chunk should end with an
+    // incomplete character, but stop at the first chunk that does, in case
+    // the transcoder disagrees with SplitPosition.
+    size_t bytesPos = 0;
+    LSTATUS status = ERROR_SUCCESS;
+    for (size_t i = 0; i != chunkCount; i += 1)
+    {
+        auto& chunk = parallel.Chunks[i];
+        AppendEncodedBytes(chunk.Output, chunk.OutputPos);
+        bytesPos += chunk.Consumed;
+
+        if (chunk.UsedDefaultChar)
+        {
+            *pUsedDefaultChar = true;
+        }
+
+        if (chunk.Status != ERROR_SUCCESS)
+        {
+            status = chunk.Status;
+            break;
+        }
+
+        if (chunk.Consumed != chunk.Input.size())
+        {
+            break;
+        }
+    }
+
+    // Each chunk's output can be tens of MB. Free it now instead of holding
+    // it (and the address space) until Close.
+    for (size_t i = 0; i != chunkCount; i += 1)
+    {
+        std::string().swap(parallel.Chunks[i].Output);
+    }
+
+    if (status != ERROR_SUCCESS)
+    {
+        ThrowTranscodeError(status, transcoder);
+    }
+
+    return bytesPos;
+}
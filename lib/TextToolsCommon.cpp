@@ -10,3 +10,9 @@ TextToolsImpl::CloseHandle_delete::operator()(HANDLE h) const noexcept
 {
     verify(CloseHandle(h));
 }
+
+void
+TextToolsImpl::UnmapViewOfFile_delete::operator()(void const* p) const noexcept
+{
+    verify(UnmapViewOfFile(p));
+}
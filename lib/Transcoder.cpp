@@ -0,0 +1,250 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+#include "pch.h"
+#include <Transcoder.h>
+#include <CodePageInfo.h>
+#include "SbcsCodec.h"
+#include "UtfKernels.h"
+#include "Utility.h"
+
+#include <assert.h>
+
+using namespace TextToolsImpl;
+
+// Size of the UTF-16 buffer used by the pivot path.
+static constexpr size_t PivotChars = 2048;
+
+static bool
+IsUtf16(unsigned codePage) noexcept
+{
+    return (codePage | 1u) == CodePageUtf16BE;
+}
+
+static bool
+IsUtf32(unsigned codePage) noexcept
+{
+    return (codePage | 1u) == CodePageUtf32BE;
+}
+
+static bool
+IsUtf(unsigned codePage) noexcept
+{
+    return codePage == CodePageUtf8 || IsUtf16(codePage) || IsUtf32(codePage);
+}
+
+// True for errors other than ERROR_NO_UNICODE_TRANSLATION (which still
+// produces complete output).
+static bool
+IsHardError(LSTATUS status) noexcept
+{
+    return status != ERROR_SUCCESS && status != ERROR_NO_UNICODE_TRANSLATION;
+}
+
+// Limits n so that n * scale does not overflow.
+static size_t
+Scale(size_t n, size_t scale) noexcept
+{
+    size_t const nMax = ~(size_t)0 / scale;
+    return (n < nMax ? n : nMax) * scale;
+}
+
+Transcoder::Transcoder(CodeConvert from, CodeConvert to)
+    : m_from(from)
+    , m_to(to)
+    , m_path(Path::Pivot)
+{
+    auto const fromCodePage = m_from.CodePage();
+    auto const toCodePage = m_to.CodePage();
+    if (fromCodePage == toCodePage)
+    {
+        // Validate and copy.
+        m_path =
+            fromCodePage == CodePageUtf8 ? Path::Utf8ToUtf8
+            : fromCodePage == CodePageUtf16LE ? Path::Utf16ToUtf16
+            : Path::Pivot;
+    }
+    else if (fromCodePage == CodePageUtf8)
+    {
+        m_path =
+            IsUtf16(toCodePage) ? Path::Utf8ToUtf16
+            : IsUtf32(toCodePage) ? Path::Utf8ToUtf32
+            : Path::Pivot;
+    }
+    else if (toCodePage == CodePageUtf8)
+    {
+        m_path =
+            IsUtf16(fromCodePage) ? Path::Utf16ToUtf8
+            : IsUtf32(fromCodePage) ? Path::Utf32ToUtf8
+            : SbcsCodec::Get(fromCodePage) ? Path::SbcsToUtf8
+            : Path::Pivot;
+    }
+}
+
+bool
+Transcoder::IsDirect() const noexcept
+{
+    return m_path != Path::Pivot;
+}
+
+LSTATUS
+Transcoder::TranscodePivot(
+    std::string_view input,
+    size_t& inputPos,
+    std::string& output,
+    size_t& outputPos,
+    unsigned mb2wcFlags,
+    unsigned wc2mbFlags,
+    _In_opt_ PCCH pDefaultChar,
+    _Inout_opt_ bool* pUsedDefaultChar) const
+{
+    LSTATUS status = ERROR_SUCCESS;
+    char16_t pivot[PivotChars];
+
+    while (inputPos != input.size())
+    {
+        auto const decoded = m_from.EncodedToUtf16(input.substr(inputPos), pivot, mb2wcFlags);
+        size_t pivotPos = 0;
+        auto const encodeStatus = m_to.Utf16ToEncoded(
+            std::u16string_view(pivot, decoded.Produced), pivotPos,
+            output, outputPos,
+            wc2mbFlags, pDefaultChar, pUsedDefaultChar);
+
+        if (status == ERROR_SUCCESS)
+        {
+            status = decoded.Status != ERROR_SUCCESS ? decoded.Status : encodeStatus;
+        }
+
+        if (IsHardError(decoded.Status) || IsHardError(encodeStatus))
+        {
+            break;
+        }
+
+        // The encoder leaves a high surrogate at the end unconsumed. Only
+        // UTF-32 input decodes to a lone high surrogate (surrogate values are
+        // passed through), so back off by one char32 per leftover char16.
+        size_t const leftover = decoded.Produced - pivotPos;
+        assert(leftover == 0 || IsUtf32(m_from.CodePage()));
+        size_t const consumed = decoded.Consumed - leftover * sizeof(char32_t);
+        inputPos += consumed;
+        if (consumed == 0)
+        {
+            break;
+        }
+    }
+
+    return status;
+}
+
+LSTATUS
+Transcoder::Transcode(
+    std::string_view input,
+    size_t& inputPos,
+    std::string& output,
+    size_t& outputPos,
+    unsigned mb2wcFlags,
+    unsigned wc2mbFlags,
+    _In_opt_ PCCH pDefaultChar,
+    _Inout_opt_ bool* pUsedDefaultChar) const
+{
+    assert(inputPos <= input.size());
+    assert(outputPos <= output.size());
+    if (input.size() < inputPos ||
+        output.size() < outputPos)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (m_path == Path::Pivot)
+    {
+        return TranscodePivot(input, inputPos, output, outputPos,
+            mb2wcFlags, wc2mbFlags, pDefaultChar, pUsedDefaultChar);
+    }
+
+    if ((pDefaultChar || pUsedDefaultChar) && IsUtf(m_to.CodePage()))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    auto const pInput = reinterpret_cast<UINT8 const*>(input.data() + inputPos);
+    size_t const cbInput = input.size() - inputPos;
+    UtfConvertResult result;
+
+    switch (m_path)
+    {
+    default:
+        assert(false);
+        return ERROR_INVALID_PARAMETER;
+
+    case Path::Utf8ToUtf8:
+        EnsureSize(output, outputPos, Scale(cbInput, 3));
+        result = Utf8ToUtf8(
+            pInput, cbInput, reinterpret_cast<UINT8*>(output.data() + outputPos));
+        break;
+
+    case Path::Utf16ToUtf16:
+        EnsureSize(output, outputPos, cbInput / sizeof(char16_t) * sizeof(char16_t));
+        result = Utf16ToUtf16(
+            reinterpret_cast<char16_t const*>(pInput), cbInput / sizeof(char16_t),
+            reinterpret_cast<char16_t*>(output.data() + outputPos),
+            ByteSwap::None);
+        break;
+
+    case Path::Utf8ToUtf16:
+        EnsureSize(output, outputPos, Scale(cbInput, sizeof(char16_t)));
+        result = Utf8ToUtf16(
+            pInput, cbInput, reinterpret_cast<char16_t*>(output.data() + outputPos),
+            m_to.CodePage() == CodePageUtf16BE ? ByteSwap::Output : ByteSwap::None);
+        break;
+
+    case Path::Utf8ToUtf32:
+        EnsureSize(output, outputPos, Scale(cbInput, sizeof(char32_t)));
+        result = Utf8ToUtf32(
+            pInput, cbInput, reinterpret_cast<char32_t*>(output.data() + outputPos),
+            m_to.CodePage() == CodePageUtf32BE ? ByteSwap::Output : ByteSwap::None);
+        break;
+
+    case Path::Utf16ToUtf8:
+        EnsureSize(output, outputPos, Scale(cbInput / sizeof(char16_t), 3));
+        result = Utf16ToUtf8(
+            reinterpret_cast<char16_t const*>(pInput), cbInput / sizeof(char16_t),
+            reinterpret_cast<UINT8*>(output.data() + outputPos),
+            m_from.CodePage() == CodePageUtf16BE ? ByteSwap::Input : ByteSwap::None);
+        break;
+
+    case Path::Utf32ToUtf8:
+        EnsureSize(output, outputPos, cbInput / sizeof(char32_t) * 4);
+        result = Utf32ToUtf8(
+            reinterpret_cast<char32_t const*>(pInput), cbInput / sizeof(char32_t),
+            reinterpret_cast<UINT8*>(output.data() + outputPos),
+            m_from.CodePage() == CodePageUtf32BE ? ByteSwap::Input : ByteSwap::None);
+        break;
+
+    case Path::SbcsToUtf8:
+        if (mb2wcFlags & ~(MB_PRECOMPOSED | MB_ERR_INVALID_CHARS))
+        {
+            return TranscodePivot(input, inputPos, output, outputPos,
+                mb2wcFlags, wc2mbFlags, pDefaultChar, pUsedDefaultChar);
+        }
+        else
+        {
+            EnsureSize(output, outputPos, Scale(cbInput, 3));
+            auto const pOutput = reinterpret_cast<UINT8*>(output.data() + outputPos);
+            auto const sbcsResult = SbcsCodec::Get(m_from.CodePage())->DecodeToUtf8(pInput, cbInput, pOutput);
+            result = {
+                pInput + cbInput,
+                pOutput + sbcsResult.OutputUsed,
+                sbcsResult.AnyInvalid ? ERROR_NO_UNICODE_TRANSLATION : ERROR_SUCCESS };
+        }
+        break;
+    }
+
+    inputPos += static_cast<UINT8 const*>(result.InputPos) - pInput;
+    outputPos = static_cast<size_t>(static_cast<char const*>(result.OutputPos) - output.data());
+
+    assert(inputPos <= input.size());
+    assert(outputPos <= output.size());
+    return result.UsedReplacement != ERROR_SUCCESS && (mb2wcFlags & MB_ERR_INVALID_CHARS)
+        ? ERROR_NO_UNICODE_TRANSLATION
+        : ERROR_SUCCESS;
+}
@@ -0,0 +1,753 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+// Portable (no pch.h) so that it builds without Windows headers.
+#include "UtfKernels.h"
+
+#include <assert.h>
+
+using namespace TextToolsImpl;
+
+static constexpr char16_t UnicodeReplacement = 0xFFFD;
+
+namespace
+{
+    template<ByteSwap Swap>
+    struct ByteSwapper
+    {
+        static UINT16
+        Input16(UINT16 n) noexcept
+        {
+            if constexpr (Swap == ByteSwap::Input)
+                return _byteswap_ushort(n);
+            else
+                return n;
+        }
+
+        static UINT32
+        Input32(UINT32 n) noexcept
+        {
+            if constexpr (Swap == ByteSwap::Input)
+                return _byteswap_ulong(n);
+            else
+                return n;
+        }
+
+        static UINT16
+        Output16(UINT16 n) noexcept
+        {
+            if constexpr (Swap == ByteSwap::Output)
+                return _byteswap_ushort(n);
+            else
+                return n;
+        }
+
+        static UINT32
+        Output32(UINT32 n) noexcept
+        {
+            if constexpr (Swap == ByteSwap::Output)
+                return _byteswap_ulong(n);
+            else
+                return n;
+        }
+
+        template<class Unit>
+        static Unit
+        Input(Unit n) noexcept
+        {
+            if constexpr (sizeof(Unit) == sizeof(UINT16))
+                return static_cast<Unit>(Input16(n));
+            else
+                return static_cast<Unit>(Input32(n));
+        }
+
+        template<class Unit>
+        static Unit
+        Output(Unit n) noexcept
+        {
+            if constexpr (sizeof(Unit) == sizeof(UINT16))
+                return static_cast<Unit>(Output16(n));
+            else
+                return static_cast<Unit>(Output32(n));
+        }
+    };
+}
+
+// Converts the leading run of ASCII bytes to UTF-16 or UTF-32.
+template<class Unit, ByteSwap Swap>
+static size_t
+WidenAsciiRun(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) Unit* pOutput) noexcept
+{
+    if constexpr (sizeof(Unit) == sizeof(char16_t) && Swap == ByteSwap::None)
+    {
+        return WidenAscii(pInput, cInput, reinterpret_cast<char16_t*>(pOutput));
+    }
+    else
+    {
+        static constexpr ByteSwapper<Swap> swap;
+        size_t i = 0;
+
+        // 8 bytes at a time while all are ASCII.
+        for (; cInput - i >= 8; i += 8)
+        {
+            UINT64 block;
+            memcpy(&block, pInput + i, sizeof(block));
+            if (block & 0x8080808080808080u)
+            {
+                break;
+            }
+
+            for (unsigned j = 0; j != 8; j += 1)
+            {
+                pOutput[i + j] = swap.Output(static_cast<Unit>(pInput[i + j]));
+            }
+        }
+
+        for (; i != cInput && pInput[i] < 0x80; i += 1)
+        {
+            pOutput[i] = swap.Output(static_cast<Unit>(pInput[i]));
+        }
+
+        return i;
+    }
+}
+
+// Converts the leading run of ASCII UTF-16 or UTF-32 units to bytes.
+template<class Unit, ByteSwap Swap>
+static size_t
+NarrowAsciiRun(
+    _In_reads_(cInput) Unit const* pInput,
+    size_t cInput,
+    _Out_writes_to_(cInput, return) UINT8* pOutput) noexcept
+{
+    if constexpr (sizeof(Unit) == sizeof(char16_t) && Swap == ByteSwap::None)
+    {
+        return NarrowAscii(reinterpret_cast<char16_t const*>(pInput), cInput, pOutput);
+    }
+    else
+    {
+        static constexpr ByteSwapper<Swap> swap;
+        size_t i = 0;
+        for (; i != cInput; i += 1)
+        {
+            auto const ch = swap.Input(pInput[i]);
+            if (ch >= 0x80)
+            {
+                break;
+            }
+
+            pOutput[i] = static_cast<UINT8>(ch);
+        }
+
+        return i;
+    }
+}
+
+namespace
+{
+    struct Utf8Sequence
+    {
+        unsigned Length; // 0 if valid so far but incomplete at end of input.
+        bool Valid;
+        char32_t Ch;
+    };
+}
+
+// Decodes the non-ASCII sequence at the start of pInput. If the sequence is
+// invalid, Length is the length of the maximal invalid subsequence (at least 1).
+static Utf8Sequence
+DecodeUtf8Sequence(
+    _In_reads_(cInput) UINT8 const* const pInput,
+    size_t const cInput) noexcept
+{
+    assert(cInput != 0);
+    unsigned const b0 = pInput[0];
+    assert(b0 >= 0x80);
+
+    // Valid range for the first trail byte depends on the lead byte.
+    // This rejects overlong sequences, surrogates, and values above 0x10FFFF.
+    unsigned cTrail;
+    unsigned trail1Min = 0x80;
+    unsigned trail1Max = 0xBF;
+    char32_t ch;
+    if (b0 < 0xC2)
+    {
+        // Unexpected trail byte, or lead byte of an overlong 2-byte sequence.
+        return { 1, false, 0 };
+    }
+    else if (b0 < 0xE0)
+    {
+        cTrail = 1;
+        ch = b0 & 0x1F;
+    }
+    else if (b0 < 0xF0)
+    {
+        cTrail = 2;
+        ch = b0 & 0x0F;
+        trail1Min = b0 == 0xE0 ? 0xA0 : 0x80;
+        trail1Max = b0 == 0xED ? 0x9F : 0xBF;
+    }
+    else if (b0 < 0xF5)
+    {
+        cTrail = 3;
+        ch = b0 & 0x07;
+        trail1Min = b0 == 0xF0 ? 0x90 : 0x80;
+        trail1Max = b0 == 0xF4 ? 0x8F : 0xBF;
+    }
+    else
+    {
+        // Not valid in any position.
+        return { 1, false, 0 };
+    }
+
+    for (unsigned iTrail = 1; iTrail <= cTrail; iTrail += 1)
+    {
+        if (iTrail == cInput)
+        {
+            // Valid so far but incomplete at end of input.
+            return { 0, false, 0 };
+        }
+
+        unsigned const b = pInput[iTrail];
+        if (b < (iTrail == 1 ? trail1Min : 0x80) ||
+            b > (iTrail == 1 ? trail1Max : 0xBF))
+        {
+            // Invalid. Replace the bytes consumed so far (at least the lead byte).
+            return { iTrail, false, 0 };
+        }
+
+        ch = (ch << 6) | (b & 0x3F);
+    }
+
+    return { cTrail + 1, true, ch };
+}
+
+// Validates. Each maximal invalid subsequence is replaced with one U+FFFD.
+// Stops before an incomplete sequence at end of input.
+template<class Unit, ByteSwap Swap>
+static UtfConvertResult
+Utf8ToUtfN(
+    _In_reads_(cInput) UINT8 const* const pInput,
+    size_t const cInput,
+    _Pre_cap_(cInput) Unit* const pOutput) noexcept
+{
+    static constexpr ByteSwapper<Swap> swap;
+    size_t iInput = 0;
+    size_t iOutput = 0;
+    LSTATUS usedReplacement = ERROR_SUCCESS;
+
+    while (iInput != cInput)
+    {
+        if (pInput[iInput] < 0x80)
+        {
+            // Run of ASCII.
+            auto const cAscii = WidenAsciiRun<Unit, Swap>(&pInput[iInput], cInput - iInput, &pOutput[iOutput]);
+            assert(cAscii != 0);
+            iInput += cAscii;
+            iOutput += cAscii;
+            continue;
+        }
+
+        auto const seq = DecodeUtf8Sequence(&pInput[iInput], cInput - iInput);
+        if (seq.Length == 0)
+        {
+            // Don't consume an incomplete sequence.
+            break;
+        }
+
+        iInput += seq.Length;
+        if (!seq.Valid)
+        {
+            pOutput[iOutput++] = swap.Output(static_cast<Unit>(UnicodeReplacement));
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+        }
+        else if (sizeof(Unit) == sizeof(char32_t) || seq.Ch <= 0xFFFF)
+        {
+            pOutput[iOutput++] = swap.Output(static_cast<Unit>(seq.Ch));
+        }
+        else
+        {
+            auto const val = seq.Ch - 0x10000;
+            pOutput[iOutput++] = swap.Output(static_cast<Unit>((val >> 10) + 0xD800));
+            pOutput[iOutput++] = swap.Output(static_cast<Unit>((val & 0x3FF) + 0xDC00));
+        }
+    }
+
+    return { &pInput[iInput], &pOutput[iOutput], usedReplacement };
+}
+
+// Writes ch (<= 0x10FFFF) as UTF-8. Returns the number of bytes written.
+static unsigned
+EncodeUtf8(char32_t ch, _Out_writes_to_(4, return) UINT8* pOutput) noexcept
+{
+    if (ch < 0x80)
+    {
+        pOutput[0] = static_cast<UINT8>(ch);
+        return 1;
+    }
+    else if (ch < 0x800)
+    {
+        pOutput[0] = static_cast<UINT8>(0xC0 | (ch >> 6));
+        pOutput[1] = static_cast<UINT8>(0x80 | (ch & 0x3F));
+        return 2;
+    }
+    else if (ch < 0x10000)
+    {
+        pOutput[0] = static_cast<UINT8>(0xE0 | (ch >> 12));
+        pOutput[1] = static_cast<UINT8>(0x80 | ((ch >> 6) & 0x3F));
+        pOutput[2] = static_cast<UINT8>(0x80 | (ch & 0x3F));
+        return 3;
+    }
+    else
+    {
+        pOutput[0] = static_cast<UINT8>(0xF0 | (ch >> 18));
+        pOutput[1] = static_cast<UINT8>(0x80 | ((ch >> 12) & 0x3F));
+        pOutput[2] = static_cast<UINT8>(0x80 | ((ch >> 6) & 0x3F));
+        pOutput[3] = static_cast<UINT8>(0x80 | (ch & 0x3F));
+        return 4;
+    }
+}
+
+// Validates. Each unmatched surrogate is replaced with U+FFFD.
+// Stops before a high surrogate at end of input.
+template<ByteSwap Swap>
+static UtfConvertResult
+Utf16ToUtf8Impl(
+    _In_reads_(cInput) char16_t const* const pInput,
+    size_t const cInput,
+    _Pre_cap_(cInput * 3) UINT8* const pOutput) noexcept
+{
+    static constexpr ByteSwapper<Swap> swap;
+    size_t iInput = 0;
+    size_t iOutput = 0;
+    LSTATUS usedReplacement = ERROR_SUCCESS;
+
+    while (iInput != cInput)
+    {
+        char32_t ch = swap.Input16(pInput[iInput]);
+        if (ch < 0x80)
+        {
+            // Run of ASCII.
+            auto const cAscii = NarrowAsciiRun<char16_t, Swap>(&pInput[iInput], cInput - iInput, &pOutput[iOutput]);
+            assert(cAscii != 0);
+            iInput += cAscii;
+            iOutput += cAscii;
+            continue;
+        }
+
+        if (ch < 0xD800 || ch >= 0xE000)
+        {
+            // Not a surrogate.
+            iInput += 1;
+        }
+        else if (ch >= 0xDC00)
+        {
+            // Unmatched low surrogate.
+            ch = UnicodeReplacement;
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+            iInput += 1;
+        }
+        else if (iInput + 1 == cInput)
+        {
+            // High surrogate at end of input. Don't consume it.
+            break;
+        }
+        else if (
+            char32_t const ch1 = swap.Input16(pInput[iInput + 1]);
+            ch1 >= 0xDC00 && ch1 < 0xE000)
+        {
+            // Surrogate pair.
+            ch = 0x10000 + (((ch - 0xD800) << 10) | (ch1 - 0xDC00));
+            iInput += 2;
+        }
+        else
+        {
+            // Unmatched high surrogate.
+            ch = UnicodeReplacement;
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+            iInput += 1;
+        }
+
+        iOutput += EncodeUtf8(ch, &pOutput[iOutput]);
+    }
+
+    return { &pInput[iInput], &pOutput[iOutput], usedReplacement };
+}
+
+// Validates. Surrogates and values above 0x10FFFF are replaced with U+FFFD.
+template<ByteSwap Swap>
+static UtfConvertResult
+Utf32ToUtf8Impl(
+    _In_reads_(cInput) char32_t const* const pInput,
+    size_t const cInput,
+    _Pre_cap_(cInput * 4) UINT8* const pOutput) noexcept
+{
+    static constexpr ByteSwapper<Swap> swap;
+    size_t iInput = 0;
+    size_t iOutput = 0;
+    LSTATUS usedReplacement = ERROR_SUCCESS;
+
+    while (iInput != cInput)
+    {
+        char32_t ch = swap.Input32(pInput[iInput]);
+        if (ch < 0x80)
+        {
+            // Run of ASCII.
+            auto const cAscii = NarrowAsciiRun<char32_t, Swap>(&pInput[iInput], cInput - iInput, &pOutput[iOutput]);
+            assert(cAscii != 0);
+            iInput += cAscii;
+            iOutput += cAscii;
+            continue;
+        }
+
+        if ((ch >= 0xD800 && ch < 0xE000) || ch > 0x10FFFF)
+        {
+            ch = UnicodeReplacement;
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+        }
+
+        iOutput += EncodeUtf8(ch, &pOutput[iOutput]);
+        iInput += 1;
+    }
+
+    return { &pInput[iInput], &pOutput[iOutput], usedReplacement };
+}
+
+// Validates. If appropriate, byte-swaps.
+template<ByteSwap Swap>
+static UtfConvertResult
+Utf16ToUtf16Impl(
+    _In_reads_(cInput) char16_t const* const pInput,
+    size_t const cInput,
+    _Pre_cap_(cInput) char16_t* const pOutput) noexcept
+{
+    static constexpr ByteSwapper<Swap> swap;
+    size_t iInput = 0;
+    LSTATUS usedReplacement = ERROR_SUCCESS;
+
+    for (;;)
+    {
+        // Bulk copy of non-surrogates and surrogate pairs.
+        iInput += CopyValidUtf16(&pInput[iInput], cInput - iInput, &pOutput[iInput], Swap);
+        if (iInput == cInput)
+        {
+            break;
+        }
+
+        auto const ch0 = swap.Input16(pInput[iInput]);
+        assert(ch0 >= 0xD800 && ch0 < 0xE000);
+        if (ch0 >= 0xDC00)
+        {
+            // Unmatched low surrogate.
+            pOutput[iInput] = swap.Output16(UnicodeReplacement);
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+            iInput += 1;
+        }
+        else if (iInput + 1 == cInput)
+        {
+            // High surrogate at end of input. Don't consume it.
+            break;
+        }
+        else
+        {
+            // Unmatched high surrogate.
+            pOutput[iInput] = swap.Output16(UnicodeReplacement);
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+            iInput += 1;
+        }
+    }
+
+    return { &pInput[iInput], &pOutput[iInput], usedReplacement };
+}
+
+// Validates. If appropriate, byte-swaps.
+template<ByteSwap Swap>
+static UtfConvertResult
+Utf16ToUtf32Impl(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t const cInput,
+    _Pre_cap_(cInput) char32_t* pOutput) noexcept
+{
+    static constexpr ByteSwapper<Swap> swap;
+    size_t iInput = 0;
+    size_t iOutput = 0;
+    LSTATUS usedReplacement = ERROR_SUCCESS;
+
+    for (;;)
+    {
+        // Bulk conversion of non-surrogates.
+        auto const cBmp = Utf16ToUtf32Bmp(&pInput[iInput], cInput - iInput, &pOutput[iOutput], Swap);
+        iInput += cBmp;
+        iOutput += cBmp;
+        if (iInput == cInput)
+        {
+            break;
+        }
+
+        auto const ch0 = swap.Input16(pInput[iInput]);
+        assert(ch0 >= 0xD800 && ch0 < 0xE000);
+        if (ch0 >= 0xDC00)
+        {
+            // Unmatched low surrogate.
+            pOutput[iOutput++] = swap.Output32(UnicodeReplacement);
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+            iInput += 1;
+        }
+        else if (iInput + 1 == cInput)
+        {
+            // High surrogate at end of input. Don't consume it.
+            break;
+        }
+        else if (
+            auto const ch1 = swap.Input16(pInput[iInput + 1]);
+            ch1 >= 0xDC00 && ch1 < 0xE000)
+        {
+            // Surrogate pair.
+            pOutput[iOutput++] = swap.Output32(0x10000 + (((ch0 - 0xD800) << 10) | (ch1 - 0xDC00)));
+            iInput += 2;
+        }
+        else
+        {
+            // Unmatched high surrogate.
+            pOutput[iOutput++] = swap.Output32(UnicodeReplacement);
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+            iInput += 1;
+        }
+    }
+
+    return { &pInput[iInput], &pOutput[iOutput], usedReplacement };
+}
+
+// Validates. If appropriate, byte-swaps.
+template<ByteSwap Swap>
+static UtfConvertResult
+Utf32ToUtf16Impl(
+    _In_reads_(cInput) char32_t const* pInput,
+    size_t const cInput,
+    _Pre_cap_(cInput * 2) char16_t* pOutput) noexcept
+{
+    static constexpr ByteSwapper<Swap> swap;
+    size_t iInput = 0;
+    size_t iOutput = 0;
+    LSTATUS usedReplacement = ERROR_SUCCESS;
+
+    for (; iInput != cInput; iInput += 1)
+    {
+        // Bulk conversion of BMP non-surrogates.
+        auto const cBmp = Utf32ToUtf16Bmp(&pInput[iInput], cInput - iInput, &pOutput[iOutput], Swap);
+        iInput += cBmp;
+        iOutput += cBmp;
+        if (iInput == cInput)
+        {
+            break;
+        }
+
+        auto const ch = swap.Input32(pInput[iInput]);
+        if (ch <= 0xFFFF)
+        {
+            // Note: Not checking for surrogates, which would be errors if we were more strict.
+            pOutput[iOutput++] = swap.Output16(static_cast<char16_t>(ch));
+        }
+        else if (ch <= 0x10FFFF)
+        {
+            auto val = ch - 0x10000;
+            pOutput[iOutput++] = swap.Output16(static_cast<char16_t>(val >> 10) + 0xD800);
+            pOutput[iOutput++] = swap.Output16(static_cast<char16_t>(val & 0x3FF) + 0xDC00);
+        }
+        else
+        {
+            pOutput[iOutput++] = swap.Output16(UnicodeReplacement);
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+        }
+    }
+
+    return { &pInput[iInput], &pOutput[iOutput], usedReplacement };
+}
+
+size_t
+TextToolsImpl::ValidateUtf8(
+    _In_reads_(cInput) UINT8 const* const pInput,
+    size_t const cInput,
+    _Out_ bool* pInvalid) noexcept
+{
+    size_t iInput = 0;
+    *pInvalid = false;
+
+    for (;;)
+    {
+        // Bulk validation, then finish any sequence it stopped at.
+        iInput += SkipValidUtf8(&pInput[iInput], cInput - iInput);
+        if (iInput == cInput)
+        {
+            break;
+        }
+
+        if (pInput[iInput] < 0x80)
+        {
+            iInput += 1;
+            continue;
+        }
+
+        auto const seq = DecodeUtf8Sequence(&pInput[iInput], cInput - iInput);
+        if (seq.Length == 0)
+        {
+            // Incomplete sequence at end of input.
+            break;
+        }
+        else if (!seq.Valid)
+        {
+            *pInvalid = true;
+            break;
+        }
+
+        iInput += seq.Length;
+    }
+
+    return iInput;
+}
+
+UtfConvertResult
+TextToolsImpl::Utf8ToUtf8(
+    _In_reads_(cInput) UINT8 const* const pInput,
+    size_t const cInput,
+    _Pre_cap_(cInput * 3) UINT8* const pOutput) noexcept
+{
+    size_t iInput = 0;
+    size_t iOutput = 0;
+    LSTATUS usedReplacement = ERROR_SUCCESS;
+
+    while (iInput != cInput)
+    {
+        if (pInput[iInput] < 0x80)
+        {
+            // Run of ASCII.
+            auto const cAscii = CopyAscii(&pInput[iInput], cInput - iInput, &pOutput[iOutput]);
+            assert(cAscii != 0);
+            iInput += cAscii;
+            iOutput += cAscii;
+            continue;
+        }
+
+        auto const seq = DecodeUtf8Sequence(&pInput[iInput], cInput - iInput);
+        if (seq.Length == 0)
+        {
+            // Don't consume an incomplete sequence.
+            break;
+        }
+
+        if (seq.Valid)
+        {
+            memcpy(&pOutput[iOutput], &pInput[iInput], seq.Length);
+            iOutput += seq.Length;
+        }
+        else
+        {
+            iOutput += EncodeUtf8(UnicodeReplacement, &pOutput[iOutput]);
+            usedReplacement = ERROR_NO_UNICODE_TRANSLATION;
+        }
+
+        iInput += seq.Length;
+    }
+
+    return { &pInput[iInput], &pOutput[iOutput], usedReplacement };
+}
+
+UtfConvertResult
+TextToolsImpl::Utf8ToUtf16(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Pre_cap_(cInput) char16_t* pOutput,
+    ByteSwap swap) noexcept
+{
+    assert(swap != ByteSwap::Input);
+    return swap == ByteSwap::Output
+        ? Utf8ToUtfN<char16_t, ByteSwap::Output>(pInput, cInput, pOutput)
+        : Utf8ToUtfN<char16_t, ByteSwap::None>(pInput, cInput, pOutput);
+}
+
+UtfConvertResult
+TextToolsImpl::Utf8ToUtf32(
+    _In_reads_(cInput) UINT8 const* pInput,
+    size_t cInput,
+    _Pre_cap_(cInput) char32_t* pOutput,
+    ByteSwap swap) noexcept
+{
+    assert(swap != ByteSwap::Input);
+    return swap == ByteSwap::Output
+        ? Utf8ToUtfN<char32_t, ByteSwap::Output>(pInput, cInput, pOutput)
+        : Utf8ToUtfN<char32_t, ByteSwap::None>(pInput, cInput, pOutput);
+}
+
+UtfConvertResult
+TextToolsImpl::Utf16ToUtf8(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Pre_cap_(cInput * 3) UINT8* pOutput,
+    ByteSwap swap) noexcept
+{
+    assert(swap != ByteSwap::Output);
+    return swap == ByteSwap::Input
+        ? Utf16ToUtf8Impl<ByteSwap::Input>(pInput, cInput, pOutput)
+        : Utf16ToUtf8Impl<ByteSwap::None>(pInput, cInput, pOutput);
+}
+
+UtfConvertResult
+TextToolsImpl::Utf32ToUtf8(
+    _In_reads_(cInput) char32_t const* pInput,
+    size_t cInput,
+    _Pre_cap_(cInput * 4) UINT8* pOutput,
+    ByteSwap swap) noexcept
+{
+    assert(swap != ByteSwap::Output);
+    return swap == ByteSwap::Input
+        ? Utf32ToUtf8Impl<ByteSwap::Input>(pInput, cInput, pOutput)
+        : Utf32ToUtf8Impl<ByteSwap::None>(pInput, cInput, pOutput);
+}
+
+UtfConvertResult
+TextToolsImpl::Utf16ToUtf16(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Pre_cap_(cInput) char16_t* pOutput,
+    ByteSwap swap) noexcept
+{
+    switch (swap)
+    {
+    case ByteSwap::Input: return Utf16ToUtf16Impl<ByteSwap::Input>(pInput, cInput, pOutput);
+    case ByteSwap::Output: return Utf16ToUtf16Impl<ByteSwap::Output>(pInput, cInput, pOutput);
+    default: return Utf16ToUtf16Impl<ByteSwap::None>(pInput, cInput, pOutput);
+    }
+}
+
+UtfConvertResult
+TextToolsImpl::Utf16ToUtf32(
+    _In_reads_(cInput) char16_t const* pInput,
+    size_t cInput,
+    _Pre_cap_(cInput) char32_t* pOutput,
+    ByteSwap swap) noexcept
+{
+    switch (swap)
+    {
+    case ByteSwap::Input: return Utf16ToUtf32Impl<ByteSwap::Input>(pInput, cInput, pOutput);
+    case ByteSwap::Output: return Utf16ToUtf32Impl<ByteSwap::Output>(pInput, cInput, pOutput);
+    default: return Utf16ToUtf32Impl<ByteSwap::None>(pInput, cInput, pOutput);
+    }
+}
+
+UtfConvertResult
+TextToolsImpl::Utf32ToUtf16(
+    _In_reads_(cInput) char32_t const* pInput,
+    size_t cInput,
+    _Pre_cap_(cInput * 2) char16_t* pOutput,
+    ByteSwap swap) noexcept
+{
+    switch (swap)
+    {
+    case ByteSwap::Input: return Utf32ToUtf16Impl<ByteSwap::Input>(pInput, cInput, pOutput);
+    case ByteSwap::Output: return Utf32ToUtf16Impl<ByteSwap::Output>(pInput, cInput, pOutput);
+    default: return Utf32ToUtf16Impl<ByteSwap::None>(pInput, cInput, pOutput);
+    }
+}
@@ -0,0 +1,118 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+#pragma once
+#include "SimdKernels.h"
+
+/*
+Validating conversions between UTF encodings, shared by CodeConvert and
+Transcoder. Each conversion writes the worst-case output size noted on the
+pOutput parameter, replaces invalid input with U+FFFD, and stops before an
+incomplete sequence (or a high surrogate) at the end of input.
+*/
+namespace TextToolsImpl
+{
+    struct UtfConvertResult
+    {
+        void const* InputPos;
+        void const* OutputPos;
+        LSTATUS UsedReplacement; // ERROR_NO_UNICODE_TRANSLATION if any input was replaced.
+    };
+
+    /*
+    Validates UTF-8 without converting. Returns the length of the leading run
+    of complete, valid sequences. Sets *pInvalid to true if the run is
+    followed by an invalid sequence, or to false if it is followed by the end
+    of input or by an incomplete sequence at the end of input.
+    */
+    size_t
+    ValidateUtf8(
+        _In_reads_(cInput) UINT8 const* pInput,
+        size_t cInput,
+        _Out_ bool* pInvalid) noexcept;
+
+    /*
+    UTF-8 to UTF-8 (validate and copy). Each maximal invalid subsequence is
+    replaced with one U+FFFD.
+    */
+    UtfConvertResult
+    Utf8ToUtf8(
+        _In_reads_(cInput) UINT8 const* pInput,
+        size_t cInput,
+        _Pre_cap_(cInput * 3) UINT8* pOutput) noexcept;
+
+    /*
+    UTF-8 to UTF-16. Each maximal invalid subsequence is replaced with one
+    U+FFFD. swap must be None or Output.
+    */
+    UtfConvertResult
+    Utf8ToUtf16(
+        _In_reads_(cInput) UINT8 const* pInput,
+        size_t cInput,
+        _Pre_cap_(cInput) char16_t* pOutput,
+        ByteSwap swap) noexcept;
+
+    /*
+    UTF-8 to UTF-32. Each maximal invalid subsequence is replaced with one
+    U+FFFD. swap must be None or Output.
+    */
+    UtfConvertResult
+    Utf8ToUtf32(
+        _In_reads_(cInput) UINT8 const* pInput,
+        size_t cInput,
+        _Pre_cap_(cInput) char32_t* pOutput,
+        ByteSwap swap) noexcept;
+
+    /*
+    UTF-16 to UTF-8. Each unmatched surrogate is replaced with U+FFFD.
+    swap must be None or Input.
+    */
+    UtfConvertResult
+    Utf16ToUtf8(
+        _In_reads_(cInput) char16_t const* pInput,
+        size_t cInput,
+        _Pre_cap_(cInput * 3) UINT8* pOutput,
+        ByteSwap swap) noexcept;
+
+    /*
+    UTF-32 to UTF-8. Surrogates and values above U+10FFFF are replaced with
+    U+FFFD. swap must be None or Input.
+    */
+    UtfConvertResult
+    Utf32ToUtf8(
+        _In_reads_(cInput) char32_t const* pInput,
+        size_t cInput,
+        _Pre_cap_(cInput * 4) UINT8* pOutput,
+        ByteSwap swap) noexcept;
+
+    /*
+    UTF-16 to UTF-16. Each unmatched surrogate is replaced with U+FFFD.
+    */
+    UtfConvertResult
+    Utf16ToUtf16(
+        _In_reads_(cInput) char16_t const* pInput,
+        size_t cInput,
+        _Pre_cap_(cInput) char16_t* pOutput,
+        ByteSwap swap) noexcept;
+
+    /*
+    UTF-16 to UTF-32. Each unmatched surrogate is replaced with U+FFFD.
+    */
+    UtfConvertResult
+    Utf16ToUtf32(
+        _In_reads_(cInput) char16_t const* pInput,
+        size_t cInput,
+        _Pre_cap_(cInput) char32_t* pOutput,
+        ByteSwap swap) noexcept;
+
+    /*
+    UTF-32 to UTF-16. Values above U+10FFFF are replaced with U+FFFD.
+    Surrogates are passed through unchanged.
+    */
+    UtfConvertResult
+    Utf32ToUtf16(
+        _In_reads_(cInput) char32_t const* pInput,
+        size_t cInput,
+        _Pre_cap_(cInput * 2) char16_t* pOutput,
+        ByteSwap swap) noexcept;
+}
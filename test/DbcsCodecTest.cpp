@@ -0,0 +1,212 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+// Unit tests for DbcsCodec, using a codec loaded from an excerpt of the
+// unicode.org CP932 (Shift-JIS) mapping table. Builds without Windows headers
+// (see Makefile in this directory).
+
+#include <DbcsCodec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string_view>
+
+using namespace TextToolsImpl;
+
+static unsigned g_failures;
+
+#define CHECK(expression) \
+    ((expression) ? (void)0 : CheckFailed(__FILE__, __LINE__, #expression))
+
+static void
+CheckFailed(char const* file, int line, char const* expression)
+{
+    fprintf(stderr, "%s(%d): CHECK failed: %s\n", file, line, expression);
+    g_failures += 1;
+}
+
+// Lines from CP932.TXT (ASCII is added by LoadCodec). Includes an undefined
+// single byte, and a character with two encodings (U+2252 is 0x81E0 and the
+// NEC duplicate 0x8790; the first one listed is used for encoding).
+static constexpr std::string_view Cp932Excerpt =
+    "#\tName:     cp932 to Unicode table (excerpt)\n"
+    "0x80\t#UNDEFINED\n"
+    "0xA1\t0xFF61\t#HALFWIDTH IDEOGRAPHIC FULL STOP\n"
+    "0xB1\t0xFF71\t#HALFWIDTH KATAKANA LETTER A\n"
+    "0x8140\t0x3000\t#IDEOGRAPHIC SPACE\n"
+    "0x8141\t0x3001\t#IDEOGRAPHIC COMMA\n"
+    "0x8160\t0xFF5E\t#FULLWIDTH TILDE\n"
+    "0x81E0\t0x2252\t#APPROXIMATELY EQUAL TO OR THE IMAGE OF\n"
+    "0x829F\t0x3041\t#HIRAGANA LETTER SMALL A\n"
+    "0x82A0\t0x3042\t#HIRAGANA LETTER A\n"
+    "0x8790\t0x2252\t#APPROXIMATELY EQUAL TO OR THE IMAGE OF\n"
+    "0x889F\t0x4E9C\t#CJK UNIFIED IDEOGRAPH\n"
+    "0x88A0\t0x5516\t#CJK UNIFIED IDEOGRAPH\n"
+    "0xE040\t0x6F3E\t#CJK UNIFIED IDEOGRAPH\n";
+
+static std::unique_ptr<DbcsCodec>
+LoadCodec()
+{
+    std::string mappingText;
+    char line[32];
+    for (unsigned b = 0; b != 0x80; b += 1)
+    {
+        snprintf(line, sizeof(line), "0x%02X\t0x%04X\n", b, b);
+        mappingText += line;
+    }
+
+    mappingText += Cp932Excerpt;
+    return DbcsCodec::FromMappingText(932, mappingText);
+}
+
+static std::u16string
+Decode(DbcsCodec const& codec, std::string_view input, size_t* pInputUsed = nullptr, bool* pAnyInvalid = nullptr)
+{
+    std::u16string output(input.size(), u'\0');
+    auto const result = codec.Decode(reinterpret_cast<UINT8 const*>(input.data()), input.size(), output.data());
+    output.resize(result.OutputUsed);
+    if (pInputUsed) *pInputUsed = result.InputUsed;
+    if (pAnyInvalid) *pAnyInvalid = result.AnyInvalid;
+    return output;
+}
+
+static std::string
+Encode(DbcsCodec const& codec, std::u16string_view input, size_t* pInputUsed = nullptr, bool* pUsedDefaultChar = nullptr)
+{
+    std::string output(input.size() * 2, '\0');
+    auto const result = codec.Encode(input.data(), input.size(),
+        reinterpret_cast<UINT8*>(output.data()), false, codec.DefaultChar());
+    output.resize(result.OutputUsed);
+    if (pInputUsed) *pInputUsed = result.InputUsed;
+    if (pUsedDefaultChar) *pUsedDefaultChar = result.UsedDefaultChar;
+    return output;
+}
+
+static void
+TestRoundTrip(DbcsCodec const& codec)
+{
+    // Long ASCII run for the vector paths, then single-byte katakana and
+    // double-byte characters.
+    std::string const bytes = std::string(40, 'x') +
+        "A\x81\x40\x82\xA0\xA1\x88\x9F" "z\xB1\x81\x60\xE0\x40";
+    std::u16string const chars = std::u16string(40, u'x') +
+        u"A　あ｡亜zｱ～漾";
+
+    size_t inputUsed;
+    bool flag;
+    CHECK(Decode(codec, bytes, &inputUsed, &flag) == chars);
+    CHECK(inputUsed == bytes.size());
+    CHECK(!flag);
+
+    CHECK(Encode(codec, chars, &inputUsed, &flag) == bytes);
+    CHECK(inputUsed == chars.size());
+    CHECK(!flag);
+
+    // Both encodings of U+2252 decode; the first one listed is used to encode.
+    CHECK(Decode(codec, "\x81\xE0\x87\x90") == u"≒≒");
+    CHECK(Encode(codec, u"≒") == "\x81\xE0");
+}
+
+static void
+TestInvalid(DbcsCodec const& codec)
+{
+    size_t inputUsed;
+    bool anyInvalid;
+
+    // Undefined single byte; unmapped pair (both bytes replaced); lead byte
+    // followed by a byte that can't be a trail byte (only the lead replaced).
+    CHECK(Decode(codec, "\x80" "a\x82\x40" "b\x82\x31", &inputUsed, &anyInvalid) == u"?a?b?1");
+    CHECK(inputUsed == 7);
+    CHECK(anyInvalid);
+
+    // Unmapped character; surrogate pair (one default char); high surrogate
+    // at the end is not consumed.
+    CHECK(Encode(codec, u"a一b\U0001F600c\xD800", &inputUsed, &anyInvalid) == "a?b?c");
+    CHECK(inputUsed == 6);
+    CHECK(anyInvalid);
+}
+
+static void
+TestTrailingLeadByte(DbcsCodec const& codec)
+{
+    size_t inputUsed;
+    CHECK(Decode(codec, "ab\x82", &inputUsed) == u"ab");
+    CHECK(inputUsed == 2);
+
+    // 0x82 0x82 would be a (unmapped) pair, so only the last 0x82 is left.
+    CHECK(Decode(codec, "\x82\xA0\x82\x82\x82", &inputUsed) == u"あ?");
+    CHECK(inputUsed == 4);
+}
+
+// Length of the longest prefix that doesn't end with a lone lead byte,
+// found by parsing forward the way Decode does.
+static size_t
+ForwardCompleteLength(DbcsCodec const& codec, std::string_view input)
+{
+    size_t i = 0;
+    while (i != input.size())
+    {
+        auto const b = static_cast<UINT8>(input[i]);
+        if (!codec.LeadBytes().Contains(b))
+        {
+            i += 1;
+        }
+        else if (i + 1 == input.size())
+        {
+            break;
+        }
+        else
+        {
+            i += static_cast<UINT8>(input[i + 1]) < 0x40 ? 1 : 2;
+        }
+    }
+
+    return i;
+}
+
+static void
+TestCompleteLength(DbcsCodec const& codec)
+{
+    // Lead bytes, trail-only bytes, and bytes that are neither, so that runs
+    // of lead bytes of every length (including more than 8) occur.
+    static constexpr UINT8 pool[] = { 0x81, 0x82, 0x88, 0xE0, 0x40, 0xA0, 0x9F, 0x31, 'a' };
+
+    unsigned seed = 1;
+    for (unsigned iter = 0; iter != 2000; iter += 1)
+    {
+        std::string input;
+        seed = seed * 1103515245 + 12345;
+        size_t const length = (seed >> 16) % 40;
+        for (size_t i = 0; i != length; i += 1)
+        {
+            seed = seed * 1103515245 + 12345;
+            auto const leadHeavy = (iter & 1) != 0; // Odd iterations: mostly lead bytes.
+            auto const index = (seed >> 16) % (leadHeavy ? 5 : sizeof(pool));
+            input += static_cast<char>(pool[index]);
+        }
+
+        auto const expected = ForwardCompleteLength(codec, input);
+        CHECK(codec.LeadBytes().CompleteLength(reinterpret_cast<UINT8 const*>(input.data()), input.size()) == expected);
+
+        size_t inputUsed;
+        Decode(codec, input, &inputUsed);
+        CHECK(inputUsed == expected);
+    }
+}
+
+int
+main()
+{
+    auto const codec = LoadCodec();
+    CHECK(codec->LeadBytes().Contains(0x81));
+    CHECK(!codec->LeadBytes().Contains(0xA1));
+
+    TestRoundTrip(*codec);
+    TestInvalid(*codec);
+    TestTrailingLeadByte(*codec);
+    TestCompleteLength(*codec);
+
+    printf("DbcsCodecTest: %u failure(s).\n", g_failures);
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,255 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+// Unit tests for SbcsCodec's built-in tables. Builds without Windows headers
+// (see Makefile in this directory).
+
+#include <SbcsCodec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace TextToolsImpl;
+
+static unsigned g_failures;
+
+#define CHECK(expression) \
+    ((expression) ? (void)0 : CheckFailed(__FILE__, __LINE__, #expression))
+
+static void
+CheckFailed(char const* file, int line, char const* expression)
+{
+    fprintf(stderr, "%s(%d): CHECK failed: %s\n", file, line, expression);
+    g_failures += 1;
+}
+
+static std::u16string
+Decode(SbcsCodec const& codec, std::string_view input, bool* pAnyInvalid = nullptr)
+{
+    std::u16string output(input.size(), u'\0');
+    auto const anyInvalid = codec.Decode(reinterpret_cast<UINT8 const*>(input.data()), input.size(), output.data());
+    if (pAnyInvalid) *pAnyInvalid = anyInvalid;
+    return output;
+}
+
+static std::string
+DecodeToUtf8(SbcsCodec const& codec, std::string_view input, bool* pAnyInvalid = nullptr)
+{
+    // Exactly 3 bytes per input byte (the documented maximum), so that an
+    // overrun is caught by ASan.
+    std::vector<UINT8> output(input.size() * 3);
+    auto const result = codec.DecodeToUtf8(reinterpret_cast<UINT8 const*>(input.data()), input.size(), output.data());
+    if (pAnyInvalid) *pAnyInvalid = result.AnyInvalid;
+    return std::string(output.begin(), output.begin() + result.OutputUsed);
+}
+
+static std::string
+Encode(SbcsCodec const& codec, std::u16string_view input, size_t* pInputUsed = nullptr, bool* pUsedDefaultChar = nullptr)
+{
+    std::vector<UINT8> output(input.size());
+    auto const result = codec.Encode(input.data(), input.size(), output.data(), false, '?');
+    if (pInputUsed) *pInputUsed = result.InputUsed;
+    if (pUsedDefaultChar) *pUsedDefaultChar = result.UsedDefaultChar;
+    return std::string(output.begin(), output.begin() + result.OutputUsed);
+}
+
+// UTF-8 for a BMP character.
+static std::string
+Utf8(char16_t ch)
+{
+    std::string utf8;
+    if (ch < 0x80)
+    {
+        utf8 += static_cast<char>(ch);
+    }
+    else if (ch < 0x800)
+    {
+        utf8 += static_cast<char>(0xC0 | (ch >> 6));
+        utf8 += static_cast<char>(0x80 | (ch & 0x3F));
+    }
+    else
+    {
+        utf8 += static_cast<char>(0xE0 | (ch >> 12));
+        utf8 += static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+        utf8 += static_cast<char>(0x80 | (ch & 0x3F));
+    }
+    return utf8;
+}
+
+static void
+TestTables()
+{
+    // Samples from the unicode.org mapping tables (VENDORS/MICSFT and
+    // ISO8859), plus the bytes that 1252 passes through as C1 controls.
+    static constexpr struct
+    {
+        unsigned CodePage;
+        UINT8 Byte;
+        char16_t Char;
+    } samples[] = {
+        { 1252, 0x80, 0x20AC },
+        { 1252, 0x81, 0x0081 },
+        { 1252, 0x8A, 0x0160 },
+        { 1252, 0x9D, 0x009D },
+        { 1252, 0x9F, 0x0178 },
+        { 1252, 0xE9, 0x00E9 },
+        { 437, 0x80, 0x00C7 },
+        { 437, 0x9E, 0x20A7 },
+        { 437, 0xB0, 0x2591 },
+        { 437, 0xE0, 0x03B1 },
+        { 437, 0xFF, 0x00A0 },
+        { 850, 0x9B, 0x00F8 },
+        { 850, 0x9E, 0x00D7 },
+        { 850, 0xD5, 0x0131 },
+        { 850, 0xF0, 0x00AD },
+        { 28591, 0x80, 0x0080 },
+        { 28591, 0xFF, 0x00FF },
+        { 28592, 0xA1, 0x0104 },
+        { 28592, 0xFF, 0x02D9 },
+        { 28593, 0xA1, 0x0126 },
+        { 28594, 0xA2, 0x0138 },
+        { 28595, 0xB0, 0x0410 },
+        { 28595, 0xF0, 0x2116 },
+        { 28596, 0xC7, 0x0627 },
+        { 28597, 0xC1, 0x0391 },
+        { 28598, 0xE0, 0x05D0 },
+        { 28599, 0xD0, 0x011E },
+        { 28603, 0xA1, 0x201D },
+        { 28605, 0xA4, 0x20AC },
+    };
+
+    for (auto const& sample : samples)
+    {
+        auto const codec = SbcsCodec::Get(sample.CodePage);
+        CHECK(codec != nullptr);
+        if (!codec)
+        {
+            continue;
+        }
+
+        std::string const input(1, static_cast<char>(sample.Byte));
+        bool anyInvalid = true;
+        CHECK(Decode(*codec, input, &anyInvalid) == std::u16string(1, sample.Char));
+        CHECK(!anyInvalid);
+        CHECK(DecodeToUtf8(*codec, input) == Utf8(sample.Char));
+        CHECK(Encode(*codec, std::u16string(1, sample.Char)) == input);
+    }
+
+    // Not a single-byte code page.
+    CHECK(SbcsCodec::Get(932) == nullptr);
+}
+
+static void
+TestUndefined()
+{
+    // ISO 8859-3 leaves 0xA5 undefined: it decodes to U+00A5 but is invalid,
+    // and U+00A5 has no exact mapping.
+    auto const codec = SbcsCodec::Get(28593);
+    CHECK(codec != nullptr);
+    if (!codec)
+    {
+        return;
+    }
+
+    bool anyInvalid = false;
+    CHECK(Decode(*codec, "a\xA5" "b", &anyInvalid) == u"a¥b");
+    CHECK(anyInvalid);
+
+    anyInvalid = false;
+    CHECK(DecodeToUtf8(*codec, "a\xA5" "b", &anyInvalid) == "a\xC2\xA5" "b");
+    CHECK(anyInvalid);
+
+    bool usedDefaultChar = false;
+    CHECK(Encode(*codec, u"¥", nullptr, &usedDefaultChar) == "?");
+    CHECK(usedDefaultChar);
+}
+
+static void
+TestAsciiBoundary()
+{
+    // ASCII runs of every length around the vector widths, each followed by
+    // non-ASCII bytes, so that each vector path hands off to the table lookup
+    // at every position.
+    auto const codec = SbcsCodec::Get(1252);
+    CHECK(codec != nullptr);
+    if (!codec)
+    {
+        return;
+    }
+
+    for (size_t asciiLength = 0; asciiLength != 70; asciiLength += 1)
+    {
+        std::string input;
+        std::u16string expected;
+        std::string expectedUtf8;
+        for (size_t i = 0; i != asciiLength; i += 1)
+        {
+            input += static_cast<char>('a' + i % 26);
+            expected += static_cast<char16_t>('a' + i % 26);
+        }
+
+        input += "\x80\xE9";
+        expected += u"€é";
+        input += std::string(asciiLength / 2, 'z');
+        expected += std::u16string(asciiLength / 2, u'z');
+
+        for (auto const ch : expected)
+        {
+            expectedUtf8 += Utf8(ch);
+        }
+
+        bool anyInvalid = true;
+        CHECK(Decode(*codec, input, &anyInvalid) == expected);
+        CHECK(!anyInvalid);
+        CHECK(DecodeToUtf8(*codec, input) == expectedUtf8);
+
+        size_t inputUsed = 0;
+        CHECK(Encode(*codec, expected, &inputUsed) == input);
+        CHECK(inputUsed == expected.size());
+    }
+}
+
+static void
+TestEncodeDefaultChar()
+{
+    auto const codec = SbcsCodec::Get(1252);
+    CHECK(codec != nullptr);
+    if (!codec)
+    {
+        return;
+    }
+
+    size_t inputUsed = 0;
+    bool usedDefaultChar = true;
+    CHECK(Encode(*codec, u"café €", &inputUsed, &usedDefaultChar) == "caf\xE9 \x80");
+    CHECK(inputUsed == 6);
+    CHECK(!usedDefaultChar);
+
+    // Without best fit, U+0100 has no mapping (best fit would give 'A'). A
+    // surrogate pair becomes one default char, as does an unmatched low
+    // surrogate.
+    CHECK(Encode(*codec, u"aĀb\U0001F600c\xDC00" u"d", &inputUsed, &usedDefaultChar) == "a?b?c?d");
+    CHECK(inputUsed == 8);
+    CHECK(usedDefaultChar);
+
+    // A high surrogate at the end of input is not consumed.
+    usedDefaultChar = true;
+    CHECK(Encode(*codec, u"ab\xD83D", &inputUsed, &usedDefaultChar) == "ab");
+    CHECK(inputUsed == 2);
+    CHECK(!usedDefaultChar);
+}
+
+int
+main()
+{
+    TestTables();
+    TestUndefined();
+    TestAsciiBoundary();
+    TestEncodeDefaultChar();
+
+    printf("SbcsCodecTest: %u failure(s).\n", g_failures);
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
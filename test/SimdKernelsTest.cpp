@@ -0,0 +1,514 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+// Differential tests for the SIMD kernels: each kernel is run at every SIMD
+// level the processor supports (using LimitSimdLevel) and compared with a
+// simple scalar reference. Builds without Windows headers (see Makefile in
+// this directory).
+
+#include <SimdKernels.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+using namespace TextToolsImpl;
+
+static unsigned g_failures;
+static char const* g_levelName = "";
+
+#define CHECK(expression) \
+    ((expression) ? (void)0 : CheckFailed(__FILE__, __LINE__, #expression))
+
+static void
+CheckFailed(char const* file, int line, char const* expression)
+{
+    fprintf(stderr, "%s(%d): CHECK failed [%s]: %s\n", file, line, g_levelName, expression);
+    g_failures += 1;
+}
+
+static unsigned
+Random(unsigned& seed, unsigned limit)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % limit;
+}
+
+// Random code units drawn from pool, which should make the interesting
+// values common.
+template<class T, size_t N>
+static std::vector<T>
+RandomData(unsigned& seed, size_t length, T const (&pool)[N])
+{
+    std::vector<T> data(length);
+    for (auto& value : data)
+    {
+        value = pool[Random(seed, N)];
+    }
+    return data;
+}
+
+// Data length up to 100, so that every tail size after the 16- and 32-unit
+// blocks occurs.
+static constexpr size_t MaxLength = 100;
+
+template<class T>
+static std::vector<T>
+FoldCRLFReference(std::vector<T> const& input)
+{
+    std::vector<T> output;
+    bool prevCR = false;
+    for (auto const ch : input)
+    {
+        if (ch != T('\n') || !prevCR)
+        {
+            output.push_back(ch == T('\r') ? T('\n') : ch);
+        }
+        prevCR = ch == T('\r');
+    }
+    return output;
+}
+
+// Folds input in random chunks, carrying *pPrevCR across them, and checks
+// that the result matches folding it all at once. Each chunk is copied to a
+// buffer of exactly its size so that ASan catches overruns.
+template<class T, size_t N>
+static void
+TestFoldCRLF(T const (&pool)[N])
+{
+    unsigned seed = 1;
+    for (unsigned iter = 0; iter != 3000; iter += 1)
+    {
+        auto const input = RandomData(seed, Random(seed, MaxLength + 1), pool);
+        auto const expected = FoldCRLFReference(input);
+
+        std::vector<T> output;
+        bool prevCR = false;
+        size_t pos = 0;
+        while (pos != input.size())
+        {
+            // Mostly whole-buffer or large chunks, sometimes tiny ones.
+            size_t const remaining = input.size() - pos;
+            size_t const chunkSize = iter % 3 == 0
+                ? remaining
+                : 1 + Random(seed, remaining);
+            std::vector<T> chunk(input.begin() + pos, input.begin() + pos + chunkSize);
+            bool const endsWithCR = chunk.back() == T('\r');
+            auto const cFolded = FoldCRLF(chunk.data(), chunk.size(), &prevCR);
+            CHECK(cFolded <= chunk.size());
+            output.insert(output.end(), chunk.begin(), chunk.begin() + cFolded);
+            CHECK(prevCR == endsWithCR);
+            pos += chunkSize;
+        }
+
+        CHECK(output == expected);
+    }
+
+    // A CR at the end of the previous chunk drops a leading LF.
+    std::vector<T> data = { T('\n'), T('a') };
+    bool prevCR = true;
+    CHECK(FoldCRLF(data.data(), data.size(), &prevCR) == 1);
+    CHECK(data[0] == T('a'));
+    CHECK(!prevCR);
+}
+
+static void
+TestFoldCRLF()
+{
+    static constexpr UINT8 bytePool[] = { '\r', '\n', '\r', '\n', 'a', 'b', 0x80, 0xFF, 0x0E, 0x09 };
+    TestFoldCRLF(bytePool);
+
+    // Includes char16s whose high or low byte is CR or LF.
+    static constexpr char16_t charPool[] = { u'\r', u'\n', u'\r', u'\n', u'a', 0x0D0A, 0x0A0D, 0x0D00, 0x0A00, 0xFFFF };
+    TestFoldCRLF(charPool);
+}
+
+template<class T>
+static std::vector<T>
+ExpandCRLFReference(std::vector<T> const& input)
+{
+    std::vector<T> output;
+    for (auto const ch : input)
+    {
+        if (ch == T('\n'))
+        {
+            output.push_back(T('\r'));
+        }
+        output.push_back(ch);
+    }
+    return output;
+}
+
+// Checks CountLF and ExpandCRLF for input. The output buffer is exactly the
+// size computed from CountLF (as TextOutput sizes it), so that ASan catches
+// a count/expansion mismatch that would overrun it.
+template<class T>
+static void
+CheckExpandCRLF(std::vector<T> const& input)
+{
+    auto const expected = ExpandCRLFReference(input);
+    auto const cLF = CountLF(input.data(), input.size());
+    CHECK(cLF == expected.size() - input.size());
+
+    std::vector<T> output(input.size() + cLF);
+    ExpandCRLF(input.data(), input.size(), output.data());
+    CHECK(output == expected);
+}
+
+template<class T, size_t N>
+static void
+TestExpandCRLF(T const (&pool)[N])
+{
+    unsigned seed = 1;
+    for (size_t length = 0; length <= MaxLength; length += 1)
+    {
+        // Random data, no LFs, all LFs.
+        for (unsigned iter = 0; iter != 20; iter += 1)
+        {
+            CheckExpandCRLF(RandomData(seed, length, pool));
+        }
+
+        CheckExpandCRLF(std::vector<T>(length, T('a')));
+        CheckExpandCRLF(std::vector<T>(length, T('\n')));
+
+        // Runs of LFs ending at, starting at, and straddling each 8-, 16-,
+        // and 32-unit boundary.
+        for (size_t edge = 8; edge < length; edge += 8)
+        {
+            for (size_t runLength = 1; runLength != 4; runLength += 1)
+            {
+                for (size_t start = edge > runLength ? edge - runLength : 0; start <= edge; start += 1)
+                {
+                    std::vector<T> data(length, T('x'));
+                    for (size_t i = start; i != start + runLength && i != length; i += 1)
+                    {
+                        data[i] = T('\n');
+                    }
+
+                    CheckExpandCRLF(data);
+                }
+            }
+        }
+    }
+}
+
+static void
+TestExpandCRLF()
+{
+    static constexpr UINT8 bytePool[] = { '\n', '\n', '\r', 'a', 'b', 0x80, 0xFF, 0x0A + 0x80 };
+    TestExpandCRLF(bytePool);
+
+    // Includes char16s whose high or low byte is LF.
+    static constexpr char16_t charPool[] = { u'\n', u'\n', u'\r', u'a', 0x0A0A, 0x0A00, 0x010A, 0xFFFF };
+    TestExpandCRLF(charPool);
+}
+
+static constexpr ByteSwap SwapModes[] = { ByteSwap::None, ByteSwap::Input, ByteSwap::Output };
+
+static char16_t
+Swap16(char16_t ch)
+{
+    return static_cast<char16_t>((ch << 8) | (ch >> 8));
+}
+
+static std::vector<char16_t>
+Swap16(std::vector<char16_t> values)
+{
+    for (auto& value : values)
+    {
+        value = Swap16(value);
+    }
+    return values;
+}
+
+// Length of the leading run of valid UTF-16 (not counting a high surrogate
+// at the end).
+static size_t
+ValidUtf16Reference(std::vector<char16_t> const& input)
+{
+    size_t i = 0;
+    while (i != input.size())
+    {
+        auto const ch = input[i];
+        if (ch < 0xD800 || ch >= 0xE000)
+        {
+            i += 1;
+        }
+        else if (ch < 0xDC00 && i + 1 != input.size() && input[i + 1] >= 0xDC00 && input[i + 1] < 0xE000)
+        {
+            i += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+// Checks CopyValidUtf16 on native (i.e. not byte-swapped) data in each
+// ByteSwap mode, expecting it to copy expectedCount char16s.
+static void
+CheckCopyValidUtf16(std::vector<char16_t> const& native, size_t expectedCount)
+{
+    CHECK(ValidUtf16Reference(native) == expectedCount);
+    for (auto const swap : SwapModes)
+    {
+        auto const input = swap == ByteSwap::Input ? Swap16(native) : native;
+        auto expected = swap == ByteSwap::Output ? Swap16(native) : native;
+        expected.resize(expectedCount);
+
+        std::vector<char16_t> output(input.size());
+        auto const count = CopyValidUtf16(input.data(), input.size(), output.data(), swap);
+        CHECK(count == expectedCount);
+        output.resize(count);
+        CHECK(output == expected);
+    }
+}
+
+static void
+TestCopyValidUtf16()
+{
+    static constexpr char16_t high = 0xD83D;
+    static constexpr char16_t low = 0xDE00;
+
+    for (size_t length = 1; length <= MaxLength; length += 1)
+    {
+        // High surrogate at the end of input is left for the next chunk.
+        std::vector<char16_t> data(length, u'a');
+        data.back() = high;
+        CheckCopyValidUtf16(data, length - 1);
+
+        // Unmatched low surrogate at the end.
+        data.back() = low;
+        CheckCopyValidUtf16(data, length - 1);
+
+        // Pair at the end.
+        if (length >= 2)
+        {
+            data[length - 2] = high;
+            CheckCopyValidUtf16(data, length);
+        }
+    }
+
+    // Around each 16- and 32-char16 block boundary.
+    for (size_t boundary = 16; boundary <= 64; boundary += 16)
+    {
+        for (size_t tail = 0; tail != 40; tail += 1)
+        {
+            // Pair split across the boundary.
+            std::vector<char16_t> data(boundary + 1 + tail, u'a');
+            data[boundary - 1] = high;
+            data[boundary] = low;
+            CheckCopyValidUtf16(data, data.size());
+
+            // Unmatched high surrogate in a block's last lane.
+            data[boundary] = u'b';
+            CheckCopyValidUtf16(data, boundary - 1);
+
+            // Unmatched low surrogate in a block's first lane.
+            data[boundary - 1] = u'b';
+            data[boundary] = low;
+            CheckCopyValidUtf16(data, boundary);
+
+            // Pair ending in a block's last lane, then an unmatched high
+            // surrogate in the next block's first lane.
+            data[boundary - 2] = high;
+            data[boundary - 1] = low;
+            data[boundary] = high;
+            CheckCopyValidUtf16(data, boundary);
+        }
+    }
+
+    // Random surrogate-heavy data.
+    static constexpr char16_t pool[] = { u'a', 0xD7FF, 0xD800, 0xDBFF, 0xDC00, 0xDFFF, 0xE000, 0xFFFF, 0x00D8, 0x00DC };
+    unsigned seed = 1;
+    for (unsigned iter = 0; iter != 3000; iter += 1)
+    {
+        auto data = RandomData(seed, Random(seed, MaxLength + 1), pool);
+
+        // Mostly valid: turn most high surrogates into pairs.
+        for (size_t i = 0; i + 1 < data.size(); i += 1)
+        {
+            if (data[i] >= 0xD800 && data[i] < 0xDC00 && Random(seed, 8) != 0)
+            {
+                data[i + 1] = low;
+                i += 1;
+            }
+            else if (data[i] >= 0xDC00 && data[i] < 0xE000 && Random(seed, 8) != 0)
+            {
+                data[i] = u'a';
+            }
+        }
+
+        CheckCopyValidUtf16(data, ValidUtf16Reference(data));
+    }
+}
+
+static char32_t
+Swap32(char32_t ch)
+{
+    return (ch << 24) | ((ch & 0xFF00) << 8) | ((ch >> 8) & 0xFF00) | (ch >> 24);
+}
+
+static std::vector<char32_t>
+Swap32(std::vector<char32_t> values)
+{
+    for (auto& value : values)
+    {
+        value = Swap32(value);
+    }
+    return values;
+}
+
+// Checks Utf16ToUtf32Bmp on native data in each ByteSwap mode, expecting it
+// to convert expectedCount char16s.
+static void
+CheckUtf16ToUtf32Bmp(std::vector<char16_t> const& native, size_t expectedCount)
+{
+    std::vector<char32_t> const expectedNative(native.begin(), native.begin() + expectedCount);
+    for (auto const swap : SwapModes)
+    {
+        auto const input = swap == ByteSwap::Input ? Swap16(native) : native;
+        auto const expected = swap == ByteSwap::Output ? Swap32(expectedNative) : expectedNative;
+
+        std::vector<char32_t> output(input.size());
+        auto const count = Utf16ToUtf32Bmp(input.data(), input.size(), output.data(), swap);
+        CHECK(count == expectedCount);
+        output.resize(count);
+        CHECK(output == expected);
+    }
+}
+
+// Checks Utf32ToUtf16Bmp on native data in each ByteSwap mode, expecting it
+// to convert expectedCount char32s.
+static void
+CheckUtf32ToUtf16Bmp(std::vector<char32_t> const& native, size_t expectedCount)
+{
+    std::vector<char16_t> expectedNative;
+    for (size_t i = 0; i != expectedCount; i += 1)
+    {
+        expectedNative.push_back(static_cast<char16_t>(native[i]));
+    }
+
+    for (auto const swap : SwapModes)
+    {
+        auto const input = swap == ByteSwap::Input ? Swap32(native) : native;
+        auto const expected = swap == ByteSwap::Output ? Swap16(expectedNative) : expectedNative;
+
+        std::vector<char16_t> output(input.size());
+        auto const count = Utf32ToUtf16Bmp(input.data(), input.size(), output.data(), swap);
+        CHECK(count == expectedCount);
+        output.resize(count);
+        CHECK(output == expected);
+    }
+}
+
+static void
+TestUtf16Utf32Bmp()
+{
+    // BMP non-surrogates near the edges of the signed 16-bit range (which the
+    // SSE2 narrowing biases into) and of the surrogate range.
+    static constexpr char16_t valid[] = { 0x0000, 0x007F, 0x7FFF, 0x8000, 0xD7FF, 0xE000, 0xFFFE, 0xFFFF };
+    static constexpr char16_t surrogates[] = { 0xD800, 0xDBFF, 0xDC00, 0xDFFF };
+    static constexpr char32_t invalid32[] = {
+        0xD800, 0xDBFF, 0xDC00, 0xDFFF, // Surrogates.
+        0x10000, 0x1D800, 0x18000, 0x10FFFF, 0x110000, // Above U+FFFF.
+        0x7FFF8000, 0x7FFFFFFF, 0x80000000, 0x80008000, 0xFFFF0000, 0xFFFFD800, 0xFFFFFFFF, // Above 0x7FFFFFFF.
+    };
+
+    unsigned seed = 1;
+    for (size_t length = 0; length <= MaxLength; length += 1)
+    {
+        // All valid: checks the converted values.
+        for (unsigned iter = 0; iter != 10; iter += 1)
+        {
+            auto const data16 = RandomData(seed, length, valid);
+            CheckUtf16ToUtf32Bmp(data16, length);
+            CheckUtf32ToUtf16Bmp(std::vector<char32_t>(data16.begin(), data16.end()), length);
+        }
+
+        if (length == 0)
+        {
+            continue;
+        }
+
+        // One stop value: last, then at random positions.
+        for (unsigned iter = 0; iter != 10; iter += 1)
+        {
+            auto const position = iter == 0 ? length - 1 : Random(seed, static_cast<unsigned>(length));
+
+            auto data16 = RandomData(seed, length, valid);
+            std::vector<char32_t> data32(data16.begin(), data16.end());
+
+            data16[position] = surrogates[Random(seed, sizeof(surrogates) / sizeof(surrogates[0]))];
+            CheckUtf16ToUtf32Bmp(data16, position);
+
+            data32[position] = invalid32[Random(seed, sizeof(invalid32) / sizeof(invalid32[0]))];
+            CheckUtf32ToUtf16Bmp(data32, position);
+        }
+    }
+
+    // Each stop value in each lane of the first 16-unit block.
+    for (auto const value : surrogates)
+    {
+        for (size_t position = 0; position != 16; position += 1)
+        {
+            std::vector<char16_t> data(20, u'a');
+            data[position] = value;
+            CheckUtf16ToUtf32Bmp(data, position);
+        }
+    }
+
+    for (auto const value : invalid32)
+    {
+        for (size_t position = 0; position != 16; position += 1)
+        {
+            std::vector<char32_t> data(20, U'a');
+            data[position] = value;
+            CheckUtf32ToUtf16Bmp(data, position);
+        }
+    }
+}
+
+static void
+RunAtEachLevel(void (*test)())
+{
+    static constexpr struct
+    {
+        SimdLevel Level;
+        char const* Name;
+    } levels[] = {
+        { SimdLevel::Scalar, "scalar" },
+        { SimdLevel::Sse2, "sse2" },
+        { SimdLevel::Avx2, "avx2" },
+    };
+
+    for (auto const& level : levels)
+    {
+        if (LimitSimdLevel(level.Level) == level.Level)
+        {
+            g_levelName = level.Name;
+            test();
+        }
+    }
+
+    LimitSimdLevel(SimdLevel::Avx2);
+    g_levelName = "";
+}
+
+int
+main()
+{
+    RunAtEachLevel(TestFoldCRLF);
+    RunAtEachLevel(TestExpandCRLF);
+    RunAtEachLevel(TestCopyValidUtf16);
+    RunAtEachLevel(TestUtf16Utf32Bmp);
+
+    printf("SimdKernelsTest: %u failure(s) (highest SIMD level: %s).\n", g_failures,
+        LimitSimdLevel(SimdLevel::Avx2) == SimdLevel::Avx2 ? "avx2"
+        : LimitSimdLevel(SimdLevel::Avx2) == SimdLevel::Sse2 ? "sse2"
+        : "scalar");
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,199 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+// Unit tests for the UTF kernels. Builds without Windows headers (see
+// Makefile in this directory).
+
+#include <UtfKernels.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string_view>
+
+using namespace TextToolsImpl;
+
+static unsigned g_failures;
+
+#define CHECK(expression) \
+    ((expression) ? (void)0 : CheckFailed(__FILE__, __LINE__, #expression))
+
+static void
+CheckFailed(char const* file, int line, char const* expression)
+{
+    fprintf(stderr, "%s(%d): CHECK failed: %s\n", file, line, expression);
+    g_failures += 1;
+}
+
+struct Utf16Result
+{
+    std::u16string Output;
+    size_t Consumed;
+    bool UsedReplacement;
+};
+
+static Utf16Result
+Utf8ToUtf16(std::string_view input)
+{
+    auto const pInput = reinterpret_cast<UINT8 const*>(input.data());
+    std::u16string output(input.size(), u'\0');
+    auto const result = TextToolsImpl::Utf8ToUtf16(pInput, input.size(), output.data(), ByteSwap::None);
+    output.resize(static_cast<char16_t const*>(result.OutputPos) - output.data());
+    return {
+        output,
+        static_cast<size_t>(static_cast<UINT8 const*>(result.InputPos) - pInput),
+        result.UsedReplacement != ERROR_SUCCESS };
+}
+
+static void
+TestValid()
+{
+    // ASCII (long enough for the vector paths), 2-, 3-, and 4-byte sequences.
+    std::string input(100, 'a');
+    input += "\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80z";
+    auto const result = Utf8ToUtf16(input);
+    CHECK(result.Consumed == input.size());
+    CHECK(!result.UsedReplacement);
+    CHECK(result.Output == std::u16string(100, u'a') + u"é€\U0001F600z");
+
+    bool invalid = true;
+    CHECK(ValidateUtf8(reinterpret_cast<UINT8 const*>(input.data()), input.size(), &invalid) == input.size());
+    CHECK(!invalid);
+}
+
+static void
+TestOverlongAndSurrogate()
+{
+    // Overlong encodings of '/' and of U+0000, a surrogate (U+D800), and a
+    // value above U+10FFFF. Each byte is its own maximal subpart.
+    static char const* const inputs[] = {
+        "\xC0\xAF",
+        "\xE0\x80\xAF",
+        "\xF0\x80\x80\xAF",
+        "\xC1\x80",
+        "\xED\xA0\x80",
+        "\xF4\x90\x80\x80",
+    };
+
+    for (std::string_view const input : inputs)
+    {
+        auto const result = Utf8ToUtf16(input);
+        CHECK(result.Consumed == input.size());
+        CHECK(result.UsedReplacement);
+        CHECK(result.Output == std::u16string(input.size(), u'\xFFFD'));
+
+        bool invalid = false;
+        CHECK(ValidateUtf8(reinterpret_cast<UINT8 const*>(input.data()), input.size(), &invalid) == 0);
+        CHECK(invalid);
+    }
+
+    // Unmatched surrogates in UTF-16 input become U+FFFD in UTF-8 output.
+    std::u16string const utf16 = u"a\xDC00" u"b\xD800" u"c";
+    UINT8 utf8[5 * 3];
+    auto const result = Utf16ToUtf8(utf16.data(), utf16.size(), utf8, ByteSwap::None);
+    std::string_view const output(reinterpret_cast<char const*>(utf8),
+        static_cast<UINT8 const*>(result.OutputPos) - utf8);
+    CHECK(result.InputPos == utf16.data() + utf16.size());
+    CHECK(result.UsedReplacement != ERROR_SUCCESS);
+    CHECK(output == "a\xEF\xBF\xBD" "b\xEF\xBF\xBD" "c");
+}
+
+static void
+TestTruncated()
+{
+    // A valid but incomplete sequence at the end of input is not consumed.
+    static char const* const inputs[] = {
+        "ab\xC3",
+        "ab\xE2\x82",
+        "ab\xF0\x9F\x98",
+    };
+
+    for (std::string_view const input : inputs)
+    {
+        auto const result = Utf8ToUtf16(input);
+        CHECK(result.Consumed == 2);
+        CHECK(!result.UsedReplacement);
+        CHECK(result.Output == u"ab");
+
+        bool invalid = true;
+        CHECK(ValidateUtf8(reinterpret_cast<UINT8 const*>(input.data()), input.size(), &invalid) == 2);
+        CHECK(!invalid);
+    }
+
+    // An incomplete sequence followed by more input is invalid.
+    auto const result = Utf8ToUtf16("\xF0\x9F\x98" "A");
+    CHECK(result.Consumed == 4);
+    CHECK(result.Output == u"\xFFFD" u"A");
+}
+
+static void
+TestMaximalSubpart()
+{
+    // Example from the Unicode Standard, section 3.9 (U+FFFD substitution
+    // of maximal subparts).
+    std::string_view const input = "\x61\xF1\x80\x80\xE1\x80\xC2\x62\x80\x63\x80\xBF\x64";
+    auto const result = Utf8ToUtf16(input);
+    CHECK(result.Consumed == input.size());
+    CHECK(result.UsedReplacement);
+    CHECK(result.Output == u"a\xFFFD\xFFFD\xFFFD" u"b\xFFFD" u"c\xFFFD\xFFFD" u"d");
+}
+
+static void
+TestChunked()
+{
+    // Mix of ASCII runs, valid sequences of each length, and invalid bytes.
+    static char const* const pieces[] = {
+        "plain ascii text ",
+        "\xC3\xA9",
+        "\xE2\x82\xAC",
+        "\xF0\x9F\x98\x80",
+        "\x80",
+        "\xC0\xAF",
+        "\xED\xA0\x80",
+        "\xF1\x80\x80",
+        "\xFF",
+        "\n",
+    };
+
+    std::string input;
+    unsigned seed = 1;
+    for (unsigned i = 0; i != 2000; i += 1)
+    {
+        seed = seed * 1103515245 + 12345;
+        input += pieces[(seed >> 16) % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+
+    auto const whole = Utf8ToUtf16(input);
+    CHECK(whole.Consumed == input.size());
+
+    // Feed the input in chunks, carrying any incomplete sequence over to the
+    // next chunk, the way CodeConvert and TextInput do.
+    for (size_t chunkSize = 1; chunkSize != 40; chunkSize += 1)
+    {
+        std::u16string output;
+        std::string pending;
+        for (size_t pos = 0; pos < input.size(); pos += chunkSize)
+        {
+            pending += input.substr(pos, chunkSize);
+            auto const chunk = Utf8ToUtf16(pending);
+            output += chunk.Output;
+            pending.erase(0, chunk.Consumed);
+        }
+
+        CHECK(pending.empty());
+        CHECK(output == whole.Output);
+    }
+}
+
+int
+main()
+{
+    TestValid();
+    TestOverlongAndSurrogate();
+    TestTruncated();
+    TestMaximalSubpart();
+    TestChunked();
+
+    printf("UtfKernelsTest: %u failure(s).\n", g_failures);
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,105 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+#include "pch.h"
+#include "CommandQueue.h"
+
+CommandQueue::CommandQueue(size_t capacity)
+    : m_mutex()
+    , m_notEmpty()
+    , m_notFull()
+    , m_commands()
+    , m_spares()
+    , m_capacity(capacity)
+    , m_closed()
+    , m_canceled()
+{
+    assert(capacity != 0);
+    m_spares.reserve(capacity + 1);
+}
+
+bool
+CommandQueue::Push(std::wstring_view command, unsigned itemCount)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    assert(!m_closed);
+
+    m_notFull.wait(lock, [this] { return m_canceled || m_commands.size() < m_capacity; });
+    if (m_canceled)
+    {
+        return false;
+    }
+
+    if (m_spares.empty())
+    {
+        m_commands.push_back({ std::wstring(command), itemCount });
+    }
+    else
+    {
+        m_commands.push_back({ std::move(m_spares.back()), itemCount });
+        m_spares.pop_back();
+        m_commands.back().CommandLine.assign(command);
+    }
+
+    bool const wasEmpty = m_commands.size() == 1;
+    lock.unlock();
+
+    if (wasEmpty)
+    {
+        m_notEmpty.notify_one();
+    }
+
+    return true;
+}
+
+bool
+CommandQueue::Pop(std::wstring& command, _Out_ unsigned* pItemCount)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_notEmpty.wait(lock, [this] { return m_closed || !m_commands.empty(); });
+    if (m_commands.empty())
+    {
+        *pItemCount = 0;
+        return false;
+    }
+
+    // Keep the caller's old buffer for a later Push.
+    auto& entry = m_commands.front();
+    command.swap(entry.CommandLine);
+    *pItemCount = entry.ItemCount;
+    m_spares.push_back(std::move(entry.CommandLine));
+    m_commands.pop_front();
+
+    bool const wasFull = m_commands.size() + 1 == m_capacity;
+    lock.unlock();
+
+    if (wasFull)
+    {
+        m_notFull.notify_one();
+    }
+
+    return true;
+}
+
+void
+CommandQueue::Close() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+
+    m_notEmpty.notify_all();
+}
+
+void
+CommandQueue::Cancel() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_canceled = true;
+    }
+
+    m_notFull.notify_all();
+}
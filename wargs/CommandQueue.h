@@ -0,0 +1,63 @@
+// Copyright (c) Doug Cook.
+// Licensed under the MIT License.
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/*
+Bounded queue of ready-to-run command lines, filled by the input reader
+thread and drained by the launcher (see WArgs::Run).
+*/
+class CommandQueue
+{
+    struct Entry
+    {
+        std::wstring CommandLine;
+        unsigned ItemCount; // Number of input items in CommandLine.
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<Entry> m_commands;
+    std::vector<std::wstring> m_spares; // Popped strings, reused by Push to avoid allocations.
+    size_t const m_capacity;
+    bool m_closed; // Reader is done: no more Push.
+    bool m_canceled; // Launcher is done: Push fails.
+
+public:
+
+    CommandQueue(CommandQueue const&) = delete;
+    void operator=(CommandQueue const&) = delete;
+
+    explicit
+    CommandQueue(size_t capacity);
+
+    /*
+    Appends a copy of command. Blocks while the queue is full.
+    Returns false (without appending) if Cancel was called.
+    */
+    bool
+    Push(std::wstring_view command, unsigned itemCount);
+
+    /*
+    Removes the oldest command and swaps it into command. Blocks while the
+    queue is empty. Returns false if the queue is empty and Close was called.
+    */
+    bool
+    Pop(std::wstring& command, _Out_ unsigned* pItemCount);
+
+    /*
+    Called by the reader: no more commands will be pushed.
+    */
+    void
+    Close() noexcept;
+
+    /*
+    Called by the launcher: no more commands will be popped. Unblocks Push.
+    */
+    void
+    Cancel() noexcept;
+};
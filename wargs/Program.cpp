@@ -52,7 +52,20 @@ If no COMMAND is specified, the default command is echo (cmd.exe /c echo).
 -s MAXCHARS, --max-chars=... Limits each batch's command length to MAXCHARS.
 --show-limits                Output the limits of this implementation before
                              running any commands.
+--stats[=FILE]               After all commands exit, output a summary to
+                             stderr of command wall, user, and kernel time,
+                             peak memory, slot utilization, and time spent
+                             waiting for input. If FILE is given,
+                             instead write one JSON line per command and a
+                             final summary line to FILE. Commands started
+                             with -b are counted but not measured.
 -t, --verbose                Output command line to stderr before each batch.
+--target-seconds=SECONDS     Size each batch so that COMMAND runs for about
+                             SECONDS, based on the measured runtime per
+                             argument of earlier batches. Batches have 1
+                             argument until the first batch finishes.
+                             Batches still respect MAXARGS, MAXLINES, and
+                             MAXCHARS.
 -x, --exit                   Exit instead of skipping the argument if the
                              argument would force the command line to exceed
                              MAXCHARS.
@@ -210,6 +223,22 @@ wmain(int argc, _In_count_(argc) PWSTR argv[])
                 {
                     wargs.SetShowLimits();
                 }
+                else if (ap.CurrentArgNameMatches(2, L"stats"))
+                {
+                    val = {};
+                    if (nullptr == ap.GetLongArgVal() || // If value is absent, report to stderr.
+                        ap.GetLongArgVal(val, false))    // If value is present, it must not be empty.
+                    {
+                        wargs.SetStats(val, "--stats");
+                    }
+                }
+                else if (ap.CurrentArgNameMatches(1, L"target-seconds"))
+                {
+                    if (ap.GetLongArgVal(uval, false, 10))
+                    {
+                        wargs.SetTargetSeconds(uval, "--target-seconds");
+                    }
+                }
                 else if (ap.CurrentArgNameMatches(4, L"verbose"))
                 {
                     wargs.SetVerbose();
@@ -4,20 +4,25 @@
 #include "pch.h"
 #include "WArgs.h"
 #include "WArgsContext.h"
+#include "CommandQueue.h"
 #include "TokenReader.h"
 
 #include <CodePageInfo.h>
 #include <CodeConvert.h>
 #include <TextInput.h>
 
+#include <thread>
+
 static constexpr std::wstring_view ClipboardFilename = L"<clipboard>";
 static constexpr std::wstring_view StdInFilename = L"<stdin>";
 static constexpr std::wstring_view EchoCommand = L"cmd.exe /c echo";
 
 static constexpr UINT16 MaxCharsLimit = 32767;
 static constexpr UINT16 MaxCharsDefault = 8000;
-static constexpr INT8 MaxProcsLimit = MAXIMUM_WAIT_OBJECTS;
-static constexpr INT8 MaxProcsDefault = 1;
+static constexpr int MaxProcsLimit = 4096;
+static constexpr int MaxProcsDefault = 1;
+static constexpr size_t CommandQueueCapacity = 256; // Command lines parsed ahead of the launcher.
+static constexpr unsigned TargetBatchItemsMax = 0x10000; // --target-seconds: limit on items per batch.
 
 static void
 WarnIfNotEmpty(PCWSTR oldValue, PCSTR argName)
@@ -126,6 +131,41 @@ Replace(
     }
 }
 
+// --target-seconds: number of items for the next batch. Until a runtime has
+// been measured, each batch is a 1-item probe: the reader can run up to
+// 2 * MAXPROCS batches ahead of the first exit, so growing the batches before
+// then could start a whole wave of commands that run far past the target.
+static unsigned
+TargetBatchItems(unsigned targetSeconds, double millisecondsPerItem) noexcept
+{
+    double const items = millisecondsPerItem > 0
+        ? targetSeconds * 1000.0 / millisecondsPerItem
+        : 1.0;
+    return items < 1 ? 1u
+        : items > TargetBatchItemsMax ? TargetBatchItemsMax
+        : static_cast<unsigned>(items);
+}
+
+// Stops the reader thread started by WArgs::Run. The reader may be blocked in
+// ReadFile or ReadConsoleW waiting for input that won't arrive soon (slow
+// pipe, console), so cancel its I/O until it exits. TextInput treats the
+// canceled read (ERROR_OPERATION_ABORTED) as end of input, and Push fails
+// after Cancel, so the reader exits without starting more commands.
+static void
+StopReader(CommandQueue& queue, std::thread& reader) noexcept
+{
+    queue.Cancel();
+
+    // Retry in case the reader was between reads when the I/O was canceled.
+    auto const hReader = static_cast<HANDLE>(reader.native_handle());
+    while (WaitForSingleObject(hReader, 10) == WAIT_TIMEOUT)
+    {
+        CancelSynchronousIo(hReader);
+    }
+
+    reader.join();
+}
+
 static TextInput
 OpenInput(std::wstring const& filename, unsigned codePage, TextInputFlags flags)
 {
@@ -345,6 +385,13 @@ WArgs::SetMaxChars(unsigned value, PCSTR argName)
     m_maxChars = value;
 }
 
+void
+WArgs::SetTargetSeconds(unsigned value, PCSTR argName)
+{
+    WarnIfNotZero(m_targetSeconds, argName);
+    m_targetSeconds = value;
+}
+
 bool
 WArgs::SetProcessSlotVar(std::wstring_view value, PCSTR argName)
 {
@@ -382,7 +429,7 @@ void
 WArgs::SetMaxProcs(unsigned value, PCSTR argName)
 {
     WarnIfNotNegative(m_maxProcs, argName);
-    m_maxProcs = value <= MaxProcsLimit ? (INT8)value : MaxProcsLimit;
+    m_maxProcs = value <= (unsigned)MaxProcsLimit ? (int)value : MaxProcsLimit;
 
     if (m_background)
     {
@@ -571,6 +618,14 @@ WArgs::SetShowLimits() noexcept
     m_showLimits = true;
 }
 
+void
+WArgs::SetStats(std::wstring_view filename, PCSTR argName)
+{
+    WarnIfNotEmpty(m_statsFilename.c_str(), argName);
+    m_statsFilename = filename;
+    m_stats = true;
+}
+
 void
 WArgs::SetVerbose()
 {
@@ -625,6 +680,14 @@ WArgs::FinalizeParameters()
         m_maxProcs = MaxProcsLimit;
     }
 
+    if (m_targetSeconds != 0 && (m_background || !m_replaceStr.empty()))
+    {
+        // Runtimes aren't measured with -b, and -I always runs one item per command.
+        fprintf(stderr, "%hs: warning : '%hs' ignoring --target-seconds\n",
+            AppName, m_background ? "-b (background)" : "-I (replace)");
+        m_targetSeconds = 0;
+    }
+
     if (m_delimiter >= 0 && !m_eofStr.empty())
     {
         fprintf(stderr, "%hs: warning : '-d' (delimiter) overriding -E (eof)\n",
@@ -646,6 +709,141 @@ WArgs::FinalizeParameters()
     return ok;
 }
 
+WArgs::ExitCode
+WArgs::ReadCommands(
+    std::wstring commandLine,
+    Context const& context,
+    std::function<bool(std::wstring&, unsigned)> const& startCommand) const
+{
+    auto const commandLineInitialSize = commandLine.size();
+    ExitCode exitCode = ExitCodeSuccess;
+
+    bool const inputCheckBom = m_inputEncoding.Specified
+        ? m_inputEncoding.Bom
+        : ClipboardFilename != m_inputFilename;
+    TextInputFlags const inputFlags =
+        TextInputFlags::FoldCRLF |
+        (inputCheckBom ? TextInputFlags::ConsumeBom : TextInputFlags::None) |
+        TextInputFlags::InvalidMbcsError |
+        TextInputFlags::CheckConsole |
+        TextInputFlags::ConsoleCtrlZ;
+    TokenReader reader(
+        OpenInput(m_inputFilename, m_inputEncoding.CodePage, inputFlags),
+        static_cast<wchar_t>(m_delimiter));
+
+    std::wstring token;
+    std::wstring replacedArg;
+    std::wstring escapedArg;
+    bool runWithNoArgs = !m_noRunIfEmpty && m_replaceStr.empty();
+    unsigned targetItems = m_targetSeconds != 0
+        ? TargetBatchItems(m_targetSeconds, context.MillisecondsPerItem())
+        : 0;
+
+    for (;;)
+    {
+        bool const tokenRead =
+            m_delimiter >= 0 ? reader.ReadDelimited(token)
+            : m_replaceStr.empty() ? reader.ReadEscapedToken(token)
+            : reader.ReadEscapedLine(token);
+        if (!tokenRead ||
+            (!m_eofStr.empty() && m_eofStr == token))
+        {
+            if (runWithNoArgs || commandLine.size() != commandLineInitialSize)
+            {
+                startCommand(commandLine, reader.TokenCount());
+            }
+
+            break;
+        }
+
+        if (m_replaceStr.empty())
+        {
+            // Normal mode (not -I)
+
+            EscapeArg(escapedArg, token);
+
+            if (m_maxChars - commandLineInitialSize <= escapedArg.size())
+            {
+                fprintf(stderr, "%hs: %hs : Token (length=%Iu) is too long to fit on command line (max-chars=%u).\n",
+                    AppName, m_exitIfSizeExceeded ? "error" : "warning",
+                    escapedArg.size(), m_maxChars);
+                if (m_exitIfSizeExceeded)
+                {
+                    exitCode = ExitCodeFatalCommandCannotRun;
+                    break;
+                }
+                else
+                {
+                    continue;
+                }
+            }
+
+            bool const tokenFits = m_maxChars > commandLine.size() + escapedArg.size();
+
+            if (tokenFits)
+            {
+                commandLine += escapedArg;
+                assert(commandLine.size() <= m_maxChars);
+            }
+
+            if (!tokenFits ||
+                (0 != m_maxArgs && m_maxArgs <= reader.TokenCount()) ||
+                (0 != m_maxLines && m_maxLines <= reader.LineCount()) ||
+                (0 != targetItems && targetItems <= reader.TokenCount()))
+            {
+                // If the token didn't fit, it isn't part of this batch.
+                if (!startCommand(commandLine, reader.TokenCount() - !tokenFits))
+                {
+                    break;
+                }
+
+                commandLine.erase(commandLineInitialSize);
+                reader.ResetCounts();
+                runWithNoArgs = false;
+
+                if (0 != targetItems)
+                {
+                    targetItems = TargetBatchItems(m_targetSeconds, context.MillisecondsPerItem());
+                }
+            }
+
+            if (!tokenFits)
+            {
+                commandLine += escapedArg;
+                assert(commandLine.size() <= m_maxChars);
+            }
+        }
+        else
+        {
+            // Replace mode (-I)
+
+            for (auto const& arg : m_initialArgs)
+            {
+                Replace(replacedArg, arg, m_replaceStr, token);
+                EscapeArg(escapedArg, replacedArg);
+                commandLine += escapedArg;
+            }
+
+            if (commandLine.size() >= m_maxChars)
+            {
+                fprintf(stderr, "%hs: error : Command line (length=%Iu) is too long (max-chars=%u).\n",
+                    AppName, commandLine.size(), m_maxChars);
+                exitCode = ExitCodeFatalCommandCannotRun;
+                break;
+            }
+
+            if (!startCommand(commandLine, 1))
+            {
+                break;
+            }
+
+            commandLine.erase(commandLineInitialSize);
+        }
+    }
+
+    return exitCode;
+}
+
 unsigned
 WArgs::Run() const
 {
@@ -667,6 +865,7 @@ WArgs::Run() const
             m_exitIfSizeExceeded ? "x" : "");
     }
     if (m_showLimits) { fprintf(stderr, " --show-limits"); }
+    if (m_stats) { fprintf(stderr, " --stats=\"%ls\"", m_statsFilename.c_str()); }
     if (m_inputEncoding.Specified) fprintf(stderr, " -f cp%u%hs", m_inputEncoding.CodePage, m_inputEncoding.Bom ? "BOM" : "");
     if (!m_inputFilename.empty()) { fprintf(stderr, " -a\"%ls\"", m_inputFilename.c_str()); }
     if (!m_eofStr.empty()) { fprintf(stderr, " -E\"%ls\"", m_eofStr.c_str()); }
@@ -675,6 +874,7 @@ WArgs::Run() const
     if (m_maxLines) { fprintf(stderr, " -L%u", m_maxLines); }
     if (m_maxArgs) { fprintf(stderr, " -n%u", m_maxArgs); }
     if (m_maxChars) { fprintf(stderr, " -s%u", m_maxChars); }
+    if (m_targetSeconds) { fprintf(stderr, " --target-seconds=%u", m_targetSeconds); }
     if (m_maxProcs >= 0) { fprintf(stderr, " -P%u", m_maxProcs); }
     if (m_delimiter >= 0) { fprintf(stderr, " -d\\x%02X", m_delimiter); }
     fprintf(stderr, " %ls", m_command.c_str());
@@ -715,114 +915,86 @@ WArgs::Run() const
             AppName, commandLineInitialSize, m_maxChars);
         context.AccumulateExitCode(ExitCodeFatalCommandCannotRun);
     }
-    else
+    else if (context.ExitCodeIsFatal())
     {
-        bool const inputCheckBom = m_inputEncoding.Specified
-            ? m_inputEncoding.Bom
-            : ClipboardFilename != m_inputFilename;
-        TextInputFlags const inputFlags =
-            TextInputFlags::FoldCRLF |
-            (inputCheckBom ? TextInputFlags::ConsumeBom : TextInputFlags::None) |
-            TextInputFlags::InvalidMbcsError |
-            TextInputFlags::CheckConsole |
-            TextInputFlags::ConsoleCtrlZ;
-        TokenReader reader(
-            OpenInput(m_inputFilename, m_inputEncoding.CodePage, inputFlags),
-            static_cast<wchar_t>(m_delimiter));
-
-        std::wstring token;
-        std::wstring replacedArg;
-        std::wstring escapedArg;
-        bool runWithNoArgs = !m_noRunIfEmpty && m_replaceStr.empty();
-
-        while (!context.ExitCodeIsFatal())
-        {
-            bool const tokenRead =
-                m_delimiter >= 0 ? reader.ReadDelimited(token)
-                : m_replaceStr.empty() ? reader.ReadEscapedToken(token)
-                : reader.ReadEscapedLine(token);
-            if (!tokenRead ||
-                (!m_eofStr.empty() && m_eofStr == token))
+        // Context setup failed (error already reported). Run no commands.
+    }
+    else if (m_interactive)
+    {
+        // The prompt reads from the console, so don't read input (which
+        // might also be the console) at the same time.
+        context.AccumulateExitCode(ReadCommands(commandLine, context,
+            [&](std::wstring& command, unsigned itemCount)
             {
-                if (runWithNoArgs || commandLine.size() != commandLineInitialSize)
+                if (context.ExitCodeIsFatal())
                 {
-                    context.StartProcess(commandLine.data());
+                    return false;
                 }
 
-                break;
-            }
-
-            if (m_replaceStr.empty())
+                context.StartProcess(command.data(), itemCount);
+                return !context.ExitCodeIsFatal();
+            }));
+    }
+    else
+    {
+        // Parse input and build command lines on a separate thread so that
+        // parsing continues while the launcher waits for a free slot.
+        // With --target-seconds, keep the reader close behind the launcher
+        // so that batch sizes use recent runtimes.
+        CommandQueue queue(m_targetSeconds != 0 && (unsigned)m_maxProcs < CommandQueueCapacity
+            ? m_maxProcs
+            : CommandQueueCapacity);
+        ExitCode readerExitCode = ExitCodeSuccess;
+        std::exception_ptr readerException;
+        std::thread reader([&]()
             {
-                // Normal mode (not -I)
-
-                EscapeArg(escapedArg, token);
-
-                if (m_maxChars - commandLineInitialSize <= escapedArg.size())
+                try
                 {
-                    fprintf(stderr, "%hs: %hs : Token (length=%Iu) is too long to fit on command line (max-chars=%u).\n",
-                        AppName, m_exitIfSizeExceeded ? "error" : "warning",
-                        escapedArg.size(), m_maxChars);
-                    if (m_exitIfSizeExceeded)
-                    {
-                        context.AccumulateExitCode(ExitCodeFatalCommandCannotRun);
-                        break;
-                    }
-                    else
-                    {
-                        continue;
-                    }
+                    readerExitCode = ReadCommands(commandLine, context,
+                        [&](std::wstring& command, unsigned itemCount) { return queue.Push(command, itemCount); });
                 }
-
-                bool const tokenFits = m_maxChars > commandLine.size() + escapedArg.size();
-
-                if (tokenFits)
+                catch (...)
                 {
-                    commandLine += escapedArg;
-                    assert(commandLine.size() <= m_maxChars);
+                    readerException = std::current_exception();
                 }
 
-                if (!tokenFits ||
-                    (0 != m_maxArgs && m_maxArgs <= reader.TokenCount()) ||
-                    (0 != m_maxLines && m_maxLines <= reader.LineCount()))
-                {
-                    context.StartProcess(commandLine.data());
-                    commandLine.erase(commandLineInitialSize);
-                    reader.ResetCounts();
-                    runWithNoArgs = false;
-                }
+                queue.Close();
+            });
 
-                if (!tokenFits)
-                {
-                    commandLine += escapedArg;
-                    assert(commandLine.size() <= m_maxChars);
-                }
-            }
-            else
+        try
+        {
+            std::wstring readyCommand;
+            unsigned readyItemCount;
+            auto waitStartTicks = GetTickCount64();
+            while (!context.ExitCodeIsFatal() && queue.Pop(readyCommand, &readyItemCount))
             {
-                // Replace mode (-I)
-
-                for (auto const& arg : m_initialArgs)
-                {
-                    Replace(replacedArg, arg, m_replaceStr, token);
-                    EscapeArg(escapedArg, replacedArg);
-                    commandLine += escapedArg;
-                }
+                context.AddInputWait(GetTickCount64() - waitStartTicks);
+                context.StartProcess(readyCommand.data(), readyItemCount);
+                waitStartTicks = GetTickCount64();
+            }
+        }
+        catch (...)
+        {
+            StopReader(queue, reader);
+            throw;
+        }
 
-                if (commandLine.size() >= m_maxChars)
-                {
-                    fprintf(stderr, "%hs: error : Command line (length=%Iu) is too long (max-chars=%u).\n",
-                        AppName, commandLine.size(), m_maxChars);
-                    context.AccumulateExitCode(ExitCodeFatalCommandCannotRun);
-                    break;
-                }
+        StopReader(queue, reader);
 
-                context.StartProcess(commandLine.data());
-                commandLine.erase(commandLineInitialSize);
-            }
+        if (readerException)
+        {
+            std::rethrow_exception(readerException);
         }
+
+        context.AccumulateExitCode(readerExitCode);
     }
 
     context.WaitForAllProcessesToExit();
+
+    if (m_stats)
+    {
+        context.WriteStats();
+    }
+
     return context.UnsignedExitCode();
 }
@@ -34,12 +34,14 @@ class WArgs
     std::wstring m_eofStr; // -E, --eof
     std::wstring m_processSlotVar; // --process-slot-var
     std::wstring m_replaceStr; // -I, --replace
+    std::wstring m_statsFilename; // --stats
     Encoding m_inputEncoding = {}; // -f, --from-code
     unsigned m_maxLines = 0; // -L, --max-lines
     unsigned m_maxArgs = 0; // -n, --max-args
     unsigned m_maxChars = 0; // -s, --max-chars
+    unsigned m_targetSeconds = 0; // --target-seconds
     int m_delimiter = -1; // -d, --delimiter
-    INT8 m_maxProcs = -1; // -P, --max-procs
+    int m_maxProcs = -1; // -P, --max-procs
     bool m_background = 0; // -b, --background
     bool m_interactive = 0; // -p, --interactive
     bool m_noRunIfEmpty = 0; // -r, --no-run-if-empty
@@ -47,6 +49,7 @@ class WArgs
     bool m_verbose = 0; // -t, --verbose
     bool m_exitIfSizeExceeded = 0; // -x, --exit
     bool m_showLimits = 0; // --show-limits
+    bool m_stats = 0; // --stats
     bool m_noQuoteArgs = 0; // -Q, --no-quote-args
 
 private:
@@ -57,6 +60,26 @@ private:
     void
     EscapeArg(std::wstring& escapedArg, std::wstring_view arg) const;
 
+    /*
+    Reads tokens from the input, builds command lines starting with
+    commandLine (the command and initial args), and passes each one (with
+    the number of input items in it) to startCommand, which returns false to
+    stop reading. With --target-seconds, sizes batches using
+    context.MillisecondsPerItem(). Returns a fatal exit code if a command
+    line is too long, otherwise ExitCodeSuccess.
+
+    With -p, runs on the launcher's thread and startCommand runs each
+    command. Otherwise, runs on a reader thread and startCommand queues each
+    command for the launcher. If the launcher stops early, it cancels the
+    reader's blocked read (CancelSynchronousIo), which is treated as the end
+    of input.
+    */
+    ExitCode
+    ReadCommands(
+        std::wstring commandLine,
+        Context const& context,
+        std::function<bool(std::wstring&, unsigned)> const& startCommand) const;
+
 public:
 
     [[nodiscard]] bool
@@ -107,6 +130,9 @@ public:
     void
     SetMaxChars(unsigned value, PCSTR argName);
 
+    void
+    SetTargetSeconds(unsigned value, PCSTR argName);
+
     void
     SetVerbose();
 
@@ -116,6 +142,9 @@ public:
     void
     SetShowLimits() noexcept;
 
+    void
+    SetStats(std::wstring_view filename, PCSTR argName);
+
     [[nodiscard]] bool
     SetDelimiter(std::wstring_view value, PCSTR argName) noexcept;
 
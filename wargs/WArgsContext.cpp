@@ -4,6 +4,29 @@
 #include "pch.h"
 #include "WArgsContext.h"
 
+#include <psapi.h>
+#include <stdarg.h>
+
+static ULONGLONG
+FileTimeValue(FILETIME const& fileTime) noexcept
+{
+    return (ULONGLONG)fileTime.dwHighDateTime << 32 | fileTime.dwLowDateTime;
+}
+
+static double
+FileTimeToSeconds(ULONGLONG fileTimeValue) noexcept
+{
+    return fileTimeValue / 10000000.0;
+}
+
+void
+WArgs::Context::CloseThreadpoolWait_delete::operator()(PTP_WAIT p) const noexcept
+{
+    SetThreadpoolWait(p, nullptr, nullptr);
+    WaitForThreadpoolWaitCallbacks(p, TRUE);
+    CloseThreadpoolWait(p);
+}
+
 WArgs::Context:: ~Context()
 {
     WaitForAllProcessesToExit();
@@ -11,16 +34,62 @@ WArgs::Context:: ~Context()
 
 WArgs::Context::Context(WArgs const& wargs, bool useStdIn)
     : m_wargs(wargs)
-    , m_slotHandles(wargs.m_maxProcs)
+    , m_completionPort()
+    , m_slots(wargs.m_maxProcs)
+    , m_freeSlots(wargs.m_maxProcs)
     , m_slotCount(wargs.m_maxProcs)
     , m_slotsActive()
+    , m_millisecondsPerItem()
+    , m_stats()
+    , m_statsFile()
     , m_exitCode()
     , m_conin()
     , m_nul()
     , m_hTtyForPrompt()
     , m_hStdInputForChild()
 {
-    assert(wargs.m_maxProcs <= MAXIMUM_WAIT_OBJECTS);
+    m_stats.StartTicks = GetTickCount64();
+
+    if (m_slotCount != 0)
+    {
+        m_completionPort.reset(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1));
+        if (!m_completionPort)
+        {
+            fprintf(stderr, "%hs: error : CreateIoCompletionPort error %u.\n",
+                AppName, GetLastError());
+            AccumulateExitCode(ExitCodeFatalOtherError);
+        }
+
+        for (unsigned slotIndex = 0; slotIndex != m_slotCount; slotIndex += 1)
+        {
+            m_slots[slotIndex].CompletionPort = m_completionPort.get();
+
+            // Reverse order so that the lowest slots are used first.
+            m_freeSlots[slotIndex] = m_slotCount - 1 - slotIndex;
+        }
+    }
+
+    if (!m_wargs.m_statsFilename.empty())
+    {
+        HANDLE hStatsFile = CreateFileW(
+            m_wargs.m_statsFilename.c_str(),
+            GENERIC_WRITE,
+            FILE_SHARE_READ,
+            nullptr, // Not inherited by commands.
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL,
+            nullptr);
+        if (hStatsFile == INVALID_HANDLE_VALUE)
+        {
+            fprintf(stderr, "%hs: error : CreateFile error %u opening '%ls'.\n",
+                AppName, GetLastError(), m_wargs.m_statsFilename.c_str());
+            AccumulateExitCode(ExitCodeFatalOtherError);
+        }
+        else
+        {
+            m_statsFile.reset(hStatsFile);
+        }
+    }
 
     if (m_wargs.m_interactive || m_wargs.m_openTty)
     {
@@ -90,14 +159,67 @@ WArgs::Context::WaitForAllProcessesToExit()
     }
 }
 
+double
+WArgs::Context::MillisecondsPerItem() const noexcept
+{
+    return m_millisecondsPerItem.load(std::memory_order_relaxed);
+}
+
 void
-WArgs::Context::StartProcess(_In_ PWSTR commandLine)
+WArgs::Context::AddInputWait(ULONGLONG ticks) noexcept
+{
+    // Exits are reaped lazily, so this undercounts when slots freed up
+    // during the wait.
+    if (m_slotsActive < m_slotCount)
+    {
+        m_stats.InputWaitTicks += ticks;
+    }
+}
+
+void
+WArgs::Context::WriteStats()
+{
+    auto const elapsedTicks = GetTickCount64() - m_stats.StartTicks;
+    double const utilization = m_slotCount != 0 && elapsedTicks != 0
+        ? m_stats.WallTime / 10000.0 / ((double)m_slotCount * elapsedTicks)
+        : 0.0;
+
+    if (m_statsFile)
+    {
+        WriteStatsLine(
+            "{\"summary\":true,\"commands\":%u,\"measured\":%u,\"items\":%llu,"
+            "\"elapsedSeconds\":%.3f,\"slots\":%u,\"utilization\":%.4f,\"inputWaitSeconds\":%.3f,"
+            "\"wallSeconds\":%.3f,\"maxWallSeconds\":%.3f,\"userSeconds\":%.3f,\"kernelSeconds\":%.3f,"
+            "\"maxPeakWorkingSetBytes\":%llu}\n",
+            m_stats.CommandsStarted, m_stats.CommandsMeasured, m_stats.ItemCount,
+            elapsedTicks / 1000.0, m_slotCount, utilization, m_stats.InputWaitTicks / 1000.0,
+            FileTimeToSeconds(m_stats.WallTime), FileTimeToSeconds(m_stats.MaxWallTime),
+            FileTimeToSeconds(m_stats.UserTime), FileTimeToSeconds(m_stats.KernelTime),
+            (unsigned long long)m_stats.MaxPeakWorkingSet);
+    }
+    else
+    {
+        fprintf(stderr, "%hs: info : stats: %u commands (%u measured), %llu items, elapsed %.3fs.\n",
+            AppName, m_stats.CommandsStarted, m_stats.CommandsMeasured, m_stats.ItemCount,
+            elapsedTicks / 1000.0);
+        fprintf(stderr, "%hs: info : stats: command wall %.3fs (max %.3fs), user %.3fs, kernel %.3fs, max peak working set %Iu KB.\n",
+            AppName,
+            FileTimeToSeconds(m_stats.WallTime), FileTimeToSeconds(m_stats.MaxWallTime),
+            FileTimeToSeconds(m_stats.UserTime), FileTimeToSeconds(m_stats.KernelTime),
+            m_stats.MaxPeakWorkingSet / 1024);
+        fprintf(stderr, "%hs: info : stats: %u slots, %.1f%% utilized, %.3fs waiting for input with a free slot.\n",
+            AppName, m_slotCount, utilization * 100.0, m_stats.InputWaitTicks / 1000.0);
+    }
+}
+
+void
+WArgs::Context::StartProcess(_In_ PWSTR commandLine, unsigned itemCount)
 {
     assert(!ExitCodeIsFatal());
     assert(commandLine[0] != 0);
     assert(m_hStdInputForChild);
 
-    UINT8 slotIndex;
+    unsigned slotIndex;
     if (m_wargs.m_background)
     {
         slotIndex = 0;
@@ -127,7 +249,7 @@ WArgs::Context::StartProcess(_In_ PWSTR commandLine)
         fprintf(stderr, "%ls\n", commandLine);
     }
 
-    WCHAR slotString[3];
+    WCHAR slotString[9];
     swprintf_s(slotString, L"%0x", slotIndex);
     if (!m_wargs.m_processSlotVar.empty() &&
         !SetEnvironmentVariableW(m_wargs.m_processSlotVar.c_str(), slotString))
@@ -164,14 +286,23 @@ WArgs::Context::StartProcess(_In_ PWSTR commandLine)
         {
             TextToolsUniqueHandle hProcess(pi.hProcess);
             TextToolsUniqueHandle hThread(pi.hThread);
+            m_stats.CommandsStarted += 1;
+            m_stats.ItemCount += itemCount;
             if (!m_wargs.m_background)
             {
-                SetSlot(slotIndex, std::move(hProcess));
+                SetSlot(slotIndex, std::move(hProcess), itemCount);
             }
         }
     }
 }
 
+void CALLBACK
+WArgs::Context::ProcessExitCallback(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WAIT, TP_WAIT_RESULT) noexcept
+{
+    auto const pSlot = static_cast<Slot*>(context);
+    PostQueuedCompletionStatus(pSlot->CompletionPort, 0, reinterpret_cast<ULONG_PTR>(pSlot), nullptr);
+}
+
 TextToolsUniqueHandle
 WArgs::Context::OpenInputDevice(PCWSTR name) noexcept
 {
@@ -207,9 +338,9 @@ WArgs::Context::OpenInputDevice(PCWSTR name) noexcept
 }
 
 _Success_(return) bool
-WArgs::Context::AcquireSlotIndex(_Out_ UINT8* pSlotIndex)
+WArgs::Context::AcquireSlotIndex(_Out_ unsigned* pSlotIndex)
 {
-    UINT8 slotIndex;
+    unsigned slotIndex;
     bool ok;
     if (!WaitForProcessExit(m_slotsActive == m_slotCount))
     {
@@ -219,16 +350,25 @@ WArgs::Context::AcquireSlotIndex(_Out_ UINT8* pSlotIndex)
     else
     {
         assert(m_slotsActive < m_slotCount);
-        for (slotIndex = 0; slotIndex != m_slotCount; slotIndex += 1)
+        assert(m_freeSlots.size() == m_slotCount - m_slotsActive);
+
+        // Stays on the free stack until SetSlot (the prompt may skip it).
+        slotIndex = m_freeSlots.back();
+        assert(!m_slots[slotIndex].Process);
+        ok = true;
+
+        auto& slot = m_slots[slotIndex];
+        if (!slot.Wait)
         {
-            if (!m_slotHandles[slotIndex])
+            slot.Wait.reset(CreateThreadpoolWait(ProcessExitCallback, &slot, nullptr));
+            if (!slot.Wait)
             {
-                break;
+                fprintf(stderr, "%hs: error : CreateThreadpoolWait error %u.\n",
+                    AppName, GetLastError());
+                AccumulateExitCode(ExitCodeFatalOtherError);
+                ok = false;
             }
         }
-
-        assert(slotIndex < m_slotCount);
-        ok = true;
     }
 
     *pSlotIndex = slotIndex;
@@ -236,75 +376,82 @@ WArgs::Context::AcquireSlotIndex(_Out_ UINT8* pSlotIndex)
 }
 
 void
-WArgs::Context::SetSlot(UINT8 slotIndex, TextToolsUniqueHandle value) noexcept
+WArgs::Context::SetSlot(unsigned slotIndex, TextToolsUniqueHandle value, unsigned itemCount) noexcept
 {
     assert(slotIndex < m_slotCount);
     assert(value);
-    assert(!m_slotHandles[slotIndex]);
+    auto& slot = m_slots[slotIndex];
+    assert(!slot.Process);
+    assert(slot.Wait);
     assert(m_slotsActive < m_slotCount);
-    m_slotHandles[slotIndex] = std::move(value);
+    assert(m_freeSlots.back() == slotIndex);
+    m_freeSlots.pop_back();
+    SetThreadpoolWait(slot.Wait.get(), value.get(), nullptr);
+    slot.Process = std::move(value);
+    slot.ItemCount = itemCount;
+    slot.CommandNumber = m_stats.CommandsStarted;
     m_slotsActive += 1;
 }
 
 TextToolsUniqueHandle
-WArgs::Context::ClearSlot(UINT8 slotIndex) noexcept
+WArgs::Context::ClearSlot(unsigned slotIndex) noexcept
 {
     assert(slotIndex < m_slotCount);
-    assert(m_slotHandles[slotIndex]);
+    assert(m_slots[slotIndex].Process);
     assert(m_slotsActive != 0);
     m_slotsActive -= 1;
-    return std::move(m_slotHandles[slotIndex]);
+    m_freeSlots.push_back(slotIndex); // Capacity is m_slotCount, so this doesn't allocate.
+    return std::move(m_slots[slotIndex].Process);
 }
 
 bool
 WArgs::Context::WaitForProcessExit(bool block)
 {
-    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
-    UINT8 handleIndexToSlotIndex[MAXIMUM_WAIT_OBJECTS];
     DWORD timeout = block ? INFINITE : 0;
 
-    // Loop until no objects signaled.
+    // Loop until no more exits are queued.
     while (m_slotsActive)
     {
-        UINT8 handleIndex = 0;
-        for (UINT8 slotIndex = 0; slotIndex != m_slotCount; slotIndex++)
+        DWORD cbTransferred;
+        ULONG_PTR completionKey;
+        LPOVERLAPPED pOverlapped;
+        if (!GetQueuedCompletionStatus(m_completionPort.get(), &cbTransferred, &completionKey, &pOverlapped, timeout))
         {
-            auto const slotHandle = m_slotHandles[slotIndex].get();
-            if (slotHandle)
+            auto const lastError = GetLastError();
+            if (lastError != WAIT_TIMEOUT)
             {
-                handles[handleIndex] = slotHandle;
-                handleIndexToSlotIndex[handleIndex] = slotIndex;
-                handleIndex += 1;
+                fprintf(stderr, "%hs: error : GetQueuedCompletionStatus failed with code %u.\n",
+                    AppName, lastError);
+                AccumulateExitCode(ExitCodeFatalOtherError);
             }
+            break;
         }
-        assert(handleIndex == m_slotsActive);
 
-        auto const waitResult = WaitForMultipleObjects(handleIndex, handles, false, timeout);
         timeout = 0; // Block only first time through the loop.
 
-        if (waitResult > WAIT_OBJECT_0 + handleIndex)
+        auto const slotIndex = static_cast<unsigned>(reinterpret_cast<Slot*>(completionKey) - m_slots.data());
+        auto const& slot = m_slots[slotIndex];
+        auto hProcess = ClearSlot(slotIndex);
+
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (slot.ItemCount != 0 &&
+            GetProcessTimes(hProcess.get(), &creationTime, &exitTime, &kernelTime, &userTime))
         {
-            switch (waitResult)
-            {
-            case WAIT_TIMEOUT:
-                break;
-            case WAIT_FAILED:
-                fprintf(stderr, "%hs: error : WaitForMultipleObjects failed with code %u.\n",
-                    AppName, GetLastError());
-                AccumulateExitCode(ExitCodeFatalOtherError);
-                break;
-            default:
-                fprintf(stderr, "%hs: error : WaitForMultipleObjects returned unexpected result %u.\n",
-                    AppName, waitResult);
-                AccumulateExitCode(ExitCodeFatalOtherError);
-                break;
-            }
-            break;
+            // Use the process's own lifetime, not the time until this exit
+            // was dequeued (which includes any time the launcher spent
+            // waiting for input). A command shorter than the clock's
+            // resolution measures as 0, so count at least 1 unit (100ns) to
+            // mark the rate as measured.
+            auto const wallTime = FileTimeValue(exitTime) - FileTimeValue(creationTime);
+            double const sample = double(wallTime ? wallTime : 1) / 10000.0 / slot.ItemCount;
+
+            // Exponential moving average, so batch sizes follow changes in runtime.
+            double const average = m_millisecondsPerItem.load(std::memory_order_relaxed);
+            m_millisecondsPerItem.store(
+                average > 0 ? average * 0.75 + sample * 0.25 : sample,
+                std::memory_order_relaxed);
         }
 
-        auto slotIndex = handleIndexToSlotIndex[waitResult - WAIT_OBJECT_0];
-        auto hProcess = ClearSlot(slotIndex);
-
         DWORD processExitCode = 0;
         if (!GetExitCodeProcess(hProcess.get(), &processExitCode))
         {
@@ -323,7 +470,83 @@ WArgs::Context::WaitForProcessExit(bool block)
                 AppName, processExitCode, processExitCode);
             AccumulateExitCode(ExitCodeCommandError);
         }
+
+        if (m_wargs.m_stats)
+        {
+            RecordProcessStats(slotIndex, hProcess.get(), processExitCode);
+        }
     }
 
     return m_exitCode >= 0;
 }
+
+void
+WArgs::Context::RecordProcessStats(unsigned slotIndex, HANDLE hProcess, DWORD processExitCode)
+{
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(hProcess, &creationTime, &exitTime, &kernelTime, &userTime))
+    {
+        fprintf(stderr, "%hs: warning : GetProcessTimes failed with code %u.\n",
+            AppName, GetLastError());
+        return;
+    }
+
+    PROCESS_MEMORY_COUNTERS memoryCounters = { sizeof(memoryCounters) };
+    if (!GetProcessMemoryInfo(hProcess, &memoryCounters, sizeof(memoryCounters)))
+    {
+        fprintf(stderr, "%hs: warning : GetProcessMemoryInfo failed with code %u.\n",
+            AppName, GetLastError());
+        memoryCounters.PeakWorkingSetSize = 0;
+    }
+
+    auto const wallTime = FileTimeValue(exitTime) - FileTimeValue(creationTime);
+    auto const user = FileTimeValue(userTime);
+    auto const kernel = FileTimeValue(kernelTime);
+
+    m_stats.CommandsMeasured += 1;
+    m_stats.WallTime += wallTime;
+    m_stats.UserTime += user;
+    m_stats.KernelTime += kernel;
+    if (m_stats.MaxWallTime < wallTime)
+    {
+        m_stats.MaxWallTime = wallTime;
+    }
+    if (m_stats.MaxPeakWorkingSet < memoryCounters.PeakWorkingSetSize)
+    {
+        m_stats.MaxPeakWorkingSet = memoryCounters.PeakWorkingSetSize;
+    }
+
+    if (m_statsFile)
+    {
+        auto const& slot = m_slots[slotIndex];
+        WriteStatsLine(
+            "{\"command\":%u,\"slot\":%u,\"items\":%u,\"exitCode\":%u,"
+            "\"wallSeconds\":%.3f,\"userSeconds\":%.3f,\"kernelSeconds\":%.3f,"
+            "\"peakWorkingSetBytes\":%llu}\n",
+            slot.CommandNumber, slotIndex, slot.ItemCount, processExitCode,
+            FileTimeToSeconds(wallTime), FileTimeToSeconds(user), FileTimeToSeconds(kernel),
+            (unsigned long long)memoryCounters.PeakWorkingSetSize);
+    }
+}
+
+void
+WArgs::Context::WriteStatsLine(_In_z_ PCSTR format, ...)
+{
+    assert(m_statsFile);
+
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int const cchLine = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    assert(cchLine > 0 && (unsigned)cchLine < sizeof(line));
+
+    DWORD cbWritten;
+    if (!WriteFile(m_statsFile.get(), line, (DWORD)cchLine, &cbWritten, nullptr))
+    {
+        fprintf(stderr, "%hs: error : WriteFile error %u writing '%ls'.\n",
+            AppName, GetLastError(), m_wargs.m_statsFilename.c_str());
+        AccumulateExitCode(ExitCodeOtherError);
+        m_statsFile.reset(); // Report the error once.
+    }
+}
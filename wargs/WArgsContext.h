@@ -4,15 +4,52 @@
 #pragma once 
 #include "WArgs.h"
 #include <TextToolsCommon.h>
+#include <atomic>
 
 class WArgs::Context
 {
 private:
 
+    struct CloseThreadpoolWait_delete
+    {
+        void operator()(PTP_WAIT p) const noexcept;
+    };
+
+    // When Process exits, a thread pool wait posts the slot's address to the
+    // completion port, so each exit costs O(1) regardless of the slot count.
+    struct Slot
+    {
+        TextToolsUniqueHandle Process;
+        std::unique_ptr<TP_WAIT, CloseThreadpoolWait_delete> Wait; // Created on first use.
+        HANDLE CompletionPort;
+        unsigned ItemCount; // Number of input items passed to Process.
+        unsigned CommandNumber; // 1-based, for --stats.
+    };
+
+    // --stats totals. Times are in 100ns units (FILETIME) unless noted.
+    struct Stats
+    {
+        ULONGLONG StartTicks; // GetTickCount64 when Context was created.
+        ULONGLONG InputWaitTicks; // Launcher waiting for input while a slot was free.
+        ULONGLONG WallTime; // Sum over measured commands, i.e. busy slot time.
+        ULONGLONG MaxWallTime;
+        ULONGLONG UserTime;
+        ULONGLONG KernelTime;
+        ULONGLONG ItemCount;
+        SIZE_T MaxPeakWorkingSet;
+        unsigned CommandsStarted;
+        unsigned CommandsMeasured;
+    };
+
     WArgs const& m_wargs;
-    std::vector<TextToolsUniqueHandle> m_slotHandles;
-    UINT8 const m_slotCount;
-    UINT8 m_slotsActive;
+    TextToolsUniqueHandle m_completionPort; // Must outlive m_slots.
+    std::vector<Slot> m_slots;
+    std::vector<unsigned> m_freeSlots; // Stack of free slot indexes. Next free slot is back().
+    unsigned const m_slotCount;
+    unsigned m_slotsActive;
+    std::atomic<double> m_millisecondsPerItem; // Written by launcher, read by reader thread.
+    Stats m_stats;
+    TextToolsUniqueHandle m_statsFile; // --stats=FILE, or null for stderr.
     ExitCode m_exitCode;
     TextToolsUniqueHandle m_conin;
     TextToolsUniqueHandle m_nul;
@@ -40,23 +77,53 @@ public:
     void
     WaitForAllProcessesToExit();
 
+    /*
+    Average runtime per input item of recently-exited commands, or 0 if no
+    command has exited yet. Thread-safe.
+    */
+    double
+    MillisecondsPerItem() const noexcept;
+
+    void
+    StartProcess(_In_ PWSTR commandLine, unsigned itemCount);
+
+    /*
+    Called by the launcher with the time it spent waiting for the next
+    command. Counts toward the --stats input wait if a slot was free.
+    */
+    void
+    AddInputWait(ULONGLONG ticks) noexcept;
+
+    /*
+    Writes the --stats summary to the stats file or to stderr. Call after
+    WaitForAllProcessesToExit.
+    */
     void
-    StartProcess(_In_ PWSTR commandLine);
+    WriteStats();
 
 private:
 
+    static void CALLBACK
+    ProcessExitCallback(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WAIT, TP_WAIT_RESULT) noexcept;
+
     TextToolsUniqueHandle
     OpenInputDevice(PCWSTR name) noexcept;
 
     _Success_(return) bool
-    AcquireSlotIndex(_Out_ UINT8* pSlotIndex);
+    AcquireSlotIndex(_Out_ unsigned* pSlotIndex);
 
     void
-    SetSlot(UINT8 slotIndex, TextToolsUniqueHandle value) noexcept;
+    SetSlot(unsigned slotIndex, TextToolsUniqueHandle value, unsigned itemCount) noexcept;
 
     TextToolsUniqueHandle
-    ClearSlot(UINT8 slotIndex) noexcept;
+    ClearSlot(unsigned slotIndex) noexcept;
 
     bool
     WaitForProcessExit(bool block);
+
+    void
+    RecordProcessStats(unsigned slotIndex, HANDLE hProcess, DWORD processExitCode);
+
+    void
+    WriteStatsLine(_In_z_ PCSTR format, ...);
 };
@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <string_view>
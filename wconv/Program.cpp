@@ -38,6 +38,10 @@ Converts text from one encoding to another. Similar to the "iconv" tool.
                              '--replace --oNoWarn'.
 -n NEWLINE, --newline=...    Newline output behavior: CRLF, LF, or PRESERVE.
                              Default: PRESERVE.
+--check                      Check that input is valid for the input encoding
+                             without writing any output. Reports the line,
+                             column, and offset (after any BOM) of the first
+                             invalid character of each input.
 
 If -l or --list is specified, show supported encodings and exit.
 If -h or --help is specified, show usage and exit.
@@ -68,6 +72,9 @@ Examples:
 
   Copy text from clipboard (UTF-16) to output.txt (UTF-8 with BOM):
     wconv --iclip -o output.txt
+
+  Check that input.txt is valid UTF-8 (BOM optional):
+    wconv -f utf8bom --check input.txt
 )", stdout);
 
     return 1;
@@ -98,7 +105,11 @@ wmain(int argc, _In_count_(argc) PWSTR argv[])
             std::wstring_view val;
             if (ap.BeginDashDashArg())
             {
-                if (ap.CurrentArgNameMatches(1, L"from-code"))
+                if (ap.CurrentArgNameMatches(1, L"check"))
+                {
+                    wconv.SetCheck();
+                }
+                else if (ap.CurrentArgNameMatches(1, L"from-code"))
                 {
                     if (ap.GetLongArgVal(val, false))
                     {
@@ -9,6 +9,7 @@
 #include <CodeConvert.h>
 #include <TextInput.h>
 #include <TextOutput.h>
+#include <Transcoder.h>
 
 static constexpr std::wstring_view ClipboardFilename = L"<clipboard>";
 static constexpr std::wstring_view StdInFilename = L"<stdin>";
@@ -199,6 +200,12 @@ WConv::SetNoBestFit() noexcept
     m_noBestFit = true;
 }
 
+void
+WConv::SetCheck() noexcept
+{
+    m_check = true;
+}
+
 void
 WConv::SetSilent() noexcept
 {
@@ -291,6 +298,111 @@ WConv::FinalizeParameters()
     return true;
 }
 
+bool
+WConv::OpenInput(TextInput& input, std::wstring const& inputFilename, TextInputFlags extraFlags) const
+{
+    bool const inputClipboard = ClipboardFilename == inputFilename;
+    bool const inputCheckBom = m_inputEncoding.Specified
+        ? m_inputEncoding.Bom
+        : !inputClipboard; // Eat BOM from clipboard only if explicit '-b'.
+    TextInputFlags const inputFlags = extraFlags |
+        (inputCheckBom ? TextInputFlags::ConsumeBom : TextInputFlags::None) |
+        (m_replace ? TextInputFlags::None : TextInputFlags::InvalidMbcsError) |
+        TextInputFlags::CheckConsole |
+        TextInputFlags::ConsoleCtrlZ |
+        TextInputFlags::ReadAhead;
+    if (inputClipboard)
+    {
+        auto const status = input.OpenClipboard(inputFlags);
+        if (status != ERROR_SUCCESS)
+        {
+            fprintf(stderr, "%hs: warning : clipboard error %u. Clipboard not read.\n",
+                AppName, status);
+            input.OpenChars({}, inputFlags);
+        }
+    }
+    else if (StdInFilename == inputFilename)
+    {
+        input.OpenBorrowedHandle(GetStdHandle(STD_INPUT_HANDLE), m_inputEncoding.CodePage, inputFlags);
+    }
+    else
+    {
+        auto status = input.OpenFile(inputFilename.c_str(), m_inputEncoding.CodePage, inputFlags);
+        if (status != ERROR_SUCCESS)
+        {
+            fprintf(stderr, "%hs: warning : CreateFile error %u opening input file '%ls'. Skipping.\n",
+                AppName, status, inputFilename.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int
+WConv::RunCheck() const
+{
+    int returnCode = 0;
+
+    TextInput input;
+    for (auto const& inputFilename : m_inputFilenames)
+    {
+        if (!OpenInput(input, inputFilename, TextInputFlags::RawBytes))
+        {
+            continue;
+        }
+
+        try
+        {
+            if (input.IsRawBytes())
+            {
+                CodeConvert const codeConvert(input.CodePage());
+                CodeConvert::ValidateResult result;
+                LSTATUS status;
+                do
+                {
+                    status = codeConvert.Validate(input.Bytes(), result);
+                } while (status == ERROR_SUCCESS && input.ReadNextBytes(result.Consumed));
+
+                if (status == ERROR_SUCCESS && !input.Bytes().empty())
+                {
+                    // Incomplete character at end of input.
+                    status = ERROR_NO_UNICODE_TRANSLATION;
+                }
+
+                if (status == ERROR_NO_UNICODE_TRANSLATION)
+                {
+                    fprintf(stderr, "%ls(%zu,%zu): error : Input is not valid for encoding %u (offset %zu).\n",
+                        inputFilename.c_str(), result.Line, result.Column, input.CodePage(), result.Offset);
+                    returnCode = 1;
+                }
+                else if (status != ERROR_SUCCESS)
+                {
+                    fprintf(stderr, "%ls: error : Validation error %u.\n",
+                        inputFilename.c_str(), status);
+                    returnCode = 1;
+                }
+            }
+            else
+            {
+                // Console or clipboard input is already UTF-16. Conversion
+                // errors (if any) are thrown by ReadNextChars.
+                while (input.ReadNextChars())
+                {
+                }
+            }
+        }
+        catch (std::range_error const& ex)
+        {
+            fprintf(stderr, "%ls: error : %hs\n",
+                inputFilename.c_str(), ex.what());
+            returnCode = 1;
+        }
+    }
+
+    return returnCode;
+}
+
 int
 WConv::Run() const
 {
@@ -298,6 +410,7 @@ WConv::Run() const
     fprintf(stderr, "DEBUG: %hs", AppName);
     if (m_replace) fprintf(stderr, " -r");
     if (m_noBestFit) fprintf(stderr, " --no-best-fit");
+    if (m_check) fprintf(stderr, " --check");
     if (m_outputNoDefaultCharUsedWarning) fprintf(stderr, " --oNoWarn");
     if (m_outputDefault) fprintf(stderr, " --subst=\"%hc\"", m_outputDefaultChar);
     fprintf(stderr, " -n %hs", NewlineBehaviorToString(m_newlineBehavior));
@@ -313,6 +426,11 @@ WConv::Run() const
     fprintf(stderr, "\n");
 #endif // NDEBUG
 
+    if (m_check)
+    {
+        return RunCheck();
+    }
+
     int returnCode = 0;
     bool usedDefaultChar = false;
     bool* const pUsedDefaultChar = m_outputNoDefaultCharUsedWarning ? nullptr : &usedDefaultChar;
@@ -327,7 +445,8 @@ WConv::Run() const
         (outputInsertBom ? TextOutputFlags::InsertBom : TextOutputFlags::None) |
         (m_replace ? TextOutputFlags::None : TextOutputFlags::InvalidUtf16Error) |
         (m_noBestFit ? TextOutputFlags::NoBestFitChars : TextOutputFlags::None) |
-        TextOutputFlags::CheckConsole;
+        TextOutputFlags::CheckConsole |
+        TextOutputFlags::WriteBehind;
     if (outputClipboard)
     {
         output.OpenChars(outputFlags);
@@ -341,59 +460,89 @@ WConv::Run() const
         output.OpenFile(m_outputFilename.c_str(), m_outputEncoding.CodePage, outputFlags);
     }
 
-    TextInput input;
-    for (auto const& inputFilename : m_inputFilenames)
+    // File-to-file conversion can go directly from input bytes to output
+    // bytes. Newline conversion on bytes is supported for UTF-8 to UTF-8
+    // (TextInput ignores RawBytes if it needs to fold newlines in other
+    // encodings).
+    bool const outputBytes =
+        output.Mode() == TextOutputMode::File &&
+        (NewlineBehavior::Preserve == m_newlineBehavior || output.CodePage() == CodePageUtf8);
+    unsigned const mb2wcFlags = m_replace ? 0 : MB_ERR_INVALID_CHARS;
+
+    // Mapped input is converted in parallel (see WriteBytesParallel), so give
+    // each processor a few MB per batch. A batch needs a view of up to twice
+    // the chunk size plus the converted output, so limit it to 16 MB in a
+    // 32-bit process and to a fraction of available memory otherwise.
+    unsigned const processorCount = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    TextInputOptions inputOptions;
+    if (processorCount > 1)
     {
-        bool const inputClipboard = ClipboardFilename == inputFilename;
-        bool const inputCheckBom = m_inputEncoding.Specified
-            ? m_inputEncoding.Bom
-            : !inputClipboard; // Eat BOM from clipboard only if explicit '-b'.
-        TextInputFlags const inputFlags =
-            (NewlineBehavior::Preserve != m_newlineBehavior ? TextInputFlags::FoldCRLF : TextInputFlags::None) |
-            (inputCheckBom ? TextInputFlags::ConsumeBom : TextInputFlags::None) |
-            (m_replace ? TextInputFlags::None : TextInputFlags::InvalidMbcsError) |
-            TextInputFlags::CheckConsole |
-            TextInputFlags::ConsoleCtrlZ;
-        if (inputClipboard)
+        DWORDLONG chunkSizeMax = 0x10000000u;
+        if constexpr (sizeof(void*) < 8)
+        {
+            chunkSizeMax = 0x1000000u;
+        }
+        else
         {
-            auto const status = input.OpenClipboard(inputFlags);
-            if (status != ERROR_SUCCESS)
+            MEMORYSTATUSEX memoryStatus = { sizeof(memoryStatus) };
+            if (GlobalMemoryStatusEx(&memoryStatus) &&
+                memoryStatus.ullAvailPhys / 16 < chunkSizeMax)
             {
-                fprintf(stderr, "%hs: warning : clipboard error %u. Clipboard not read.\n",
-                    AppName, status);
-                input.OpenChars({}, inputFlags);
+                chunkSizeMax = memoryStatus.ullAvailPhys / 16;
             }
         }
-        else if (StdInFilename == inputFilename)
+
+        DWORDLONG const chunkSize = processorCount * 0x400000ull;
+        inputOptions.MappedChunkSize = chunkSize < chunkSizeMax
+            ? (unsigned)chunkSize
+            : (unsigned)chunkSizeMax;
+        if (inputOptions.MappedChunkSize < TextInputOptions().MappedChunkSize)
         {
-            input.OpenBorrowedHandle(GetStdHandle(STD_INPUT_HANDLE), m_inputEncoding.CodePage, inputFlags);
+            inputOptions.MappedChunkSize = TextInputOptions().MappedChunkSize;
         }
-        else
+    }
+
+    TextInput input(inputOptions);
+    for (auto const& inputFilename : m_inputFilenames)
+    {
+        TextInputFlags const inputFlags =
+            (NewlineBehavior::Preserve != m_newlineBehavior ? TextInputFlags::FoldCRLF : TextInputFlags::None) |
+            (outputBytes ? TextInputFlags::RawBytes : TextInputFlags::None);
+        if (!OpenInput(input, inputFilename, inputFlags))
         {
-            auto status = input.OpenFile(inputFilename.c_str(), m_inputEncoding.CodePage, inputFlags);
-            if (status != ERROR_SUCCESS)
-            {
-                fprintf(stderr, "%hs: warning : CreateFile error %u opening input file '%ls'. Skipping.\n",
-                    AppName, status, inputFilename.c_str());
-                continue;
-            }
+            continue;
         }
 
         try
         {
-            do
+            if (input.IsRawBytes())
             {
-                auto inputChars = input.Chars();
-                if (input.Mode() == TextInputMode::Console &&
-                    inputChars.ends_with(L'\x1A')) // Control-Z
+                Transcoder const transcoder(CodeConvert(input.CodePage()), CodeConvert(output.CodePage()));
+                size_t consumed;
+                do
                 {
-                    inputChars.remove_suffix(1);
-                    output.WriteChars(inputChars, m_outputDefault, pUsedDefaultChar);
-                    break;
-                }
+                    // Mode can change from Mapped to File if address space runs out.
+                    consumed = input.Mode() == TextInputMode::Mapped
+                        ? output.WriteBytesParallel(transcoder, input.Bytes(), mb2wcFlags, m_outputDefault, pUsedDefaultChar)
+                        : output.WriteBytes(transcoder, input.Bytes(), mb2wcFlags, m_outputDefault, pUsedDefaultChar);
+                } while (input.ReadNextBytes(consumed));
+            }
+            else
+            {
+                do
+                {
+                    auto inputChars = input.Chars();
+                    if (input.Mode() == TextInputMode::Console &&
+                        inputChars.ends_with(L'\x1A')) // Control-Z
+                    {
+                        inputChars.remove_suffix(1);
+                        output.WriteChars(inputChars, m_outputDefault, pUsedDefaultChar);
+                        break;
+                    }
 
-                output.WriteChars(inputChars, m_outputDefault, pUsedDefaultChar);
-            } while (input.ReadNextChars());
+                    output.WriteChars(inputChars, m_outputDefault, pUsedDefaultChar);
+                } while (input.ReadNextChars());
+            }
         }
         catch (std::range_error const& ex)
         {
@@ -4,6 +4,8 @@
 #pragma once
 
 enum class CodePageCategory : UINT8;
+enum class TextInputFlags : uint8_t;
+class TextInput;
 
 class WConv
 {
@@ -26,6 +28,7 @@ class WConv
     Encoding m_outputEncoding = {};  // -t, --to-code
     bool m_replace = false;
     bool m_noBestFit = false;
+    bool m_check = false;
     NewlineBehavior m_newlineBehavior = {};
     bool m_outputNoDefaultCharUsedWarning = false;
     char m_outputDefaultChar = 0;
@@ -42,6 +45,14 @@ private:
     static [[nodiscard]] CodePageCategory
     ParseEncoding(std::wstring_view value, PCSTR argName, _Inout_ Encoding* pEncoding);
 
+    // Opens input with the flags common to all modes plus extraFlags.
+    // Returns false (after printing a warning) if the file could not be opened.
+    [[nodiscard]] bool
+    OpenInput(TextInput& input, std::wstring const& inputFilename, TextInputFlags extraFlags) const;
+
+    [[nodiscard]] int
+    RunCheck() const;
+
 public:
 
     [[nodiscard]] bool
@@ -80,6 +91,9 @@ public:
     void
     SetSilent() noexcept;
 
+    void
+    SetCheck() noexcept;
+
     [[nodiscard]] static int
     PrintSupportedEncodings();
 